@@ -0,0 +1,227 @@
+#include <SDL.h>
+#include <algorithm>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <boost/algorithm/string.hpp>
+#include "Animation.h"
+#include "Decoder.h"
+#include "Gfx.h"
+#include "LruCache.h"
+#include "Picture.h"
+#include "SurfaceTexture.h"
+#include "WorkerPool.h"
+
+// Like the region of the current picture, it is what is on screen.
+static const int AnimationQueue = 0;
+// If the next frame is that late (e.g. the window was hidden), the timing
+// restarts with it instead of skipping frames to catch up.
+static const Uint32 MaxLateMs = 1000;
+
+static auto &errors = std::cerr;
+using std::endl;
+
+namespace fs = boost::filesystem;
+
+AnimationPlayer animationPlayer;
+
+namespace {
+
+struct FrameCache : boost::noncopyable {
+	std::mutex mutex;
+	// By path. NULL for what turned out not to be animated, so that it is not tried again.
+	LruCache<std::string, std::shared_ptr<DecodedAnimation> > lru;
+	std::set<std::string> decoding;
+	// Rewritten while being decoded, what comes out is not put into lru.
+	std::set<std::string> stale;
+	FrameCache() : lru(AnimationPlayer::defaultCacheBudget()) {}
+};
+
+}
+
+// Never destroyed, workers might still put into it on exit.
+static FrameCache& frameCache = *new FrameCache();
+
+bool isAnimationFilename(const fs::path& path) {
+	std::string ext = path.extension().string();
+	boost::to_lower(ext);
+	return ext == ".gif" || ext == ".webp";
+}
+
+static void decodeJob(const std::string& path, int boxW, int boxH, size_t maxBytes) {
+	std::shared_ptr<DecodedAnimation> anim = decodeAnimation(path, boxW, boxH, maxBytes);
+	{
+		std::lock_guard<std::mutex> lock(frameCache.mutex);
+		frameCache.decoding.erase(path);
+		if(frameCache.stale.erase(path) == 0) {
+			frameCache.lru.put(path, anim, anim ? anim->bytes : 0);
+			frameCache.lru.evict();
+		}
+	}
+	pushDecodedEvent();
+}
+
+AnimationPlayer::AnimationPlayer()
+: m_boxW(0), m_boxH(0), m_decoding(false), m_frame(0), m_due(0),
+m_paused(false), m_pausedLeft(0), m_shown(0), m_skipped(0) {}
+
+size_t AnimationPlayer::defaultCacheBudget() {
+	// a 16th of the physical memory
+	size_t ram = (size_t) SDL_GetSystemRAM(); // in MB
+	if(ram == 0) ram = 1024;
+	return ram / 16 * 1024 * 1024;
+}
+
+bool AnimationPlayer::play(const fs::path& path, int boxW, int boxH) {
+	if(!isAnimationFilename(path)) {
+		stop();
+		return false;
+	}
+	if(path.string() != m_path) {
+		stop();
+		m_path = path.string();
+		m_boxW = boxW;
+		m_boxH = boxH;
+		m_decoding = true;
+		_poll();
+	}
+	return m_decoding || m_anim;
+}
+
+void AnimationPlayer::_poll() {
+	bool start = false;
+	size_t maxBytes = 0;
+	{
+		std::lock_guard<std::mutex> lock(frameCache.mutex);
+		auto* e = frameCache.lru.find(m_path);
+		if(e) {
+			m_decoding = false;
+			m_anim = e->value;
+		}
+		else if(frameCache.decoding.insert(m_path).second) {
+			start = true;
+			// So that at least two fit.
+			maxBytes = frameCache.lru.budget() / 2;
+		}
+	}
+	if(m_anim) {
+		m_textures.assign(m_anim->frames.size(), std::shared_ptr<SurfaceTexture>());
+		m_frame = 0;
+		m_due = SDL_GetTicks() + m_anim->delays[0];
+		m_shown = 1;
+		m_skipped = 0;
+	}
+	if(start) {
+		const std::string path = m_path;
+		const int boxW = m_boxW, boxH = m_boxH;
+		auto job = [path, boxW, boxH, maxBytes]() { decodeJob(path, boxW, boxH, maxBytes); };
+		if(workerPool.numThreads() > 0)
+			workerPool.push(AnimationQueue, job);
+		else {
+			job();
+			_poll();
+		}
+	}
+}
+
+void AnimationPlayer::stop() {
+	// A decode which is still running finishes into the cache.
+	m_path.clear();
+	m_decoding = false;
+	m_anim.reset();
+	m_textures.clear();
+	m_frame = 0;
+	m_paused = false;
+	m_shown = m_skipped = 0;
+}
+
+void AnimationPlayer::togglePause() {
+	if(!m_anim) return;
+	const Uint32 now = SDL_GetTicks();
+	if(m_paused)
+		m_due = now + m_pausedLeft;
+	else
+		m_pausedLeft = (Sint32(m_due - now) > 0) ? m_due - now : 0;
+	m_paused = !m_paused;
+}
+
+void AnimationPlayer::size(int& w, int& h) const {
+	w = m_anim ? m_anim->fullW : 0;
+	h = m_anim ? m_anim->fullH : 0;
+}
+
+void AnimationPlayer::_advance() {
+	if(m_paused) return;
+	const Uint32 now = SDL_GetTicks();
+	if(Sint32(now - m_due) < 0) return;
+	const size_t n = m_anim->frames.size();
+	if(now - m_due > MaxLateMs) {
+		m_frame = (m_frame + 1) % n;
+		m_due = now + m_anim->delays[m_frame];
+		m_shown++;
+		return;
+	}
+	// All which are due, but only the last one is shown.
+	bool first = true;
+	while(Sint32(now - m_due) >= 0) {
+		if(!first) m_skipped++;
+		first = false;
+		m_frame = (m_frame + 1) % n;
+		m_due += m_anim->delays[m_frame];
+	}
+	m_shown++;
+}
+
+bool AnimationPlayer::render(const Viewport& viewport) {
+	if(m_decoding) _poll();
+	if(!m_anim) return false;
+	_advance();
+	std::shared_ptr<SurfaceTexture>& texture = m_textures[m_frame];
+	if(!texture) {
+		texture.reset(new SurfaceTexture(rendererRef, m_anim->frames[m_frame]));
+		if(!*texture)
+			errors << "cannot create texture for frame " << m_frame << " of " << m_path << endl;
+	}
+	if(!*texture) return false;
+	SDL_Rect src, dst;
+	if(viewport.rects(texture->width(), texture->height(), src, dst))
+		texture->render(&src, &dst);
+	return true;
+}
+
+int AnimationPlayer::timeoutMs() const {
+	if(!m_anim || m_paused) return -1;
+	const Sint32 left = Sint32(m_due - SDL_GetTicks());
+	return std::max(left, 0);
+}
+
+AnimationPlayer::Stats AnimationPlayer::stats() const {
+	Stats s;
+	s.frames = m_anim ? m_anim->frames.size() : 0;
+	s.shown = m_shown;
+	s.skipped = m_skipped;
+	std::lock_guard<std::mutex> lock(frameCache.mutex);
+	s.cacheBytes = frameCache.lru.bytes();
+	s.cacheCount = frameCache.lru.size();
+	return s;
+}
+
+void AnimationPlayer::setCacheBudget(size_t bytes) {
+	std::lock_guard<std::mutex> lock(frameCache.mutex);
+	frameCache.lru.setBudget(bytes);
+	frameCache.lru.evict();
+}
+
+void AnimationPlayer::invalidate(const fs::path& path) {
+	if(path.string() == m_path) stop();
+	std::lock_guard<std::mutex> lock(frameCache.mutex);
+	frameCache.lru.erase(path.string());
+	if(frameCache.decoding.count(path.string()))
+		frameCache.stale.insert(path.string());
+}
+
+void AnimationPlayer::clear() {
+	stop();
+	std::lock_guard<std::mutex> lock(frameCache.mutex);
+	frameCache.lru.clear();
+}
@@ -0,0 +1,84 @@
+#ifndef __ImageViewer_Animation_h__
+#define __ImageViewer_Animation_h__
+
+#include <stddef.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include <SDL.h>
+#include <boost/filesystem.hpp>
+#include <boost/noncopyable.hpp>
+#include "Viewport.h"
+
+struct DecodedAnimation;
+class SurfaceTexture;
+
+// Whether it might be animated, by its extension (GIF, WebP).
+bool isAnimationFilename(const boost::filesystem::path& path);
+
+/*
+Plays the current picture if it is animated.
+A worker decodes all frames once (decodeAnimation(): composited up front,
+reduced to the view) into the frame cache, an LRU over whole animations
+accounted in bytes against a budget. So neither looping nor coming back
+to an animation composites or decodes anything again.
+Each frame gets its own texture when it is shown the first time, thus from
+the second loop on, playing is just drawing another texture. The main
+loop sleeps until timeoutMs(), when the next frame is due.
+Until the frames are there, and for pictures which turn out not to be
+animated, the still picture is shown as usual.
+UI thread only.
+*/
+class AnimationPlayer : boost::noncopyable {
+public:
+	struct Stats {
+		size_t frames, shown, skipped;
+		size_t cacheBytes, cacheCount;
+	};
+
+	AnimationPlayer();
+
+	// Starts playing path if it is animated, decoding it fitted into boxW x boxH
+	// unless it is in the cache. Stops what played before.
+	// Returns whether path might play, i.e. it is or might become isPlaying().
+	bool play(const boost::filesystem::path& path, int boxW, int boxH);
+	void stop();
+	// Whether there are frames.
+	bool isPlaying() const { return m_anim.get() != NULL; }
+	void togglePause();
+	// Of the original, 0 if it does not play (yet).
+	void size(int& w, int& h) const;
+
+	// Advances to the frame which is due and draws it. false if there are no frames (yet).
+	bool render(const Viewport& viewport);
+	// Until the next frame is due, -1 if there is nothing to wait for.
+	int timeoutMs() const;
+	Stats stats() const;
+
+	void setCacheBudget(size_t bytes);
+	static size_t defaultCacheBudget();
+	// path was rewritten or removed. Drops its frames, stops it if it plays.
+	void invalidate(const boost::filesystem::path& path);
+	// Drops the textures and the cache. Before the renderer goes away.
+	void clear();
+
+private:
+	std::string m_path;
+	int m_boxW, m_boxH;
+	bool m_decoding; // path is being decoded
+	std::shared_ptr<DecodedAnimation> m_anim;
+	std::vector<std::shared_ptr<SurfaceTexture> > m_textures; // [i] for frame i, NULL until shown
+	size_t m_frame;
+	Uint32 m_due; // SDL_GetTicks() when the frame after m_frame is due
+	bool m_paused;
+	Uint32 m_pausedLeft; // how long m_frame still had to be shown
+	size_t m_shown, m_skipped;
+
+	// Takes the frames from the cache, once the worker put them there.
+	void _poll();
+	void _advance();
+};
+
+extern AnimationPlayer animationPlayer;
+
+#endif
@@ -0,0 +1,401 @@
+#include <sys/resource.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <thread>
+#include <SDL.h>
+#include "Bench.h"
+#include "Gfx.h"
+#include "Pictures.h"
+#include "Decoder.h"
+#include "SurfaceTexture.h"
+#include "PixelKernels.h"
+#include "PixelPool.h"
+#include "Font.h"
+#include "Video.h"
+#include "Animation.h"
+
+static auto &errors = std::cerr;
+static auto &notes = std::cout;
+using std::endl;
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+enum Metric { Decode, Create, UpdateArea, Upload, Render, Region, NumMetrics };
+const char* MetricNames[NumMetrics] = { "decodeMs", "createMs", "updateAreaMs", "uploadMs", "renderMs", "regionMs" };
+// Decoded per video for videoFps. Four seconds at 30 fps.
+const int VideoFrames = 120;
+
+struct Sample {
+	std::string path;
+	bool ok;
+	bool regionOk; // the format supports decodePictureRegion()
+	int fullW, fullH, decodedW, decodedH;
+	double ms[NumMetrics];
+	double videoFps; // decoding only, 0 if it is not a video
+	int animationFrames; // 0 if it is not animated
+	double animationMs; // decodeAnimation()
+};
+
+struct Timer {
+	Uint64 start;
+	Timer() : start(SDL_GetPerformanceCounter()) {}
+	double ms() const { return double(SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency(); }
+};
+
+std::string jsonString(const std::string& s) {
+	std::string r = "\"";
+	for(char c : s) {
+		switch(c) {
+			case '"': r += "\\\""; break;
+			case '\\': r += "\\\\"; break;
+			case '\n': r += "\\n"; break;
+			case '\t': r += "\\t"; break;
+			default:
+				if((unsigned char) c < 0x20) {
+					char buf[8];
+					snprintf(buf, sizeof(buf), "\\u%04x", c);
+					r += buf;
+				}
+				else r += c;
+		}
+	}
+	return r + "\"";
+}
+
+// Nearest rank. v must be sorted.
+double percentile(const std::vector<double>& v, double p) {
+	if(v.empty()) return 0;
+	size_t rank = size_t(p / 100.0 * v.size() + 0.999999);
+	return v[std::min(std::max(rank, size_t(1)), v.size()) - 1];
+}
+
+// Synthetic rows for the kernels. Odd width, so that the scalar tails are used as well.
+const int KernelW = 1921, KernelH = 1080;
+const size_t KernelRowBytes = KernelW * 4;
+
+struct Kernel {
+	const char* name;
+	size_t outBytes;
+	// Prepares the output for run(). Not measured.
+	void (*prepare)(const std::vector<Uint8>& in, std::vector<Uint8>& out);
+	void (*run)(const PixelKernels& k, const std::vector<Uint8>& in, std::vector<Uint8>& out);
+};
+
+void prepareZero(const std::vector<Uint8>&, std::vector<Uint8>& out) { std::fill(out.begin(), out.end(), 0); }
+void prepareCopy(const std::vector<Uint8>& in, std::vector<Uint8>& out) { std::copy(in.begin(), in.begin() + out.size(), out.begin()); }
+
+const Kernel Kernels[] = {
+	{"rgb24ToArgb", KernelRowBytes * KernelH, prepareZero,
+		[](const PixelKernels& k, const std::vector<Uint8>& in, std::vector<Uint8>& out) {
+			for(int y = 0; y < KernelH; ++y)
+				k.rgb24ToArgb(&in[y * KernelW * 3], (Uint32*) &out[y * KernelRowBytes], KernelW);
+		}},
+	{"bgr24ToArgb", KernelRowBytes * KernelH, prepareZero,
+		[](const PixelKernels& k, const std::vector<Uint8>& in, std::vector<Uint8>& out) {
+			for(int y = 0; y < KernelH; ++y)
+				k.bgr24ToArgb(&in[y * KernelW * 3], (Uint32*) &out[y * KernelRowBytes], KernelW);
+		}},
+	{"abgrToArgb", KernelRowBytes * KernelH, prepareCopy,
+		[](const PixelKernels& k, const std::vector<Uint8>&, std::vector<Uint8>& out) {
+			for(int y = 0; y < KernelH; ++y)
+				k.abgrToArgb((Uint32*) &out[y * KernelRowBytes], KernelW);
+		}},
+	{"premultiply", KernelRowBytes * KernelH, prepareCopy,
+		[](const PixelKernels& k, const std::vector<Uint8>&, std::vector<Uint8>& out) {
+			for(int y = 0; y < KernelH; ++y)
+				k.premultiply((Uint32*) &out[y * KernelRowBytes], KernelW);
+		}},
+	{"halveRow", KernelW / 2 * 4 * (KernelH / 2), prepareZero,
+		[](const PixelKernels& k, const std::vector<Uint8>& in, std::vector<Uint8>& out) {
+			for(int y = 0; y < KernelH / 2; ++y)
+				k.halveRow(&in[y * 2 * KernelRowBytes], &in[(y * 2 + 1) * KernelRowBytes], &out[y * (KernelW / 2) * 4], KernelW / 2);
+		}},
+	{"accumulateRow", KernelRowBytes * 4 * KernelH, prepareZero,
+		[](const PixelKernels& k, const std::vector<Uint8>& in, std::vector<Uint8>& out) {
+			for(int y = 0; y < KernelH; ++y)
+				k.accumulateRow(&in[y * KernelRowBytes], (Uint32*) &out[y * KernelRowBytes * 4], KernelRowBytes, 1 + (y * 97) % (1 << 15));
+		}},
+};
+const int NumKernels = sizeof(Kernels) / sizeof(Kernels[0]);
+
+struct KernelSample {
+	std::string variant;
+	int kernel;
+	double ms; // best of a few runs
+};
+
+// Runs all kernels in all variants this CPU supports on the same random input.
+// That they give the same output is checked by the tests.
+std::vector<KernelSample> benchKernels() {
+	std::vector<Uint8> in(KernelRowBytes * KernelH);
+	Uint32 r = 2463534242u;
+	for(auto& b : in) {
+		// xorshift
+		r ^= r << 13; r ^= r >> 17; r ^= r << 5;
+		b = Uint8(r);
+	}
+
+	std::vector<KernelSample> res;
+	std::vector<Uint8> out;
+	for(int i = 0; i < NumKernels; ++i) {
+		const Kernel& kernel = Kernels[i];
+		for(const PixelKernels* k : supportedPixelKernels()) {
+			out.resize(kernel.outBytes);
+			KernelSample s;
+			s.variant = k->name;
+			s.kernel = i;
+			s.ms = 0;
+			for(int run = 0; run < 3; ++run) {
+				kernel.prepare(in, out);
+				Timer t;
+				kernel.run(*k, in, out);
+				const double ms = t.ms();
+				if(run == 0 || ms < s.ms) s.ms = ms;
+			}
+			res.push_back(s);
+		}
+	}
+	return res;
+}
+
+// How SmartPointer counted before: an int and an SDL_mutex per object,
+// locked for every copy and destroy. Only to compare against.
+struct MutexRef {
+	int* obj;
+	int* refCount;
+	SDL_mutex* mutex;
+	MutexRef(int* o) : obj(o), refCount(new int(1)), mutex(SDL_CreateMutex()) {}
+	MutexRef(const MutexRef& r) : obj(r.obj), refCount(r.refCount), mutex(r.mutex) {
+		SDL_LockMutex(mutex);
+		(*refCount)++;
+		SDL_UnlockMutex(mutex);
+	}
+	int* get() const { return obj; }
+	~MutexRef() {
+		SDL_LockMutex(mutex);
+		const bool last = --(*refCount) == 0;
+		SDL_UnlockMutex(mutex);
+		if(!last) return;
+		delete obj;
+		delete refCount;
+		SDL_DestroyMutex(mutex);
+	}
+};
+
+const int RefCopies = 1000000;
+const int RefThreads = 4;
+
+// ns per copy + destroy of a shared pointer, in `threads` threads at once on the same object.
+template<typename Ref>
+double benchRefCopies(const Ref& orig, int threads) {
+	Timer t;
+	std::vector<std::thread> ts;
+	for(int i = 0; i < threads; ++i)
+		ts.push_back(std::thread([&orig]() {
+			for(int n = 0; n < RefCopies; ++n) {
+				Ref copy(orig);
+				// so that the compiler does not drop it
+				if(!copy.get()) abort();
+			}
+		}));
+	for(auto& th : ts) th.join();
+	return t.ms() * 1e6 / RefCopies;
+}
+
+const int TextFrames = 1000;
+
+// ms per frame of overlay text which changes every frame, like the counters.
+double benchText() {
+	char buf[64];
+	Timer t;
+	for(int i = 0; i < TextFrames; ++i) {
+		snprintf(buf, sizeof(buf), "%i/45000  %.2f ms", i, i * 0.01);
+		drawText(buf, 0, 0, ColorWhite());
+	}
+	return t.ms() / TextFrames;
+}
+
+long peakRssKB() {
+	struct rusage usage;
+	if(getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+	return usage.ru_maxrss / 1024; // bytes there
+#else
+	return usage.ru_maxrss;
+#endif
+}
+
+}
+
+int runBench(const fs::path& out) {
+	// Wait for the directory scan.
+	while(pictures.m_scanner.isRunning())
+		SDL_Delay(1);
+	while(pictures.pollScan()) {}
+
+	int viewW = 0, viewH = 0;
+	SDL_GetRendererOutputSize(renderer, &viewW, &viewH);
+	const SDL_Rect viewRect = {0, 0, viewW, viewH};
+
+	std::vector<Sample> samples;
+	Timer total;
+	for(size_t i = 0; i < pictures.size(); ++i) {
+		Sample s;
+		s.path = pictures.m_catalogue.pathAt(i).string();
+		s.ok = s.regionOk = false;
+		s.fullW = s.fullH = s.decodedW = s.decodedH = 0;
+		std::fill(s.ms, s.ms + NumMetrics, 0.0);
+		s.videoFps = 0;
+		s.animationFrames = 0;
+		s.animationMs = 0;
+
+		Timer t;
+		SmartPointer<SDL_Surface> surf = decodePicture(pictures.m_catalogue.pathAt(i), viewW, viewH, &s.fullW, &s.fullH);
+		s.ms[Decode] = t.ms();
+		if(surf.get()) {
+			s.ok = true;
+			s.decodedW = surf->w;
+			s.decodedH = surf->h;
+
+			t = Timer();
+			SurfaceTexture tex(rendererRef, surf);
+			s.ms[Create] = t.ms();
+
+			t = Timer();
+			tex.updateArea(NULL);
+			s.ms[UpdateArea] = t.ms();
+
+			// The first render creates and uploads the tiles.
+			t = Timer();
+			tex.render(NULL, &viewRect);
+			s.ms[Upload] = t.ms();
+
+			t = Timer();
+			tex.render(NULL, &viewRect);
+			s.ms[Render] = t.ms();
+			SDL_RenderPresent(renderer);
+
+			// A view at 1:1 in the center, as when zoomed into a huge picture.
+			SDL_Rect region = {(s.fullW - viewW) / 2, (s.fullH - viewH) / 2, viewW, viewH};
+			int w = 0, h = 0;
+			t = Timer();
+			SmartPointer<SDL_Surface> part = decodePictureRegion(pictures.m_catalogue.pathAt(i), region, viewW, viewH, &w, &h);
+			s.ms[Region] = t.ms();
+			s.regionOk = part.get() != NULL;
+
+			if(isVideoFilename(pictures.m_catalogue.pathAt(i)))
+				s.videoFps = benchVideoDecode(pictures.m_catalogue.pathAt(i), VideoFrames);
+
+			if(isAnimationFilename(pictures.m_catalogue.pathAt(i))) {
+				t = Timer();
+				std::shared_ptr<DecodedAnimation> anim = decodeAnimation(pictures.m_catalogue.pathAt(i),
+					viewW, viewH, AnimationPlayer::defaultCacheBudget() / 2);
+				s.animationMs = t.ms();
+				s.animationFrames = anim ? int(anim->frames.size()) : 0;
+			}
+		}
+		samples.push_back(s);
+	}
+	const double totalMs = total.ms();
+
+	const std::vector<KernelSample> kernelSamples = benchKernels();
+
+	double refNs[2][2]; // [mutex, atomic][1 thread, RefThreads]
+	for(int t = 0; t < 2; ++t) {
+		const int threads = t ? RefThreads : 1;
+		refNs[0][t] = benchRefCopies(MutexRef(new int(1)), threads);
+		refNs[1][t] = benchRefCopies(SmartPointer<int>(new int(1)), threads);
+	}
+	const double textFrameMs = benchText();
+
+	std::ostringstream json;
+	json << "{" << endl;
+	json << "  \"view\": {\"width\": " << viewW << ", \"height\": " << viewH << "}," << endl;
+	json << "  \"count\": " << samples.size() << "," << endl;
+	size_t failed = 0;
+	for(auto& s : samples)
+		if(!s.ok) failed++;
+	json << "  \"failed\": " << failed << "," << endl;
+	json << "  \"totalMs\": " << totalMs << "," << endl;
+	json << "  \"peakRssKB\": " << peakRssKB() << "," << endl;
+	{
+		const PixelPool::Stats pool = pixelPool.stats();
+		json << "  \"pixelPool\": {\"hits\": " << pool.hits << ", \"misses\": " << pool.misses
+			<< ", \"usedBytes\": " << pool.usedBytes << ", \"pooledBytes\": " << pool.pooledBytes
+			<< ", \"peakBytes\": " << pool.peakBytes << "}," << endl;
+	}
+	json << "  \"kernels\": {" << endl;
+	json << "    \"selected\": " << jsonString(pixelKernels().name) << "," << endl;
+	json << "    \"size\": {\"width\": " << KernelW << ", \"height\": " << KernelH << "}," << endl;
+	json << "    \"results\": [" << endl;
+	for(size_t i = 0; i < kernelSamples.size(); ++i) {
+		const KernelSample& s = kernelSamples[i];
+		json << "      {\"kernel\": " << jsonString(Kernels[s.kernel].name) << ", \"variant\": " << jsonString(s.variant)
+			<< ", \"ms\": " << s.ms
+			<< "}" << (i + 1 < kernelSamples.size() ? "," : "") << endl;
+	}
+	json << "    ]" << endl;
+	json << "  }," << endl;
+	json << "  \"smartPointer\": {" << endl;
+	json << "    \"copyNs\": {\"mutex\": " << refNs[0][0] << ", \"atomic\": " << refNs[1][0] << "}," << endl;
+	json << "    \"contendedCopyNs\": {\"threads\": " << RefThreads
+		<< ", \"mutex\": " << refNs[0][1] << ", \"atomic\": " << refNs[1][1] << "}" << endl;
+	json << "  }," << endl;
+	json << "  \"text\": {\"frames\": " << TextFrames << ", \"frameMs\": " << textFrameMs
+		<< ", \"glyphs\": " << textGlyphCount() << "}," << endl;
+	json << "  \"summary\": {" << endl;
+	for(int m = 0; m < NumMetrics; ++m) {
+		std::vector<double> v;
+		double sum = 0;
+		for(auto& s : samples)
+			if(s.ok && (m != Region || s.regionOk)) {
+				v.push_back(s.ms[m]);
+				sum += s.ms[m];
+			}
+		std::sort(v.begin(), v.end());
+		json << "    \"" << MetricNames[m] << "\": {"
+			<< "\"mean\": " << (v.empty() ? 0 : sum / v.size())
+			<< ", \"p50\": " << percentile(v, 50)
+			<< ", \"p95\": " << percentile(v, 95)
+			<< ", \"p99\": " << percentile(v, 99)
+			<< ", \"max\": " << (v.empty() ? 0 : v.back())
+			<< "}" << (m + 1 < NumMetrics ? "," : "") << endl;
+	}
+	json << "  }," << endl;
+	json << "  \"pictures\": [" << endl;
+	for(size_t i = 0; i < samples.size(); ++i) {
+		const Sample& s = samples[i];
+		json << "    {\"path\": " << jsonString(s.path) << ", \"ok\": " << (s.ok ? "true" : "false");
+		if(s.ok) {
+			json << ", \"width\": " << s.fullW << ", \"height\": " << s.fullH
+				<< ", \"decodedWidth\": " << s.decodedW << ", \"decodedHeight\": " << s.decodedH;
+			for(int m = 0; m < NumMetrics; ++m)
+				if(m != Region || s.regionOk)
+					json << ", \"" << MetricNames[m] << "\": " << s.ms[m];
+			if(s.videoFps > 0)
+				json << ", \"videoFps\": " << s.videoFps;
+			if(s.animationFrames > 0)
+				json << ", \"animationFrames\": " << s.animationFrames << ", \"animationMs\": " << s.animationMs;
+		}
+		json << "}" << (i + 1 < samples.size() ? "," : "") << endl;
+	}
+	json << "  ]" << endl;
+	json << "}" << endl;
+
+	std::ofstream f(out.string().c_str());
+	f << json.str();
+	if(!f) {
+		errors << "cannot write " << out << endl;
+		return 1;
+	}
+	notes << "Bench: " << samples.size() << " pictures in " << totalMs << " ms, written to " << out << endl;
+	return failed == samples.size() && !samples.empty() ? 1 : 0;
+}
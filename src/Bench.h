@@ -0,0 +1,23 @@
+#ifndef __ImageViewer_Bench_h__
+#define __ImageViewer_Bench_h__
+
+#include <boost/filesystem.hpp>
+
+/*
+Headless benchmark (--bench). Goes through all loaded pictures, one after
+another in this thread, and measures for each:
+decode (fitted into the view), creation of the SurfaceTexture,
+updateArea() of the whole picture, the first render() (which does the
+texture upload) and a second render() (draw only).
+Then it measures all variants of the pixel kernels (PixelKernels.h) on
+synthetic data, the SmartPointer copies and the overlay text.
+Correctness is checked by the tests (tests/), not here.
+Writes the per-picture times, their percentiles, the kernel results, the
+pixel pool statistics and the peak RSS as JSON to `out`.
+Fails if no picture could be decoded.
+main() sets up the dummy video driver and the software renderer for it,
+so it needs neither a display nor a GPU.
+*/
+int runBench(const boost::filesystem::path& out);
+
+#endif
@@ -0,0 +1,273 @@
+#include <sys/stat.h>
+#include <time.h>
+#include <ctype.h>
+#include <string.h>
+#include <algorithm>
+#include <thread>
+#include "Catalogue.h"
+#include "Exif.h"
+
+namespace fs = boost::filesystem;
+
+// Below that, it is not worth to start threads.
+static const size_t ParallelMinCount = 4096;
+
+static size_t numParallel(size_t count) {
+	if(count < ParallelMinCount) return 1;
+	size_t n = std::thread::hardware_concurrency();
+	return std::max<size_t>(std::min<size_t>(n, 16), 1);
+}
+
+// Calls f(begin, end) on numParallel() about equally sized chunks of [0, count).
+template<typename F>
+static void parallelChunks(size_t count, size_t n, F f) {
+	if(n <= 1) { f(size_t(0), count); return; }
+	std::vector<std::thread> threads;
+	for(size_t i = 1; i < n; ++i)
+		threads.push_back(std::thread(f, count * i / n, count * (i + 1) / n));
+	f(size_t(0), count / n);
+	for(auto& t : threads)
+		t.join();
+}
+
+// Stable sort. The chunks are sorted in parallel and then merged.
+template<typename Less>
+static void parallelSort(std::vector<Catalogue::Id>::iterator begin, std::vector<Catalogue::Id>::iterator end, Less less) {
+	const size_t count = end - begin;
+	const size_t n = numParallel(count);
+	parallelChunks(count, n, [&](size_t a, size_t b) {
+		std::stable_sort(begin + a, begin + b, less);
+	});
+	for(size_t width = 1; width < n; width *= 2)
+		for(size_t i = 0; i + width < n; i += 2 * width)
+			std::inplace_merge(
+					begin + count * i / n,
+					begin + count * (i + width) / n,
+					begin + count * std::min(i + 2 * width, n) / n,
+					less);
+}
+
+// Sorts [from, end) and merges it into the already sorted [0, from).
+template<typename Less>
+static void sortAndMerge(std::vector<Catalogue::Id>& order, size_t from, Less less) {
+	parallelSort(order.begin() + from, order.end(), less);
+	if(from > 0)
+		std::inplace_merge(order.begin(), order.begin() + from, order.end(), less);
+}
+
+int naturalCompare(const std::string& a, const std::string& b) {
+	size_t i = 0, j = 0;
+	while(i < a.size() && j < b.size()) {
+		if(isdigit((unsigned char) a[i]) && isdigit((unsigned char) b[j])) {
+			// skip leading zeros, then the longer number is the larger one
+			while(i < a.size() && a[i] == '0') ++i;
+			while(j < b.size() && b[j] == '0') ++j;
+			size_t ie = i, je = j;
+			while(ie < a.size() && isdigit((unsigned char) a[ie])) ++ie;
+			while(je < b.size() && isdigit((unsigned char) b[je])) ++je;
+			if(ie - i != je - j) return (ie - i < je - j) ? -1 : 1;
+			for(; i < ie; ++i, ++j)
+				if(a[i] != b[j]) return (a[i] < b[j]) ? -1 : 1;
+			continue;
+		}
+		const int ca = tolower((unsigned char) a[i]), cb = tolower((unsigned char) b[j]);
+		if(ca != cb) return (ca < cb) ? -1 : 1;
+		++i; ++j;
+	}
+	if(i < a.size()) return 1;
+	if(j < b.size()) return -1;
+	return a.compare(b); // e.g. only different in case or leading zeros
+}
+
+static int64_t dateKey(const struct tm& t) {
+	return (((((int64_t) t.tm_year + 1900) * 100 + t.tm_mon + 1) * 100 + t.tm_mday) * 100 + t.tm_hour) * 10000
+		+ t.tm_min * 100 + t.tm_sec;
+}
+
+// "YYYY:MM:DD HH:MM:SS"
+static bool parseExifDate(const std::string& s, int64_t& key) {
+	struct tm t;
+	memset(&t, 0, sizeof(t));
+	if(sscanf(s.c_str(), "%d:%d:%d %d:%d:%d", &t.tm_year, &t.tm_mon, &t.tm_mday, &t.tm_hour, &t.tm_min, &t.tm_sec) != 6)
+		return false;
+	if(t.tm_year <= 0) return false; // "0000:00:00 00:00:00" is used for unknown
+	t.tm_year -= 1900;
+	t.tm_mon -= 1;
+	key = dateKey(t);
+	return true;
+}
+
+Catalogue::Id Catalogue::add(fs::path path) {
+	const Id id = Id(paths.size());
+	paths.push_back(std::move(path));
+	states.push_back(std::shared_ptr<PictureState>());
+	sizes.push_back(0);
+	mtimes.push_back(0);
+	dates.push_back(0);
+	widths.push_back(0);
+	heights.push_back(0);
+	flags.push_back(0);
+	positions.push_back(order.size());
+	order.push_back(id);
+	if(m_haveByPath) m_byPath[paths[id].string()] = id;
+	return id;
+}
+
+bool Catalogue::exists(size_t pos) {
+	const Id id = order[pos];
+	if(!(flags[id] & HaveStat)) {
+		struct stat st;
+		if(stat(paths[id].string().c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+			sizes[id] = st.st_size;
+			mtimes[id] = st.st_mtime;
+		}
+		else
+			flags[id] |= Missing;
+		flags[id] |= HaveStat;
+	}
+	return !(flags[id] & Missing);
+}
+
+void Catalogue::clear() {
+	paths.clear();
+	states.clear();
+	sizes.clear();
+	mtimes.clear();
+	dates.clear();
+	widths.clear();
+	heights.clear();
+	flags.clear();
+	order.clear();
+	positions.clear();
+	m_byPath.clear();
+	m_haveByPath = false;
+}
+
+bool Catalogue::find(const fs::path& path, Id& id) const {
+	if(!m_haveByPath) {
+		m_byPath.reserve(paths.size());
+		for(Id i = 0; i < paths.size(); ++i)
+			if(!(flags[i] & Removed)) m_byPath[paths[i].string()] = i;
+		m_haveByPath = true;
+	}
+	auto it = m_byPath.find(path.string());
+	if(it == m_byPath.end()) return false;
+	id = it->second;
+	return true;
+}
+
+void Catalogue::remove(const std::vector<Id>& ids) {
+	if(ids.empty()) return;
+	for(Id id : ids) {
+		if(m_haveByPath) m_byPath.erase(paths[id].string());
+		paths[id] = fs::path();
+		states[id].reset();
+		flags[id] = Removed;
+		positions[id] = size_t(-1);
+	}
+	// One pass for the whole batch.
+	order.erase(std::remove_if(order.begin(), order.end(), [this](Id id) { return flags[id] & Removed; }), order.end());
+	_updatePositions(0);
+}
+
+void Catalogue::invalidate(const std::vector<Id>& ids, bool moveToTail) {
+	if(ids.empty()) return;
+	for(Id id : ids) {
+		states[id].reset();
+		flags[id] = 0;
+		sizes[id] = 0;
+		mtimes[id] = 0;
+		dates[id] = 0;
+		widths[id] = heights[id] = 0;
+	}
+	if(!moveToTail) return;
+	std::vector<uint8_t> moved(paths.size(), 0);
+	for(Id id : ids) moved[id] = 1;
+	std::stable_partition(order.begin(), order.end(), [&](Id id) { return !moved[id]; });
+	_updatePositions(0);
+}
+
+void Catalogue::_loadMetadata(const std::vector<Id>& ids, SortMode mode) {
+	const uint8_t needed = (mode == SortDate) ? (HaveStat | HaveExif) : (mode == SortMTime || mode == SortSize) ? HaveStat : 0;
+	if(!needed) return;
+	std::vector<Id> missing;
+	for(Id id : ids)
+		if((flags[id] & needed) != needed) missing.push_back(id);
+	// Each thread writes only to its own entries.
+	// This is I/O bound, thus it pays off already for fewer entries.
+	parallelChunks(missing.size(), numParallel(missing.size() * 8), [&](size_t a, size_t b) {
+		for(size_t i = a; i < b; ++i) {
+			const Id id = missing[i];
+			if(!(flags[id] & HaveStat)) {
+				struct stat st;
+				if(stat(paths[id].string().c_str(), &st) == 0) {
+					sizes[id] = st.st_size;
+					mtimes[id] = st.st_mtime;
+				}
+				else
+					flags[id] |= Missing;
+			}
+			if((needed & HaveExif) && !(flags[id] & HaveExif)) {
+				ExifInfo info;
+				readExif(paths[id], info, false);
+				widths[id] = info.width;
+				heights[id] = info.height;
+				if(!parseExifDate(info.dateTimeOriginal, dates[id])) {
+					const time_t t = (time_t) mtimes[id];
+					struct tm tm;
+					localtime_r(&t, &tm);
+					dates[id] = dateKey(tm);
+				}
+			}
+			flags[id] |= needed;
+		}
+	});
+}
+
+void Catalogue::_updatePositions(size_t from) {
+	for(size_t pos = from; pos < order.size(); ++pos)
+		positions[order[pos]] = pos;
+}
+
+void Catalogue::sort(SortMode mode) {
+	sortTail(0, mode);
+}
+
+void Catalogue::sortTail(size_t from, SortMode mode) {
+	if(mode == SortNone || from >= order.size()) return;
+	const std::vector<Id> tail(order.begin() + from, order.end());
+	_loadMetadata(from == 0 ? order : tail, mode);
+
+	// Ties are broken by the name, so that it is deterministic.
+	auto nameLess = [this](Id a, Id b) { return naturalCompare(paths[a].string(), paths[b].string()) < 0; };
+	switch(mode) {
+		case SortName: sortAndMerge(order, from, nameLess); break;
+		case SortMTime:
+			sortAndMerge(order, from, [&](Id a, Id b) { return (mtimes[a] != mtimes[b]) ? (mtimes[a] < mtimes[b]) : nameLess(a, b); });
+			break;
+		case SortSize:
+			sortAndMerge(order, from, [&](Id a, Id b) { return (sizes[a] != sizes[b]) ? (sizes[a] < sizes[b]) : nameLess(a, b); });
+			break;
+		case SortDate:
+			sortAndMerge(order, from, [&](Id a, Id b) { return (dates[a] != dates[b]) ? (dates[a] < dates[b]) : nameLess(a, b); });
+			break;
+		default: break;
+	}
+	_updatePositions(0);
+}
+
+static const char* SortModeNames[Catalogue::NumSortModes] = { "none", "name", "mtime", "size", "date" };
+
+const char* Catalogue::sortModeName(SortMode mode) {
+	if(mode < 0 || mode >= NumSortModes) return "?";
+	return SortModeNames[mode];
+}
+
+bool Catalogue::parseSortMode(const std::string& s, SortMode& mode) {
+	for(int i = 0; i < NumSortModes; ++i)
+		if(s == SortModeNames[i]) {
+			mode = SortMode(i);
+			return true;
+		}
+	return false;
+}
@@ -0,0 +1,90 @@
+#ifndef __ImageViewer_Catalogue_h__
+#define __ImageViewer_Catalogue_h__
+
+#include <vector>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <stdint.h>
+#include <boost/filesystem.hpp>
+#include "Picture.h"
+
+/*
+All pictures we know about, stored as a structure of arrays, so that
+walking over one attribute (e.g. for sorting) only touches that memory.
+An entry is identified by its id, the index into these arrays, which
+stays the same as long as the catalogue is not cleared.
+The display order is a separate permutation of the ids, thus sorting
+only moves ids around and a position is an O(1) lookup.
+The file metadata (size, mtime, EXIF date and dimensions) is only read
+on demand, i.e. when we sort by it. Likewise, whether a file exists is only
+checked when we get to it, and the decode state is only created when it
+is first needed, so that a huge list costs little more than its paths.
+Removed entries keep their id (with an empty path) but leave the order.
+The lookup by path is only built once find() is used, i.e. once we watch
+the directory.
+*/
+struct Catalogue {
+	typedef uint32_t Id;
+	Catalogue() : m_haveByPath(false) {}
+	enum SortMode { SortNone, SortName, SortMTime, SortSize, SortDate, NumSortModes };
+	enum { HaveStat = 1, HaveExif = 2, Missing = 4, Removed = 8 };
+
+	std::vector<boost::filesystem::path> paths;
+	mutable std::vector<std::shared_ptr<PictureState> > states; // NULL until stateAt()
+	std::vector<uint64_t> sizes;
+	std::vector<int64_t> mtimes; // seconds since epoch
+	std::vector<int64_t> dates; // YYYYMMDDhhmmss, EXIF DateTimeOriginal or else the mtime
+	std::vector<int> widths, heights; // from EXIF, 0 if not known
+	std::vector<uint8_t> flags; // Have*
+
+	std::vector<Id> order; // position -> id
+	std::vector<size_t> positions; // id -> position, -1 if removed
+
+	size_t size() const { return order.size(); }
+	bool empty() const { return order.empty(); }
+	Id idAt(size_t pos) const { return order[pos]; }
+	size_t positionOf(Id id) const { return positions[id]; }
+	const boost::filesystem::path& pathAt(size_t pos) const { return paths[order[pos]]; }
+	const std::shared_ptr<PictureState>& stateAt(size_t pos) const {
+		std::shared_ptr<PictureState>& state = states[order[pos]];
+		if(!state) state = std::make_shared<PictureState>();
+		return state;
+	}
+	Picture pictureAt(size_t pos) const { return Picture(pathAt(pos), stateAt(pos)); }
+	bool contains(Id id) const { return id < flags.size() && !(flags[id] & Removed); }
+
+	// Appends it at the end of the order.
+	Id add(boost::filesystem::path path);
+	// Stats it if that was not done yet. false if it does not exist (anymore).
+	bool exists(size_t pos);
+	void clear();
+	bool find(const boost::filesystem::path& path, Id& id) const;
+	// Takes them out of the order.
+	void remove(const std::vector<Id>& ids);
+	// They were rewritten. Forgets the metadata and gives them a new decode state.
+	// If moveToTail, they are moved to the end of the order, to be sorted again by sortTail().
+	void invalidate(const std::vector<Id>& ids, bool moveToTail);
+
+	// Sorts all. Metadata which is needed for it is read first, in parallel.
+	void sort(SortMode mode);
+	// Sorts the positions from `from` on and merges them into the (sorted) ones before.
+	// This is what we do for newly added pictures.
+	void sortTail(size_t from, SortMode mode);
+
+	static const char* sortModeName(SortMode mode);
+	static bool parseSortMode(const std::string& s, SortMode& mode);
+
+private:
+	mutable std::unordered_map<std::string, Id> m_byPath; // once m_haveByPath
+	mutable bool m_haveByPath;
+
+	void _loadMetadata(const std::vector<Id>& ids, SortMode mode);
+	void _updatePositions(size_t from);
+};
+
+// Like strcasecmp, but runs of digits are compared by their numeric value,
+// i.e. "img2" < "img10".
+int naturalCompare(const std::string& a, const std::string& b);
+
+#endif
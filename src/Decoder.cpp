@@ -0,0 +1,763 @@
+#include <SDL.h>
+#include <SDL_image.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+#include <iostream>
+#include <boost/noncopyable.hpp>
+#ifdef HAVE_LIBJPEG
+#include <setjmp.h>
+#include <jpeglib.h>
+#endif
+#ifdef HAVE_LIBPNG
+#include <png.h>
+#endif
+#ifdef HAVE_LIBTIFF
+#include <tiffio.h>
+#endif
+#include "Decoder.h"
+#include "Scale.h"
+#include "Exif.h"
+#include "Profiler.h"
+#include "PixelKernels.h"
+#include "PixelPool.h"
+#include "Video.h"
+
+// IMG_LoadAnimation()
+#ifdef SDL_IMAGE_VERSION_ATLEAST
+#if SDL_IMAGE_VERSION_ATLEAST(2, 6, 0)
+#define HAVE_IMG_ANIMATION
+#endif
+#endif
+
+// Browsers show frames with a shorter delay (mostly 0) for 100ms,
+// and that is what such animations are made for.
+static const int MinFrameDelayMs = 20;
+static const int DefaultFrameDelayMs = 100;
+
+static auto &errors = std::cerr;
+using std::endl;
+
+namespace fs = boost::filesystem;
+
+enum Format { OtherFormat, JpegFormat, PngFormat, TiffFormat };
+
+static Format sniffFormat(FILE* f) {
+	unsigned char magic[4];
+	const bool ok = fread(magic, 1, 4, f) == 4;
+	rewind(f);
+	if(!ok) return OtherFormat;
+	if(magic[0] == 0xFF && magic[1] == 0xD8) return JpegFormat;
+	if(magic[0] == 0x89 && magic[1] == 'P' && magic[2] == 'N' && magic[3] == 'G') return PngFormat;
+	if((magic[0] == 'I' && magic[1] == 'I' && magic[2] == 42 && magic[3] == 0)
+	|| (magic[0] == 'M' && magic[1] == 'M' && magic[2] == 0 && magic[3] == 42))
+		return TiffFormat;
+	return OtherFormat;
+}
+
+// For the streaming decoders, once the size is known from the header.
+// region NULL means the whole picture, and then the box is capped to MaxDecodePixels.
+// false if there is nothing to do: the picture has less than minPixels,
+// or the region is outside of it.
+static bool prepareRegion(int fullW, int fullH, const SDL_Rect* region, size_t minPixels, SDL_Rect& r, int& boxW, int& boxH) {
+	if(fullW <= 0 || fullH <= 0 || size_t(fullW) * size_t(fullH) < minPixels) return false;
+	const SDL_Rect whole = {0, 0, fullW, fullH};
+	if(!region) {
+		r = whole;
+		capDecodeBox(fullW, fullH, boxW, boxH);
+		return true;
+	}
+	return SDL_IntersectRect(region, &whole, &r) == SDL_TRUE;
+}
+
+// The integer reduction which still covers the size w x h is displayed at,
+// but never with more than MaxDecodePixels.
+static int reduceStep(int w, int h, int boxW, int boxH) {
+	int step = std::max(int(1.0f / fitScale(w, h, boxW, boxH)), 1);
+	while(size_t((w + step - 1) / step) * size_t((h + step - 1) / step) > MaxDecodePixels)
+		step++;
+	return step;
+}
+
+namespace {
+/*
+Takes the rows of a region (premultiplied ARGB8888, top to bottom) and box
+filters step x step pixels into one, so that the region is never in memory
+at its full size. The edges average what is left.
+*/
+struct RowReducer : boost::noncopyable {
+	int srcW, srcH, step;
+	int row; // rows added so far
+	SmartPointer<SDL_Surface> surf;
+	std::vector<Uint32> acc; // per byte of a source row, sum of the rows of the current block
+	std::vector<Uint8> line; // for the decoders, to read a row into
+
+	RowReducer(int w, int h, int _step) : srcW(w), srcH(h), step(_step), row(0) {
+		surf = pixelPool.createSurface((w + step - 1) / step, (h + step - 1) / step, SDL_PIXELFORMAT_ARGB8888);
+		if(surf.get() && step > 1) acc.resize(size_t(w) * 4, 0);
+	}
+	operator bool() const { return surf.get() != NULL; }
+	bool done() const { return row >= srcH; }
+
+	void add(const Uint32* px) {
+		if(done()) return;
+		if(step == 1) {
+			memcpy((Uint8*) surf->pixels + row * surf->pitch, px, size_t(srcW) * 4);
+			row++;
+			return;
+		}
+		pixelKernels().accumulateRow((const Uint8*) px, &acc[0], srcW * 4, 1);
+		row++;
+		if(row % step == 0 || row == srcH) _flush();
+	}
+
+private:
+	void _flush() {
+		const int rows = (row - 1) % step + 1;
+		Uint8* out = (Uint8*) surf->pixels + ((row - 1) / step) * surf->pitch;
+		for(int x = 0; x < surf->w; ++x) {
+			const int cols = std::min(step, srcW - x * step);
+			const Uint32 n = Uint32(rows * cols);
+			const Uint32* in = &acc[size_t(x) * step * 4];
+			for(int c = 0; c < 4; ++c) {
+				Uint32 sum = 0;
+				for(int i = 0; i < cols; ++i)
+					sum += in[i * 4 + c];
+				out[x * 4 + c] = Uint8((sum + n / 2) / n);
+			}
+		}
+		std::fill(acc.begin(), acc.end(), 0);
+	}
+};
+}
+
+#ifdef HAVE_LIBJPEG
+
+struct JpegError {
+	jpeg_error_mgr mgr;
+	jmp_buf jmp;
+};
+
+static void jpegErrorExit(j_common_ptr cinfo) {
+	JpegError* err = (JpegError*) cinfo->err;
+	longjmp(err->jmp, 1);
+}
+
+static void jpegOutputMessage(j_common_ptr) {
+	// ignore warnings. errors are handled via jpegErrorExit
+}
+
+// Either a file or a memory buffer.
+struct JpegSource {
+	FILE* file;
+	const unsigned char* data;
+	size_t size;
+	JpegSource(FILE* f) : file(f), data(NULL), size(0) {}
+	JpegSource(const std::vector<unsigned char>& buf) : file(NULL), data(&buf[0]), size(buf.size()) {}
+	JpegSource(const unsigned char* d, size_t s) : file(NULL), data(d), size(s) {}
+};
+
+// Returns NULL if it is not a JPEG we can handle. Then the caller falls back to SDL_image.
+// scaleDenom 0 means to select it from the box size.
+static SmartPointer<SDL_Surface> decodeJpeg(const JpegSource& src, int boxW, int boxH, int scaleDenom, int* fullW, int* fullH) {
+	jpeg_decompress_struct cinfo;
+	JpegError err;
+	// volatile because it is modified between setjmp and longjmp
+	SDL_Surface* volatile surf = NULL;
+
+	cinfo.err = jpeg_std_error(&err.mgr);
+	err.mgr.error_exit = jpegErrorExit;
+	err.mgr.output_message = jpegOutputMessage;
+	if(setjmp(err.jmp)) {
+		jpeg_destroy_decompress(&cinfo);
+		if(surf) freeSurface(surf);
+		return NULL;
+	}
+
+	jpeg_create_decompress(&cinfo);
+	if(src.file)
+		jpeg_stdio_src(&cinfo, src.file);
+	else
+		jpeg_mem_src(&cinfo, (unsigned char*) src.data, (unsigned long) src.size);
+	jpeg_read_header(&cinfo, TRUE);
+	*fullW = cinfo.image_width;
+	*fullH = cinfo.image_height;
+
+	if(cinfo.jpeg_color_space == JCS_CMYK || cinfo.jpeg_color_space == JCS_YCCK) {
+		jpeg_destroy_decompress(&cinfo);
+		return NULL;
+	}
+#ifdef JCS_EXTENSIONS
+	// libjpeg-turbo: write ARGB8888 (BGRA in memory on little endian) directly
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+	cinfo.out_color_space = JCS_EXT_BGRA;
+#else
+	cinfo.out_color_space = JCS_EXT_ARGB;
+#endif
+#else
+	// Plain libjpeg: RGB (or gray, which it cannot convert to RGB), expanded per row.
+	const bool gray = cinfo.jpeg_color_space == JCS_GRAYSCALE;
+	cinfo.out_color_space = gray ? JCS_GRAYSCALE : JCS_RGB;
+#endif
+
+	// The DCT scaling supports 1/1, 1/2, 1/4, 1/8.
+	// Take the smallest one which still covers the displayed size.
+	const float s = fitScale(cinfo.image_width, cinfo.image_height, boxW, boxH);
+	cinfo.scale_num = 1;
+	cinfo.scale_denom = 1;
+	while(cinfo.scale_denom < 8 && s * cinfo.scale_denom * 2 <= 1.0f)
+		cinfo.scale_denom *= 2;
+	if(scaleDenom > 0)
+		cinfo.scale_denom = scaleDenom;
+	cinfo.dct_method = JDCT_ISLOW;
+	cinfo.do_fancy_upsampling = (cinfo.scale_denom == 1) ? TRUE : FALSE;
+
+	jpeg_start_decompress(&cinfo);
+	surf = pixelPool.createSurface(cinfo.output_width, cinfo.output_height, SDL_PIXELFORMAT_ARGB8888);
+	if(!surf) {
+		errors << "cannot create surface: " << SDL_GetError() << endl;
+		jpeg_destroy_decompress(&cinfo);
+		return NULL;
+	}
+#ifdef JCS_EXTENSIONS
+	while(cinfo.output_scanline < cinfo.output_height) {
+		JSAMPROW row = (JSAMPROW) surf->pixels + cinfo.output_scanline * surf->pitch;
+		jpeg_read_scanlines(&cinfo, &row, 1);
+	}
+#else
+	{
+		// Freed by jpeg_destroy_decompress(), also on error.
+		JSAMPARRAY line = (*cinfo.mem->alloc_sarray)((j_common_ptr) &cinfo, JPOOL_IMAGE,
+				cinfo.output_width * cinfo.output_components, 1);
+		const PixelKernels& kernels = pixelKernels();
+		while(cinfo.output_scanline < cinfo.output_height) {
+			Uint32* out = (Uint32*) ((Uint8*) surf->pixels + cinfo.output_scanline * surf->pitch);
+			jpeg_read_scanlines(&cinfo, line, 1);
+			if(gray)
+				for(JDIMENSION x = 0; x < cinfo.output_width; ++x)
+					out[x] = 0xff000000u | (Uint32(line[0][x]) * 0x010101u);
+			else
+				kernels.rgb24ToArgb(line[0], out, cinfo.output_width);
+		}
+	}
+#endif
+	jpeg_finish_decompress(&cinfo);
+	jpeg_destroy_decompress(&cinfo);
+	return SmartPointer<SDL_Surface>(surf);
+}
+
+#if defined(JCS_EXTENSIONS) && defined(LIBJPEG_TURBO_VERSION_NUMBER)
+// Only libjpeg-turbo can skip rows and crop columns while decoding.
+#define HAVE_JPEG_CROP
+#endif
+
+#ifdef HAVE_JPEG_CROP
+// See prepareRegion() for region and minPixels.
+// The DCT scaling does most of the reduction, the RowReducer the rest.
+static SmartPointer<SDL_Surface> decodeJpegRegion(FILE* f, SDL_Rect* region, int boxW, int boxH, size_t minPixels, int* fullW, int* fullH) {
+	jpeg_decompress_struct cinfo;
+	JpegError err;
+	// volatile because it is modified between setjmp and longjmp
+	RowReducer* volatile reducer = NULL;
+
+	cinfo.err = jpeg_std_error(&err.mgr);
+	err.mgr.error_exit = jpegErrorExit;
+	err.mgr.output_message = jpegOutputMessage;
+	if(setjmp(err.jmp)) {
+		jpeg_destroy_decompress(&cinfo);
+		delete reducer;
+		return NULL;
+	}
+
+	jpeg_create_decompress(&cinfo);
+	jpeg_stdio_src(&cinfo, f);
+	jpeg_read_header(&cinfo, TRUE);
+	*fullW = cinfo.image_width;
+	*fullH = cinfo.image_height;
+	SDL_Rect r;
+	if(!prepareRegion(*fullW, *fullH, region, minPixels, r, boxW, boxH)
+	|| cinfo.jpeg_color_space == JCS_CMYK || cinfo.jpeg_color_space == JCS_YCCK) {
+		jpeg_destroy_decompress(&cinfo);
+		return NULL;
+	}
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+	cinfo.out_color_space = JCS_EXT_BGRA;
+#else
+	cinfo.out_color_space = JCS_EXT_ARGB;
+#endif
+	const float s = fitScale(r.w, r.h, boxW, boxH);
+	cinfo.scale_num = 1;
+	cinfo.scale_denom = 1;
+	while(cinfo.scale_denom < 8 && s * cinfo.scale_denom * 2 <= 1.0f)
+		cinfo.scale_denom *= 2;
+	cinfo.dct_method = JDCT_ISLOW;
+	cinfo.do_fancy_upsampling = (cinfo.scale_denom == 1) ? TRUE : FALSE;
+	jpeg_start_decompress(&cinfo);
+
+	// The region in scaled pixels.
+	const double fx = double(cinfo.output_width) / *fullW, fy = double(cinfo.output_height) / *fullH;
+	const int x0 = int(r.x * fx), y0 = int(r.y * fy);
+	const int x1 = std::min(std::max(int(ceil((r.x + r.w) * fx)), x0 + 1), int(cinfo.output_width));
+	const int y1 = std::min(std::max(int(ceil((r.y + r.h) * fy)), y0 + 1), int(cinfo.output_height));
+	// Cropping works on whole blocks, thus the row starts a bit further left.
+	JDIMENSION cropX = x0, cropW = x1 - x0;
+	if(cropW < cinfo.output_width)
+		jpeg_crop_scanline(&cinfo, &cropX, &cropW);
+	if(y0 > 0)
+		jpeg_skip_scanlines(&cinfo, y0);
+
+	reducer = new RowReducer(x1 - x0, y1 - y0, reduceStep(x1 - x0, y1 - y0, boxW, boxH));
+	if(!*reducer) {
+		errors << "cannot create surface: " << SDL_GetError() << endl;
+		jpeg_destroy_decompress(&cinfo);
+		delete reducer;
+		return NULL;
+	}
+	reducer->line.resize(size_t(cinfo.output_width) * 4);
+	while(!reducer->done()) {
+		JSAMPROW row = &reducer->line[0];
+		jpeg_read_scanlines(&cinfo, &row, 1);
+		reducer->add((const Uint32*) &reducer->line[0] + (x0 - cropX));
+	}
+	// The rows below are not needed.
+	jpeg_abort_decompress(&cinfo);
+	jpeg_destroy_decompress(&cinfo);
+	SmartPointer<SDL_Surface> surf = reducer->surf;
+	delete reducer;
+
+	if(region) {
+		region->x = int(x0 / fx + 0.5);
+		region->y = int(y0 / fy + 0.5);
+		region->w = std::min(int(x1 / fx + 0.5), *fullW) - region->x;
+		region->h = std::min(int(y1 / fy + 0.5), *fullH) - region->y;
+	}
+	return surf;
+}
+#endif // HAVE_JPEG_CROP
+
+static void jpegInitDestination(j_compress_ptr) {}
+static boolean jpegEmptyOutputBuffer(j_compress_ptr cinfo);
+static void jpegTermDestination(j_compress_ptr cinfo);
+
+// Writes into a std::vector. jpeg_mem_dest() is not available in all libjpeg versions.
+struct JpegVectorDest {
+	jpeg_destination_mgr mgr;
+	std::vector<unsigned char>* out;
+
+	JpegVectorDest(std::vector<unsigned char>& _out) : out(&_out) {
+		mgr.init_destination = jpegInitDestination;
+		mgr.empty_output_buffer = jpegEmptyOutputBuffer;
+		mgr.term_destination = jpegTermDestination;
+		out->resize(16 * 1024);
+		mgr.next_output_byte = &(*out)[0];
+		mgr.free_in_buffer = out->size();
+	}
+};
+
+static boolean jpegEmptyOutputBuffer(j_compress_ptr cinfo) {
+	JpegVectorDest* dest = (JpegVectorDest*) cinfo->dest;
+	// The buffer is full, i.e. it is ignoring free_in_buffer.
+	size_t oldSize = dest->out->size();
+	dest->out->resize(oldSize * 2);
+	dest->mgr.next_output_byte = &(*dest->out)[oldSize];
+	dest->mgr.free_in_buffer = dest->out->size() - oldSize;
+	return TRUE;
+}
+
+static void jpegTermDestination(j_compress_ptr cinfo) {
+	JpegVectorDest* dest = (JpegVectorDest*) cinfo->dest;
+	dest->out->resize(dest->out->size() - dest->mgr.free_in_buffer);
+}
+
+#endif // HAVE_LIBJPEG
+
+SmartPointer<SDL_Surface> decodeJpegData(const unsigned char* data, size_t size) {
+#ifdef HAVE_LIBJPEG
+	int w = 0, h = 0;
+	return decodeJpeg(JpegSource(data, size), 0, 0, 0, &w, &h);
+#else
+	return NULL;
+#endif
+}
+
+bool encodeJpeg(SDL_Surface* surf, int quality, std::vector<unsigned char>& out) {
+#if defined(HAVE_LIBJPEG) && defined(JCS_EXTENSIONS)
+	if(surf->format->format != SDL_PIXELFORMAT_ARGB8888) return false;
+	jpeg_compress_struct cinfo;
+	JpegError err;
+	cinfo.err = jpeg_std_error(&err.mgr);
+	err.mgr.error_exit = jpegErrorExit;
+	err.mgr.output_message = jpegOutputMessage;
+	if(setjmp(err.jmp)) {
+		jpeg_destroy_compress(&cinfo);
+		out.clear();
+		return false;
+	}
+
+	jpeg_create_compress(&cinfo);
+	JpegVectorDest dest(out);
+	cinfo.dest = &dest.mgr;
+	cinfo.image_width = surf->w;
+	cinfo.image_height = surf->h;
+	cinfo.input_components = 4;
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+	cinfo.in_color_space = JCS_EXT_BGRA;
+#else
+	cinfo.in_color_space = JCS_EXT_ARGB;
+#endif
+	jpeg_set_defaults(&cinfo);
+	jpeg_set_quality(&cinfo, quality, TRUE);
+	jpeg_start_compress(&cinfo, TRUE);
+	while(cinfo.next_scanline < cinfo.image_height) {
+		JSAMPROW row = (JSAMPROW) surf->pixels + cinfo.next_scanline * surf->pitch;
+		jpeg_write_scanlines(&cinfo, &row, 1);
+	}
+	jpeg_finish_compress(&cinfo);
+	jpeg_destroy_compress(&cinfo);
+	return true;
+#else
+	return false;
+#endif
+}
+
+SmartPointer<SDL_Surface> decodePreview(const fs::path& path, int boxW, int boxH, int* fullW, int* fullH) {
+	ProfileScope scope("decodePreview");
+#ifdef HAVE_LIBJPEG
+	ExifInfo exif;
+	if(!readExif(path, exif, true)) return NULL; // not a JPEG
+	if(exif.width <= 0 || exif.height <= 0) return NULL;
+	*fullW = exif.width;
+	*fullH = exif.height;
+
+	if(!exif.thumbnail.empty()) {
+		int thumbW = 0, thumbH = 0;
+		SmartPointer<SDL_Surface> surf = decodeJpeg(JpegSource(exif.thumbnail), boxW, boxH, 0, &thumbW, &thumbH);
+		if(surf.get()) return surf;
+	}
+
+	// no embedded thumbnail, use the smallest DCT scaling
+	FILE* f = fopen(path.string().c_str(), "rb");
+	if(!f) return NULL;
+	int w = 0, h = 0;
+	SmartPointer<SDL_Surface> surf = decodeJpeg(JpegSource(f), boxW, boxH, 8, &w, &h);
+	fclose(f);
+	return surf;
+#else
+	return NULL;
+#endif
+}
+
+// SurfaceTexture creates the textures in the surface format.
+// Palettized formats are not supported for textures at all,
+// and everything else would be converted on every upload.
+// The scaling and the blending expect premultiplied alpha.
+static SmartPointer<SDL_Surface> toPremultipliedArgb(SmartPointer<SDL_Surface> surf) {
+	ProfileScope scope("toPremultipliedArgb");
+	const PixelKernels& kernels = pixelKernels();
+	const Uint32 format = surf->format->format;
+	Uint32 colorKey = 0;
+	const bool alpha = SDL_ISPIXELFORMAT_ALPHA(format) || SDL_GetColorKey(surf.get(), &colorKey) == 0;
+	if(!alpha && (format == SDL_PIXELFORMAT_RGB24 || format == SDL_PIXELFORMAT_BGR24)) {
+		// The most common one from SDL_image (PNG, TGA, ...). Faster than SDL's blitter.
+		SmartPointer<SDL_Surface> conv = pixelPool.createSurface(surf->w, surf->h, SDL_PIXELFORMAT_ARGB8888);
+		if(!conv.get()) return NULL;
+		for(int y = 0; y < surf->h; ++y) {
+			const Uint8* in = (const Uint8*) surf->pixels + y * surf->pitch;
+			Uint32* out = (Uint32*) ((Uint8*) conv->pixels + y * conv->pitch);
+			if(format == SDL_PIXELFORMAT_RGB24)
+				kernels.rgb24ToArgb(in, out, surf->w);
+			else
+				kernels.bgr24ToArgb(in, out, surf->w);
+		}
+		return conv;
+	}
+	const bool swap = format == SDL_PIXELFORMAT_ABGR8888 || format == SDL_PIXELFORMAT_BGR888;
+	const bool opaque = format == SDL_PIXELFORMAT_RGB888 || format == SDL_PIXELFORMAT_BGR888;
+	if(swap || opaque) {
+		// Same size per pixel, so convert in place instead of into a new surface.
+		surf = reinterpretSurface(surf, SDL_PIXELFORMAT_ARGB8888);
+		if(!surf.get()) return NULL;
+		for(int y = 0; y < surf->h; ++y) {
+			Uint32* row = (Uint32*) ((Uint8*) surf->pixels + y * surf->pitch);
+			if(swap) kernels.abgrToArgb(row, surf->w);
+			if(opaque)
+				for(int x = 0; x < surf->w; ++x)
+					row[x] |= 0xff000000u;
+		}
+	}
+	else if(format != SDL_PIXELFORMAT_ARGB8888) {
+		surf = SDL_ConvertSurfaceFormat(surf.get(), SDL_PIXELFORMAT_ARGB8888, 0);
+		if(!surf.get()) return NULL;
+	}
+	if(alpha)
+		for(int y = 0; y < surf->h; ++y)
+			kernels.premultiply((Uint32*) ((Uint8*) surf->pixels + y * surf->pitch), surf->w);
+	return surf;
+}
+
+static SmartPointer<SDL_Surface> decodeWithSDLImage(const fs::path& path, int* fullW, int* fullH) {
+	SmartPointer<SDL_Surface> surf;
+	{
+		ProfileScope scope("IMG_Load");
+		surf = IMG_Load(path.string().c_str());
+	}
+	if(!surf.get()) {
+		errors << "cannot load " << path << ": " << IMG_GetError() << endl;
+		return NULL;
+	}
+	*fullW = surf->w;
+	*fullH = surf->h;
+	surf = toPremultipliedArgb(surf);
+	if(!surf.get())
+		errors << "cannot convert " << path << ": " << SDL_GetError() << endl;
+	return surf;
+}
+
+#ifdef HAVE_LIBPNG
+static void pngError(png_structp png, png_const_charp) {
+	longjmp(png_jmpbuf(png), 1);
+}
+
+static void pngWarning(png_structp, png_const_charp) {}
+
+// See prepareRegion() for region and minPixels.
+// PNG has no random access, so the rows above the region are decoded and dropped.
+// Interlaced ones are not supported: a row is only complete after the last pass.
+static SmartPointer<SDL_Surface> decodePngRegion(FILE* f, SDL_Rect* region, int boxW, int boxH, size_t minPixels, int* fullW, int* fullH) {
+	png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, pngError, pngWarning);
+	if(!png) return NULL;
+	png_infop info = png_create_info_struct(png);
+	// volatile because it is modified between setjmp and longjmp
+	RowReducer* volatile reducer = NULL;
+	if(!info || setjmp(png_jmpbuf(png))) {
+		png_destroy_read_struct(&png, info ? &info : NULL, NULL);
+		delete reducer;
+		return NULL;
+	}
+
+	png_init_io(png, f);
+	png_read_info(png, info);
+	png_uint_32 w = 0, h = 0;
+	int depth = 0, colorType = 0, interlace = 0;
+	png_get_IHDR(png, info, &w, &h, &depth, &colorType, &interlace, NULL, NULL);
+	*fullW = int(w);
+	*fullH = int(h);
+	SDL_Rect r;
+	if(!prepareRegion(*fullW, *fullH, region, minPixels, r, boxW, boxH) || interlace != PNG_INTERLACE_NONE) {
+		png_destroy_read_struct(&png, &info, NULL);
+		return NULL;
+	}
+	const bool alpha = (colorType & PNG_COLOR_MASK_ALPHA) || png_get_valid(png, info, PNG_INFO_tRNS);
+	// Everything to 8bit RGBA, in the byte order of ARGB8888.
+	png_set_expand(png);
+	png_set_strip_16(png);
+	png_set_gray_to_rgb(png);
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+	png_set_bgr(png);
+	png_set_filler(png, 0xff, PNG_FILLER_AFTER);
+#else
+	png_set_swap_alpha(png);
+	png_set_filler(png, 0xff, PNG_FILLER_BEFORE);
+#endif
+	png_read_update_info(png, info);
+
+	reducer = new RowReducer(r.w, r.h, reduceStep(r.w, r.h, boxW, boxH));
+	if(!*reducer) {
+		errors << "cannot create surface: " << SDL_GetError() << endl;
+		png_destroy_read_struct(&png, &info, NULL);
+		delete reducer;
+		return NULL;
+	}
+	const PixelKernels& kernels = pixelKernels();
+	reducer->line.resize(std::max(png_get_rowbytes(png, info), size_t(w) * 4));
+	for(int y = 0; !reducer->done(); ++y) {
+		png_read_row(png, &reducer->line[0], NULL);
+		if(y < r.y) continue;
+		Uint32* px = (Uint32*) &reducer->line[0] + r.x;
+		if(alpha) kernels.premultiply(px, r.w);
+		reducer->add(px);
+	}
+	png_destroy_read_struct(&png, &info, NULL);
+	SmartPointer<SDL_Surface> surf = reducer->surf;
+	delete reducer;
+	if(region) *region = r;
+	return surf;
+}
+#endif // HAVE_LIBPNG
+
+#ifdef HAVE_LIBTIFF
+// A band (see below) is never larger than that.
+static const size_t MaxBandBytes = 64 * 1024 * 1024;
+
+// See prepareRegion() for region and minPixels.
+// TIFFRGBAImage reads only the tiles or strips which overlap the rows and
+// columns asked for, and converts every layout and color space to RGBA,
+// with premultiplied alpha. We ask for one row of tiles (a band) at a time.
+static SmartPointer<SDL_Surface> decodeTiffRegion(const fs::path& path, SDL_Rect* region, int boxW, int boxH, size_t minPixels, int* fullW, int* fullH) {
+	TIFF* tif = TIFFOpen(path.string().c_str(), "r");
+	if(!tif) return NULL;
+	uint32_t w = 0, h = 0;
+	TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &w);
+	TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &h);
+	*fullW = int(w);
+	*fullH = int(h);
+	SDL_Rect r;
+	char msg[1024];
+	TIFFRGBAImage img;
+	if(!prepareRegion(*fullW, *fullH, region, minPixels, r, boxW, boxH)
+	|| !TIFFRGBAImageOK(tif, msg) || !TIFFRGBAImageBegin(&img, tif, 0, msg)) {
+		TIFFClose(tif);
+		return NULL;
+	}
+	img.req_orientation = ORIENTATION_TOPLEFT;
+	img.col_offset = r.x;
+
+	uint32_t band = 0;
+	if(TIFFIsTiled(tif))
+		TIFFGetField(tif, TIFFTAG_TILELENGTH, &band);
+	else
+		TIFFGetFieldDefaulted(tif, TIFFTAG_ROWSPERSTRIP, &band);
+	band = std::max(std::min(band, uint32_t(MaxBandBytes / (size_t(r.w) * 4))), uint32_t(1));
+
+	RowReducer reducer(r.w, r.h, reduceStep(r.w, r.h, boxW, boxH));
+	if(!reducer) {
+		errors << "cannot create surface: " << SDL_GetError() << endl;
+		TIFFRGBAImageEnd(&img);
+		TIFFClose(tif);
+		return NULL;
+	}
+	const PixelKernels& kernels = pixelKernels();
+	std::vector<uint32_t> buf(size_t(r.w) * band);
+	bool ok = true;
+	for(int y = r.y; ok && !reducer.done();) {
+		// aligned to the bands of the file, so that each tile is read only once
+		const int n = std::min(int(band - y % band), r.y + r.h - y);
+		img.row_offset = y;
+		ok = TIFFRGBAImageGet(&img, &buf[0], r.w, n) != 0;
+		for(int i = 0; ok && i < n; ++i) {
+			// packed as ABGR8888
+			Uint32* px = (Uint32*) &buf[size_t(i) * r.w];
+			kernels.abgrToArgb(px, r.w);
+			reducer.add(px);
+		}
+		y += n;
+	}
+	TIFFRGBAImageEnd(&img);
+	TIFFClose(tif);
+	if(!ok) {
+		errors << "cannot read " << path << endl;
+		return NULL;
+	}
+	if(region) *region = r;
+	return reducer.surf;
+}
+#endif // HAVE_LIBTIFF
+
+// region NULL is the whole picture. NULL if the format is not supported here
+// (then unsupported is set), or the picture has less than minPixels, or on
+// errors. fullW/fullH are set if it is supported.
+static SmartPointer<SDL_Surface> decodeStreaming(const fs::path& path, SDL_Rect* region, int boxW, int boxH, size_t minPixels, int* fullW, int* fullH, bool* unsupported = NULL) {
+	if(unsupported) *unsupported = false;
+	FILE* f = fopen(path.string().c_str(), "rb");
+	if(!f) return NULL;
+	SmartPointer<SDL_Surface> surf;
+	switch(sniffFormat(f)) {
+#ifdef HAVE_JPEG_CROP
+		case JpegFormat: surf = decodeJpegRegion(f, region, boxW, boxH, minPixels, fullW, fullH); break;
+#endif
+#ifdef HAVE_LIBPNG
+		case PngFormat: surf = decodePngRegion(f, region, boxW, boxH, minPixels, fullW, fullH); break;
+#endif
+#ifdef HAVE_LIBTIFF
+		case TiffFormat: surf = decodeTiffRegion(path, region, boxW, boxH, minPixels, fullW, fullH); break;
+#endif
+		default:
+			if(unsupported) *unsupported = true;
+			break;
+	}
+	fclose(f);
+	if(!surf.get()) return NULL;
+	return reduceSurface(surf, boxW, boxH);
+}
+
+bool capDecodeBox(int fullW, int fullH, int& boxW, int& boxH) {
+	const double pixels = double(fullW) * fullH;
+	if(pixels <= MaxDecodePixels) return false;
+	const double fit = fitScale(fullW, fullH, boxW, boxH), cap = sqrt(MaxDecodePixels / pixels);
+	if(fit <= cap) return false;
+	boxW = std::max(int(fullW * cap), 1);
+	boxH = std::max(int(fullH * cap), 1);
+	return true;
+}
+
+SmartPointer<SDL_Surface> decodePictureRegion(const fs::path& path, SDL_Rect& region, int boxW, int boxH, int* fullW, int* fullH, bool* unsupported) {
+	ProfileScope scope("decodePictureRegion");
+	return decodeStreaming(path, &region, boxW, boxH, 0, fullW, fullH, unsupported);
+}
+
+SmartPointer<SDL_Surface> decodePicture(const fs::path& path, int boxW, int boxH, int* fullW, int* fullH) {
+	ProfileScope scope("decodePicture");
+	if(isVideoFilename(path))
+		return decodeVideoFrame(path, boxW, boxH, fullW, fullH);
+	{
+		SmartPointer<SDL_Surface> surf = decodeStreaming(path, NULL, boxW, boxH, MaxDecodePixels + 1, fullW, fullH);
+		if(surf.get()) return surf;
+	}
+#ifdef HAVE_LIBJPEG
+	FILE* f = fopen(path.string().c_str(), "rb");
+	if(f) {
+		SmartPointer<SDL_Surface> surf;
+		if(sniffFormat(f) == JpegFormat)
+			surf = decodeJpeg(JpegSource(f), boxW, boxH, 0, fullW, fullH);
+		fclose(f);
+		if(surf.get())
+			return reduceSurface(surf, boxW, boxH);
+	}
+#endif
+
+	SmartPointer<SDL_Surface> surf = decodeWithSDLImage(path, fullW, fullH);
+	if(!surf.get()) return NULL;
+	return reduceSurface(surf, boxW, boxH);
+}
+
+std::shared_ptr<DecodedAnimation> decodeAnimation(const fs::path& path, int boxW, int boxH, size_t maxBytes) {
+#ifdef HAVE_IMG_ANIMATION
+	ProfileScope scope("decodeAnimation");
+	IMG_Animation* anim = IMG_LoadAnimation(path.string().c_str());
+	if(!anim) return NULL;
+	std::shared_ptr<DecodedAnimation> res;
+	if(anim->count > 1 && anim->w > 0 && anim->h > 0) {
+		float s = fitScale(anim->w, anim->h, boxW, boxH);
+		const double bytes = double(anim->w) * anim->h * 4 * anim->count * s * s;
+		if(bytes > maxBytes)
+			s *= float(sqrt(maxBytes / bytes));
+		const int w = std::max(int(anim->w * s), 1), h = std::max(int(anim->h * s), 1);
+		res.reset(new DecodedAnimation());
+		res->fullW = anim->w;
+		res->fullH = anim->h;
+		for(int i = 0; i < anim->count; ++i) {
+			// Taken over, so that each original is freed as soon as it is converted.
+			SmartPointer<SDL_Surface> frame = anim->frames[i];
+			anim->frames[i] = NULL;
+			frame = toPremultipliedArgb(frame);
+			if(frame.get() && (frame->w != w || frame->h != h))
+				frame = resizeSurface(frame.get(), w, h);
+			if(!frame.get()) {
+				errors << "cannot convert frame " << i << " of " << path << ": " << SDL_GetError() << endl;
+				res.reset();
+				break;
+			}
+			res->frames.push_back(frame);
+			res->delays.push_back((anim->delays[i] >= MinFrameDelayMs) ? anim->delays[i] : DefaultFrameDelayMs);
+			res->bytes += size_t(frame->pitch) * frame->h;
+		}
+	}
+	IMG_FreeAnimation(anim);
+	return res;
+#else
+	return NULL;
+#endif
+}
@@ -0,0 +1,81 @@
+#ifndef __ImageViewer_Decoder_h__
+#define __ImageViewer_Decoder_h__
+
+#include <SDL.h>
+#include <vector>
+#include <memory>
+#include <boost/filesystem.hpp>
+#include <boost/noncopyable.hpp>
+#include "SmartPointer.h"
+
+/*
+Decodes a picture into an ARGB8888 surface with premultiplied alpha.
+If boxW/boxH are > 0, the picture is only decoded as large as needed
+to display it fitted into boxW x boxH, i.e. it might be smaller than
+the original. For JPEG, this uses the DCT scaling of libjpeg, which
+also makes the decoding itself a lot faster. Everything else is
+decoded in full and then reduced.
+fullW/fullH return the size of the original picture.
+Pictures with more than MaxDecodePixels are streamed: only the reduced
+picture is ever in memory, never more than MaxDecodePixels of it (see
+capDecodeBox()). That needs JPEG, or TIFF with libtiff, or non-interlaced
+PNG with libpng; everything else still goes through SDL_image in full.
+This is thread-safe.
+*/
+SmartPointer<SDL_Surface> decodePicture(const boost::filesystem::path& path, int boxW, int boxH, int* fullW, int* fullH);
+
+/*
+Quickly decodes a low resolution version of the picture, i.e. the embedded
+EXIF thumbnail or a 1/8 DCT scaled decode. Only for JPEG, otherwise NULL.
+fullW/fullH return the size of the original picture, as from decodePicture().
+This is thread-safe.
+*/
+SmartPointer<SDL_Surface> decodePreview(const boost::filesystem::path& path, int boxW, int boxH, int* fullW, int* fullH);
+
+// Larger pictures are never decoded as a whole at full size.
+static const size_t MaxDecodePixels = 32 * 1024 * 1024;
+// Reduces the box so that fullW x fullH fitted into it has at most MaxDecodePixels.
+// Returns whether it did. The streaming decoder reduces by an integer factor,
+// so a capped picture might come out at anything down to half of that box.
+bool capDecodeBox(int fullW, int fullH, int& boxW, int& boxH);
+
+/*
+Decodes only the part `region` (in pixels of the original) of the picture,
+as large as needed to display it fitted into boxW x boxH. This is for
+zooming into pictures which are too large to be decoded in full.
+JPEG skips the rows above and crops the columns while decoding
+(libjpeg-turbo), TIFF reads only the tiles or strips which overlap the
+region (libtiff), PNG streams the rows and drops the ones above (libpng).
+The memory needed is the result plus a row of tiles.
+region is clipped to the picture and adjusted to what the result actually
+covers, which might be slightly more because of the JPEG block alignment.
+NULL if the format is not supported, then unsupported is set, or on errors.
+This is thread-safe.
+*/
+SmartPointer<SDL_Surface> decodePictureRegion(const boost::filesystem::path& path, SDL_Rect& region, int boxW, int boxH, int* fullW, int* fullH, bool* unsupported = NULL);
+
+/*
+All frames of an animated picture (GIF, and WebP with SDL_image >= 2.8),
+composited by SDL_image, i.e. with the disposal and blending of each frame
+already applied, so that every frame can be shown as it is.
+Premultiplied ARGB8888, all reduced to the same size like decodePicture(),
+and further if they would take more than maxBytes together.
+NULL if it has only one frame or SDL_image cannot decode it as an
+animation (before 2.6, and APNG, which it does not support at all).
+This is thread-safe.
+*/
+struct DecodedAnimation : boost::noncopyable {
+	std::vector<SmartPointer<SDL_Surface> > frames;
+	std::vector<int> delays; // ms each frame is shown
+	int fullW, fullH;
+	size_t bytes; // of all frames
+	DecodedAnimation() : fullW(0), fullH(0), bytes(0) {}
+};
+std::shared_ptr<DecodedAnimation> decodeAnimation(const boost::filesystem::path& path, int boxW, int boxH, size_t maxBytes);
+
+// In-memory JPEG, e.g. for the thumbnail store. NULL if we don't have libjpeg.
+SmartPointer<SDL_Surface> decodeJpegData(const unsigned char* data, size_t size);
+// ARGB8888 surfaces only. Returns false if not supported, e.g. without libjpeg-turbo.
+bool encodeJpeg(SDL_Surface* surf, int quality, std::vector<unsigned char>& out);
+
+#endif
@@ -0,0 +1,247 @@
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <string.h>
+#include <errno.h>
+#include <deque>
+#include <iostream>
+#include <boost/algorithm/string.hpp>
+#include "DirScanner.h"
+#include "Picture.h"
+#include "Video.h"
+#include "Animation.h"
+
+static auto &errors = std::cerr;
+using std::endl;
+
+namespace fs = boost::filesystem;
+
+// Flush a chunk to the UI thread after so many entries or so much time.
+static const size_t ChunkSize = 256;
+static const Uint32 ChunkTimeMs = 50;
+// Of a list which is not mapped. Grows for longer lines.
+static const size_t ReadSize = 64 * 1024;
+// How often reading a pipe checks for cancel().
+static const int PollMs = 100;
+
+bool isPictureFilename(const fs::path& path) {
+	std::string ext = path.extension().string();
+	boost::to_lower(ext);
+	// What IMG_Init() is asked for, and what decodePictureRegion() streams.
+	return ext == ".jpg" || ext == ".jpeg" || ext == ".png" || ext == ".tif" || ext == ".tiff"
+		|| isVideoFilename(path) || isAnimationFilename(path);
+}
+
+void DirScanner::start(const fs::path& dir, int maxDepth) {
+	cancel();
+	m_cancel = false;
+	m_running = true;
+	m_thread = std::thread(&DirScanner::_scan, this, dir, maxDepth);
+}
+
+void DirScanner::startList(const fs::path& list) {
+	cancel();
+	m_cancel = false;
+	m_running = true;
+	m_thread = std::thread(&DirScanner::_scanList, this, list);
+}
+
+void DirScanner::cancel() {
+	m_cancel = true;
+	if(m_thread.joinable())
+		m_thread.join();
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_running = false;
+}
+
+bool DirScanner::isRunning() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_running;
+}
+
+bool DirScanner::takeFound(std::vector<fs::path>& out) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if(m_found.empty()) return false;
+	if(out.empty())
+		out.swap(m_found);
+	else
+		out.insert(out.end(), std::make_move_iterator(m_found.begin()), std::make_move_iterator(m_found.end()));
+	m_found.clear();
+	return true;
+}
+
+void DirScanner::_flush(std::vector<fs::path>& chunk) {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_found.insert(m_found.end(), std::make_move_iterator(chunk.begin()), std::make_move_iterator(chunk.end()));
+	}
+	chunk.clear();
+	pushDecodedEvent(); // wakes up the main loop
+}
+
+void DirScanner::_scan(fs::path root, int maxDepth) {
+	std::deque<std::pair<fs::path, int> > dirs;
+	dirs.push_back(std::make_pair(root, 0));
+	std::vector<fs::path> chunk;
+	Uint32 lastFlush = SDL_GetTicks();
+
+	while(!dirs.empty() && !m_cancel) {
+		const fs::path dir = dirs.front().first;
+		const int depth = dirs.front().second;
+		dirs.pop_front();
+
+		DIR* d = opendir(dir.string().c_str());
+		if(!d) {
+			errors << "cannot open directory " << dir << ": " << strerror(errno) << endl;
+			continue;
+		}
+		while(dirent* ent = readdir(d)) {
+			if(m_cancel) break;
+			if(strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) continue;
+
+			fs::path path = dir / ent->d_name;
+			bool isFile = false, isDir = false;
+#ifdef DT_UNKNOWN
+			if(ent->d_type == DT_REG) isFile = true;
+			else if(ent->d_type == DT_DIR) isDir = true;
+			else if(ent->d_type == DT_UNKNOWN || ent->d_type == DT_LNK)
+#endif
+			{
+				// we need to stat. only done for symlinks and filesystems without d_type
+				struct stat st;
+				if(stat(path.string().c_str(), &st) != 0) continue;
+				isFile = S_ISREG(st.st_mode);
+				isDir = S_ISDIR(st.st_mode);
+			}
+
+			if(isFile && isPictureFilename(path))
+				chunk.push_back(path);
+			else if(isDir && depth < maxDepth)
+				dirs.push_back(std::make_pair(path, depth + 1));
+
+			if(chunk.size() >= ChunkSize || (!chunk.empty() && SDL_GetTicks() - lastFlush >= ChunkTimeMs)) {
+				_flush(chunk);
+				lastFlush = SDL_GetTicks();
+			}
+		}
+		closedir(d);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_found.insert(m_found.end(), chunk.begin(), chunk.end());
+		m_running = false;
+	}
+	pushDecodedEvent();
+}
+
+// Calls line(begin, end) for each complete line in [begin, end), without the
+// line break. Returns the start of the incomplete rest.
+template<typename F>
+static const char* splitLines(const char* begin, const char* end, F line) {
+	while(begin < end) {
+		const char* nl = (const char*) memchr(begin, '\n', end - begin);
+		if(!nl) break;
+		line(begin, nl);
+		begin = nl + 1;
+	}
+	return begin;
+}
+
+template<typename F, typename G>
+void DirScanner::_readLines(int fd, F line, G afterRead) {
+	std::vector<char> buf(ReadSize);
+	size_t have = 0;
+	while(!m_cancel) {
+		// With a timeout, so that cancel() does not hang on a pipe which stays open.
+		struct pollfd p;
+		p.fd = fd;
+		p.events = POLLIN;
+		p.revents = 0;
+		const int r = poll(&p, 1, PollMs);
+		if(r < 0 && errno != EINTR) break;
+		if(r <= 0) continue;
+		if(have == buf.size()) buf.resize(buf.size() * 2);
+		const ssize_t n = read(fd, &buf[have], buf.size() - have);
+		if(n < 0) {
+			if(errno == EINTR || errno == EAGAIN) continue;
+			errors << "cannot read list: " << strerror(errno) << endl;
+			break;
+		}
+		if(n == 0) break;
+		have += n;
+		const char* rest = splitLines(&buf[0], &buf[0] + have, line);
+		have -= rest - &buf[0];
+		memmove(&buf[0], rest, have);
+		afterRead();
+	}
+	// the last line without a line break
+	if(have > 0 && !m_cancel) line(&buf[0], &buf[0] + have);
+}
+
+void DirScanner::_scanList(fs::path list) {
+	const bool isStdin = list == "-";
+	// Relative entries are relative to the list, or to the working directory for stdin.
+	const std::string base = isStdin ? std::string() : list.parent_path().string();
+	std::vector<fs::path> chunk;
+	Uint32 lastFlush = SDL_GetTicks();
+	bool flushedAny = false;
+	std::string joined; // reused, so that only the path itself allocates
+	auto line = [&](const char* begin, const char* end) {
+		if(m_cancel) return;
+		while(begin < end && isspace((unsigned char) *begin)) ++begin;
+		while(end > begin && isspace((unsigned char) end[-1])) --end;
+		if(begin == end) return;
+		if(base.empty() || *begin == '/')
+			chunk.push_back(fs::path(begin, end));
+		else {
+			joined.assign(base).append(1, '/').append(begin, end);
+			chunk.push_back(fs::path(joined));
+		}
+		// The first one right away, so that it can be shown while we read on.
+		if(!flushedAny || chunk.size() >= ChunkSize || SDL_GetTicks() - lastFlush >= ChunkTimeMs) {
+			_flush(chunk);
+			lastFlush = SDL_GetTicks();
+			flushedAny = true;
+		}
+	};
+
+	const int fd = isStdin ? 0 : open(list.string().c_str(), O_RDONLY);
+	if(fd < 0)
+		errors << "cannot open " << list << ": " << strerror(errno) << endl;
+	else {
+		struct stat st;
+		void* map = MAP_FAILED;
+		if(!isStdin && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+			map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(map != MAP_FAILED) {
+			madvise(map, st.st_size, MADV_SEQUENTIAL);
+			const char* begin = (const char*) map;
+			const char* end = begin + st.st_size;
+			const char* rest = splitLines(begin, end, line);
+			line(rest, end);
+			munmap(map, st.st_size);
+		}
+		else
+			// pipes, or whatever cannot be mapped
+			_readLines(fd, line, [&]() {
+				// As they come. A pipeline might produce them slowly.
+				if(!chunk.empty()) {
+					_flush(chunk);
+					lastFlush = SDL_GetTicks();
+				}
+			});
+		if(!isStdin) close(fd);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_found.insert(m_found.end(), std::make_move_iterator(chunk.begin()), std::make_move_iterator(chunk.end()));
+		m_running = false;
+	}
+	pushDecodedEvent();
+}
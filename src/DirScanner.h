@@ -0,0 +1,53 @@
+#ifndef __ImageViewer_DirScanner_h__
+#define __ImageViewer_DirScanner_h__
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <boost/filesystem.hpp>
+#include <boost/noncopyable.hpp>
+
+/*
+Scans a directory in a background thread, optionally recursively
+(breadth-first, up to maxDepth levels of subdirectories).
+Found pictures are collected in chunks and fetched by the UI thread
+via takeFound(), so the first ones can be shown while it still scans.
+It uses the d_type from readdir() where possible, so that we don't
+need a stat() per file, which is slow on network filesystems.
+A list file (one path per line, relative ones relative to the list) is
+read the same way: memory-mapped and split in place, without checking
+whether the files exist (see Catalogue::exists()). The first entry is
+handed over right away. "-" reads stdin as it comes, for a pipeline
+which produces the pictures one by one.
+*/
+class DirScanner : boost::noncopyable {
+	std::thread m_thread;
+	std::mutex m_mutex;
+	std::vector<boost::filesystem::path> m_found;
+	bool m_running;
+	std::atomic<bool> m_cancel;
+
+	void _scan(boost::filesystem::path dir, int maxDepth);
+	void _scanList(boost::filesystem::path list);
+	// Reads a pipe (or anything else which cannot be mapped) until the end or cancel().
+	// Calls line() for each line, and afterRead() after the lines of each read().
+	template<typename F, typename G> void _readLines(int fd, F line, G afterRead);
+	void _flush(std::vector<boost::filesystem::path>& chunk);
+
+public:
+	DirScanner() : m_running(false), m_cancel(false) {}
+	~DirScanner() { cancel(); }
+
+	void start(const boost::filesystem::path& dir, int maxDepth);
+	void startList(const boost::filesystem::path& list);
+	void cancel();
+	bool isRunning();
+	// Appends everything found so far to out. Returns false if there was nothing new.
+	bool takeFound(std::vector<boost::filesystem::path>& out);
+};
+
+// By its extension. Used by both the scan and the DirWatcher.
+bool isPictureFilename(const boost::filesystem::path& path);
+
+#endif
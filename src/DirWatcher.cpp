@@ -0,0 +1,202 @@
+#include <SDL.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+#include <iostream>
+#include "DirWatcher.h"
+#include "DirScanner.h"
+#include "Picture.h"
+
+// How often the watch thread checks for stop().
+static const int PollMs = 100;
+
+static auto &errors = std::cerr;
+using std::endl;
+
+namespace fs = boost::filesystem;
+
+bool DirWatcher::start(const fs::path& dir, int maxDepth) {
+	stop();
+#ifdef __linux__
+	m_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+	if(m_fd < 0) {
+		errors << "cannot watch " << dir << ": " << strerror(errno) << endl;
+		return false;
+	}
+	m_maxDepth = maxDepth;
+	m_quit = false;
+	// The one of dir right here, so that whatever appears in there after we
+	// return is seen, e.g. while DirScanner reads it.
+	if(!_addWatch(dir, 0)) {
+		close(m_fd);
+		m_fd = -1;
+		return false;
+	}
+	// Those of the subdirectories by the thread, walking the tree can take a while.
+	// What appears in one before it is watched is found by the scan.
+	m_thread = std::thread([this, dir]() {
+		_watchSubdirs(dir, 0, false);
+		_run();
+	});
+	return true;
+#else
+	return false;
+#endif
+}
+
+void DirWatcher::stop() {
+	m_quit = true;
+	if(m_thread.joinable())
+		m_thread.join();
+	if(m_fd >= 0)
+		close(m_fd);
+	m_fd = -1;
+	m_dirs.clear();
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_events.clear();
+	m_eventByPath.clear();
+	m_overflow = false;
+}
+
+bool DirWatcher::takeChanges(std::vector<Event>& out, bool& overflow) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	overflow = m_overflow;
+	m_overflow = false;
+	const size_t before = out.size();
+	for(Event& e : m_events)
+		if(!e.path.empty()) out.push_back(std::move(e));
+	m_events.clear();
+	m_eventByPath.clear();
+	return out.size() > before || overflow;
+}
+
+void DirWatcher::_push(const fs::path& path, Change change) {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		// Only the last change counts, and it is ordered as the last one.
+		auto it = m_eventByPath.find(path.string());
+		if(it != m_eventByPath.end()) {
+			m_events[it->second].path.clear();
+			it->second = m_events.size();
+		}
+		else
+			m_eventByPath[path.string()] = m_events.size();
+		Event e;
+		e.path = path;
+		e.change = change;
+		m_events.push_back(e);
+	}
+	pushDecodedEvent(); // wakes up the main loop
+}
+
+bool DirWatcher::_addWatch(const fs::path& dir, int depth) {
+#ifdef __linux__
+	const int wd = inotify_add_watch(m_fd, dir.string().c_str(),
+		IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_CREATE | IN_ONLYDIR);
+	if(wd < 0) {
+		errors << "cannot watch " << dir << ": " << strerror(errno) << endl;
+		return false;
+	}
+	Dir& d = m_dirs[wd];
+	d.path = dir;
+	d.depth = depth;
+	return true;
+#else
+	return false;
+#endif
+}
+
+void DirWatcher::_watch(const fs::path& dir, int depth, bool report) {
+	if(_addWatch(dir, depth))
+		_watchSubdirs(dir, depth, report);
+}
+
+void DirWatcher::_watchSubdirs(const fs::path& dir, int depth, bool report) {
+	if(depth >= m_maxDepth && !report) return;
+
+	DIR* dh = opendir(dir.string().c_str());
+	if(!dh) return;
+	while(dirent* ent = readdir(dh)) {
+		if(m_quit) break;
+		if(strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) continue;
+		const fs::path path = dir / ent->d_name;
+		bool isFile = false, isDir = false;
+#ifdef DT_UNKNOWN
+		if(ent->d_type == DT_REG) isFile = true;
+		else if(ent->d_type == DT_DIR) isDir = true;
+		else if(ent->d_type == DT_UNKNOWN || ent->d_type == DT_LNK)
+#endif
+		{
+			struct stat st;
+			if(stat(path.string().c_str(), &st) != 0) continue;
+			isFile = S_ISREG(st.st_mode);
+			isDir = S_ISDIR(st.st_mode);
+		}
+		if(isDir && depth < m_maxDepth)
+			_watch(path, depth + 1, report);
+		else if(isFile && report && isPictureFilename(path))
+			_push(path, Changed);
+	}
+	closedir(dh);
+}
+
+void DirWatcher::_run() {
+#ifdef __linux__
+	alignas(struct inotify_event) char buf[64 * 1024];
+	while(!m_quit) {
+		struct pollfd p;
+		p.fd = m_fd;
+		p.events = POLLIN;
+		p.revents = 0;
+		const int r = poll(&p, 1, PollMs);
+		if(r < 0 && errno != EINTR) break;
+		if(r <= 0) continue;
+		const ssize_t n = read(m_fd, buf, sizeof(buf));
+		if(n < 0) {
+			if(errno == EINTR || errno == EAGAIN) continue;
+			errors << "cannot read directory changes: " << strerror(errno) << endl;
+			break;
+		}
+		for(const char* at = buf; at < buf + n;) {
+			const struct inotify_event* ev = (const struct inotify_event*) at;
+			at += sizeof(struct inotify_event) + ev->len;
+			if(ev->mask & IN_Q_OVERFLOW) {
+				{
+					std::lock_guard<std::mutex> lock(m_mutex);
+					m_overflow = true;
+				}
+				pushDecodedEvent();
+				continue;
+			}
+			auto it = m_dirs.find(ev->wd);
+			if(it == m_dirs.end()) continue;
+			if(ev->mask & IN_IGNORED) {
+				// the directory itself went away
+				m_dirs.erase(it);
+				continue;
+			}
+			if(ev->len == 0) continue;
+			// Copied, _watch() might rehash m_dirs.
+			const fs::path path = it->second.path / ev->name;
+			const int depth = it->second.depth;
+			if(ev->mask & IN_ISDIR) {
+				// One which was moved in comes with its content.
+				if((ev->mask & (IN_CREATE | IN_MOVED_TO)) && depth < m_maxDepth)
+					_watch(path, depth + 1, true);
+				continue;
+			}
+			if(!isPictureFilename(path)) continue;
+			if(ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+				_push(path, Changed);
+			else if(ev->mask & (IN_DELETE | IN_MOVED_FROM))
+				_push(path, Removed);
+		}
+	}
+#endif
+}
@@ -0,0 +1,71 @@
+#ifndef __ImageViewer_DirWatcher_h__
+#define __ImageViewer_DirWatcher_h__
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <boost/filesystem.hpp>
+#include <boost/noncopyable.hpp>
+
+/*
+Watches a directory (and its subdirectories up to maxDepth, also those
+created later) for pictures which appear, are rewritten or go away.
+inotify, thus Linux only; elsewhere start() just returns false.
+A file counts when it is closed after writing or moved in, not when it is
+created, so half-written files are not picked up.
+A thread reads the events and coalesces them per path: only the last
+change of a path counts, in the order of these last changes. The UI
+thread takes them via takeChanges(), like DirScanner::takeFound(), so a
+burst of thousands of events is handled as one batch.
+If the kernel queue overflows, events are lost and the directory has to
+be scanned again, which takeChanges() tells.
+*/
+class DirWatcher : boost::noncopyable {
+public:
+	enum Change { Changed, Removed }; // Changed: new or rewritten
+	struct Event {
+		boost::filesystem::path path;
+		Change change;
+	};
+
+private:
+	std::thread m_thread;
+	std::mutex m_mutex;
+	std::vector<Event> m_events;
+	std::unordered_map<std::string, size_t> m_eventByPath; // index into m_events
+	bool m_overflow;
+	std::atomic<bool> m_quit;
+	int m_fd;
+
+	struct Dir {
+		boost::filesystem::path path;
+		int depth;
+	};
+	std::unordered_map<int, Dir> m_dirs; // by watch descriptor. start() adds the root, then watch thread only
+	int m_maxDepth;
+
+	// Just the watch of dir itself.
+	bool _addWatch(const boost::filesystem::path& dir, int depth);
+	// Adds the watch, and those of the subdirectories up to m_maxDepth.
+	// If report, the pictures in there are reported as Changed.
+	void _watch(const boost::filesystem::path& dir, int depth, bool report);
+	void _watchSubdirs(const boost::filesystem::path& dir, int depth, bool report);
+	void _push(const boost::filesystem::path& path, Change change);
+	void _run();
+
+public:
+	DirWatcher() : m_overflow(false), m_quit(false), m_fd(-1), m_maxDepth(0) {}
+	~DirWatcher() { stop(); }
+
+	bool start(const boost::filesystem::path& dir, int maxDepth);
+	void stop();
+	bool isRunning() const { return m_fd >= 0; }
+	// Appends the changes so far to out. overflow is set if some were lost.
+	// Returns false if there was nothing new.
+	bool takeChanges(std::vector<Event>& out, bool& overflow);
+};
+
+#endif
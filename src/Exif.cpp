@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "Exif.h"
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+// TIFF structure inside of the APP1 segment. All offsets are relative to its start.
+struct Tiff {
+	const unsigned char* data;
+	size_t size;
+	bool bigEndian;
+
+	bool valid(size_t offset, size_t len) const { return offset <= size && len <= size - offset; }
+
+	uint16_t u16(size_t offset) const {
+		if(!valid(offset, 2)) return 0;
+		const unsigned char* p = data + offset;
+		return bigEndian ? uint16_t((p[0] << 8) | p[1]) : uint16_t((p[1] << 8) | p[0]);
+	}
+
+	uint32_t u32(size_t offset) const {
+		if(!valid(offset, 4)) return 0;
+		const unsigned char* p = data + offset;
+		if(bigEndian) return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+		return (uint32_t(p[3]) << 24) | (uint32_t(p[2]) << 16) | (uint32_t(p[1]) << 8) | p[0];
+	}
+
+	// Value of a SHORT or LONG entry. The value is stored inline for both.
+	uint32_t entryValue(size_t entry) const {
+		return (u16(entry + 2) == 3) ? u16(entry + 8) : u32(entry + 8);
+	}
+
+	// Calls f(tag, entryOffset) for every entry. Returns the offset of the next IFD.
+	template<typename F>
+	uint32_t forEachEntry(size_t ifd, F f) const {
+		if(ifd == 0 || !valid(ifd, 2)) return 0;
+		const int count = u16(ifd);
+		if(!valid(ifd + 2, size_t(count) * 12 + 4)) return 0;
+		for(int i = 0; i < count; ++i) {
+			size_t entry = ifd + 2 + i * 12;
+			f(u16(entry), entry);
+		}
+		return u32(ifd + 2 + count * 12);
+	}
+};
+
+void parseExif(const unsigned char* data, size_t size, ExifInfo& info, bool withThumbnail) {
+	if(size < 8) return;
+	Tiff tiff;
+	tiff.data = data;
+	tiff.size = size;
+	if(memcmp(data, "MM", 2) == 0) tiff.bigEndian = true;
+	else if(memcmp(data, "II", 2) == 0) tiff.bigEndian = false;
+	else return;
+	if(tiff.u16(2) != 42) return;
+
+	uint32_t exifIfd = 0;
+	uint32_t ifd1 = tiff.forEachEntry(tiff.u32(4), [&](uint16_t tag, size_t entry) {
+		if(tag == 0x0112) info.orientation = tiff.entryValue(entry);
+		else if(tag == 0x8769) exifIfd = tiff.entryValue(entry);
+	});
+
+	tiff.forEachEntry(exifIfd, [&](uint16_t tag, size_t entry) {
+		if(tag == 0x9003) { // DateTimeOriginal, ASCII, 20 bytes incl. 0
+			uint32_t count = tiff.u32(entry + 4);
+			uint32_t offset = tiff.u32(entry + 8);
+			if(count >= 19 && tiff.valid(offset, 19))
+				info.dateTimeOriginal.assign((const char*) data + offset, 19);
+		}
+	});
+
+	if(!withThumbnail) return;
+	uint32_t thumbOffset = 0, thumbLen = 0;
+	tiff.forEachEntry(ifd1, [&](uint16_t tag, size_t entry) {
+		if(tag == 0x0201) thumbOffset = tiff.entryValue(entry);
+		else if(tag == 0x0202) thumbLen = tiff.entryValue(entry);
+	});
+	if(thumbOffset > 0 && thumbLen > 0 && tiff.valid(thumbOffset, thumbLen))
+		info.thumbnail.assign(data + thumbOffset, data + thumbOffset + thumbLen);
+}
+
+}
+
+bool readExif(const fs::path& path, ExifInfo& info, bool withThumbnail) {
+	FILE* f = fopen(path.string().c_str(), "rb");
+	if(!f) return false;
+
+	unsigned char buf[4];
+	if(fread(buf, 1, 2, f) != 2 || buf[0] != 0xFF || buf[1] != 0xD8) {
+		fclose(f);
+		return false;
+	}
+
+	while(fread(buf, 1, 4, f) == 4) {
+		if(buf[0] != 0xFF) break;
+		const int marker = buf[1];
+		const size_t len = (size_t(buf[2]) << 8) | buf[3]; // includes the length field
+		if(len < 2) break;
+		if(marker == 0xDA) break; // start of scan, the image data follows
+
+		const bool isSOF = marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC;
+		if(marker == 0xE1 || isSOF) {
+			std::vector<unsigned char> seg(len - 2);
+			if(fread(&seg[0], 1, seg.size(), f) != seg.size()) break;
+			if(isSOF && seg.size() >= 5) {
+				info.height = (seg[1] << 8) | seg[2];
+				info.width = (seg[3] << 8) | seg[4];
+			}
+			else if(marker == 0xE1 && seg.size() > 6 && memcmp(&seg[0], "Exif\0\0", 6) == 0)
+				parseExif(&seg[6], seg.size() - 6, info, withThumbnail);
+		}
+		else if(fseek(f, long(len - 2), SEEK_CUR) != 0)
+			break;
+	}
+
+	fclose(f);
+	return true;
+}
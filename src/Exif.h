@@ -0,0 +1,21 @@
+#ifndef __ImageViewer_Exif_h__
+#define __ImageViewer_Exif_h__
+
+#include <string>
+#include <vector>
+#include <boost/filesystem.hpp>
+
+struct ExifInfo {
+	int width, height; // from the JPEG frame header, 0 if unknown
+	int orientation; // 1..8, 0 if unknown
+	std::string dateTimeOriginal; // "YYYY:MM:DD HH:MM:SS", empty if unknown
+	std::vector<unsigned char> thumbnail; // embedded JPEG thumbnail
+
+	ExifInfo() : width(0), height(0), orientation(0) {}
+};
+
+// Reads the JPEG header segments up to the image data, i.e. this is cheap.
+// Returns false if it is not a JPEG file.
+bool readExif(const boost::filesystem::path& path, ExifInfo& info, bool withThumbnail);
+
+#endif
@@ -1,156 +1,454 @@
 
 #include <SDL.h>
 #include <SDL_ttf.h>
-#include <list>
-#include <map>
+#include <stdlib.h>
+#include <ctype.h>
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
 #include <iostream>
+#ifdef HAVE_FONTCONFIG
+#include <fontconfig/fontconfig.h>
+#endif
 #include "Font.h"
+#include "Gfx.h"
+#include "Profiler.h"
+#include "LruCache.h"
 
+// Since SDL_ttf 2.0.18, the glyph functions cover all of unicode, not only the BMP.
+#ifdef SDL_TTF_VERSION_ATLEAST
+#if SDL_TTF_VERSION_ATLEAST(2,0,18)
+#define HAVE_TTF_GLYPH32
+#endif
+#endif
 
 static auto &errors = std::cerr;
 static auto &notes = std::cout;
 using std::endl;
 
-static const int CacheLimit = 100;
-struct RenderedText;
+namespace fs = boost::filesystem;
+
+static const int FontSize = 10;
+static const int AtlasSize = 512;
+// Between the glyphs in the atlas, so that filtering never bleeds into the neighbours.
+static const int AtlasPadding = 1;
+// Of laid out strings kept.
+static const size_t CacheBytes = 256 * 1024;
+
+// Without fontconfig, we look for these in the usual font directories, in that order.
+// Lower case.
+static const char* FontNames[] = {
+	"dejavusans.ttf",
+	"liberationsans-regular.ttf",
+	"arial.ttf",
+	"helvetica.ttc",
+	"notosans-regular.ttf",
+	"freesans.ttf",
+	"vera.ttf",
+};
+static const int NumFontNames = sizeof(FontNames) / sizeof(FontNames[0]);
 
-static int _compare(const std::string& a, const std::string& b) {
-	return a.compare(b);
+static std::string _lower(std::string s) {
+	for(char& c : s)
+		c = (char) tolower((unsigned char) c);
+	return s;
 }
 
-static int _compare(Uint8 a, Uint8 b) {
-	if(a < b) return -1;
-	if(a > b) return 1;
-	return 0;
+static std::vector<fs::path> _fontDirs() {
+	std::vector<fs::path> dirs;
+	if(const char* home = getenv("HOME")) {
+		dirs.push_back(fs::path(home) / ".local/share/fonts");
+		dirs.push_back(fs::path(home) / ".fonts");
+		dirs.push_back(fs::path(home) / "Library/Fonts");
+	}
+	dirs.push_back("/usr/share/fonts");
+	dirs.push_back("/usr/local/share/fonts");
+	dirs.push_back("/Library/Fonts");
+	dirs.push_back("/System/Library/Fonts");
+	if(const char* windir = getenv("WINDIR"))
+		dirs.push_back(fs::path(windir) / "Fonts");
+	return dirs;
 }
 
-#define _CompCheck(Attrib) \
-	{ int c = ::_compare(Attrib, other.Attrib); if(c != 0) return c; }
+// One of FontNames if there, otherwise any TrueType/OpenType font.
+static fs::path _searchFontFile() {
+	fs::path best;
+	int bestRank = NumFontNames + 1;
+	for(auto& dir : _fontDirs()) {
+		boost::system::error_code ec;
+		for(fs::recursive_directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+			const std::string name = _lower(it->path().filename().string());
+			int rank = NumFontNames;
+			for(int i = 0; i < NumFontNames; ++i)
+				if(name == FontNames[i]) {
+					rank = i;
+					break;
+				}
+			if(rank == NumFontNames) {
+				const std::string ext = _lower(it->path().extension().string());
+				if(ext != ".ttf" && ext != ".otf" && ext != ".ttc") continue;
+			}
+			if(rank < bestRank) {
+				best = it->path();
+				bestRank = rank;
+				if(rank == 0) return best;
+			}
+		}
+	}
+	return best;
+}
 
-struct Cache {
-	struct Key {
-		std::string text;
-		SDL_Color fg;
+static fs::path _findFontFile() {
+#ifdef HAVE_FONTCONFIG
+	fs::path file;
+	if(FcInit()) {
+		FcPattern* pattern = FcNameParse((const FcChar8*) "sans-serif");
+		FcConfigSubstitute(NULL, pattern, FcMatchPattern);
+		FcDefaultSubstitute(pattern);
+		FcResult result;
+		FcPattern* match = FcFontMatch(NULL, pattern, &result);
+		FcChar8* matchFile = NULL;
+		if(match && FcPatternGetString(match, FC_FILE, 0, &matchFile) == FcResultMatch)
+			file = (const char*) matchFile;
+		if(match)
+			FcPatternDestroy(match);
+		FcPatternDestroy(pattern);
+	}
+	if(!file.empty()) return file;
+#endif
+	return _searchFontFile();
+}
 
-		Key() : text(), fg() {}
-		Key(const std::string& _t, SDL_Color _fg)
-				: text(_t), fg(_fg) {}
 
-		int compare(const Key& other) const {
-			_CompCheck(text);
-			_CompCheck(fg.r);
-			_CompCheck(fg.g);
-			_CompCheck(fg.b);
-			_CompCheck(fg.a);
-			return 0;
-		}
+struct Font {
+	TTF_Font* m_font;
+	bool m_opened; // tried to
+	fs::path m_file; // empty: search for one
 
-		bool operator<(const Key& other) const {
-			return compare(other) < 0;
-		}
-	};
+	Font() : m_font(0), m_opened(false) {}
 
-	std::list<RenderedText*> list;
-	std::map<Key, RenderedText*> byString;
+	// Lazily, on the first text.
+	bool open() {
+		if(m_opened) return m_font != NULL;
+		m_opened = true;
 
-	void clear();
-	void removeBottom();
+		if(TTF_Init() != 0) {
+			errors << "TTF_Init failed: " << TTF_GetError() << endl;
+			return false;
+		}
+
+		if(m_file.empty())
+			m_file = _findFontFile();
+		if(m_file.empty()) {
+			errors << "no font found, use --font" << endl;
+			return false;
+		}
+		m_font = TTF_OpenFont(m_file.string().c_str(), FontSize);
+		if(!m_font) {
+			errors << "cannot open font " << m_file << ": " << TTF_GetError() << endl;
+			return false;
+		}
+		notes << "font: " << m_file.string() << endl;
+		return true;
+	}
 
-	~Cache() {
-		clear();
+	~Font() {
+		if(m_font)
+			TTF_CloseFont(m_font);
+		m_font = 0;
 	}
 };
 
-static Cache cache;
+static Font font;
 
-struct RenderedText {
-	Cache::Key m_key;
-	std::shared_ptr<Texture> m_texture;
-	decltype(cache.list.begin()) m_listPtr;
+#ifdef HAVE_TTF_GLYPH32
+static bool _glyphProvided(Uint32 c) {
+	return TTF_GlyphIsProvided32(font.m_font, c) != 0;
+}
 
-	void moveTop() {
-		cache.list.push_front(this);
-		cache.list.erase(m_listPtr);
-		m_listPtr = cache.list.begin();
-	}
-};
+static SDL_Surface* _renderGlyph(Uint32 c) {
+	return TTF_RenderGlyph32_Blended(font.m_font, c, ColorWhite());
+}
 
-void Cache::clear() {
-	for(RenderedText* r : list)
-		delete r;
-	list.clear();
-	byString.clear();
+static int _advance(Uint32 c) {
+	int minx, maxx, miny, maxy, advance = 0;
+	TTF_GlyphMetrics32(font.m_font, c, &minx, &maxx, &miny, &maxy, &advance);
+	return advance;
 }
 
-void Cache::removeBottom() {
-	assert(!list.empty());
-	RenderedText* r = list.back();
-	list.pop_back();
-	byString.erase(r->m_key);
-	delete r;
+static int _kerning(Uint32 prev, Uint32 c) {
+	return TTF_GetFontKerningSizeGlyphs32(font.m_font, prev, c);
+}
+#else
+// Only the basic multilingual plane.
+static bool _glyphProvided(Uint32 c) {
+	return c <= 0xffff && TTF_GlyphIsProvided(font.m_font, Uint16(c)) != 0;
 }
 
+static SDL_Surface* _renderGlyph(Uint32 c) {
+	return TTF_RenderGlyph_Blended(font.m_font, Uint16(c), ColorWhite());
+}
 
-struct Font {
-	TTF_Font* m_font;
+static int _advance(Uint32 c) {
+	int minx, maxx, miny, maxy, advance = 0;
+	TTF_GlyphMetrics(font.m_font, Uint16(c), &minx, &maxx, &miny, &maxy, &advance);
+	return advance;
+}
 
-	Font() : m_font(0) {
-		if(TTF_Init() != 0) {
-			errors << "TTF_Init failed: " << TTF_GetError() << endl;
-			return;
-		}
+static int _kerning(Uint32 prev, Uint32 c) {
+#if defined(SDL_TTF_VERSION_ATLEAST)
+	return TTF_GetFontKerningSizeGlyphs(font.m_font, Uint16(prev), Uint16(c));
+#else
+	(void) prev; (void) c;
+	return 0;
+#endif
+}
+#endif
+
+// The next code point of the UTF-8 string s at i, and moves i behind it.
+// U+FFFD for invalid sequences.
+static Uint32 _nextCodepoint(const std::string& s, size_t& i) {
+	const Uint8 c = s[i++];
+	if(c < 0x80) return c;
+	int len;
+	Uint32 cp;
+	if((c & 0xe0) == 0xc0) { len = 1; cp = c & 0x1f; }
+	else if((c & 0xf0) == 0xe0) { len = 2; cp = c & 0x0f; }
+	else if((c & 0xf8) == 0xf0) { len = 3; cp = c & 0x07; }
+	else return 0xfffd;
+	for(int k = 0; k < len; ++k) {
+		if(i >= s.size() || (Uint8(s[i]) & 0xc0) != 0x80) return 0xfffd;
+		cp = (cp << 6) | (Uint8(s[i++]) & 0x3f);
+	}
+	if(cp > 0x10ffff || (cp >= 0xd800 && cp < 0xe000)) return 0xfffd;
+	return cp;
+}
 
-		m_font = TTF_OpenFont("/Library/Fonts/Arial.ttf", 10);
-		if(!m_font) {
-			errors << "cannot open font: " << TTF_GetError() << endl;
-			return;
+
+struct Layout {
+	struct Quad {
+		SDL_Rect src; // in the atlas
+		int x; // relative to the start of the text. the top is always the line top
+	};
+
+	std::vector<Quad> m_quads;
+	SDL_Point m_size;
+
+	size_t bytes(const std::string& text) const {
+		return sizeof(Layout) + text.size() + m_quads.capacity() * sizeof(Quad);
+	}
+};
+
+// Laid out strings by their text. The color is only applied when drawing.
+static LruCache<std::string, Layout> cache(CacheBytes);
+
+
+struct Glyph {
+	SDL_Rect src; // in the atlas. empty if there is nothing to draw, e.g. space
+	int advance;
+};
+
+/*
+All glyphs we have drawn so far, white, in one texture, packed in rows.
+When it is full, it is cleared and filled again with what is needed
+from then on. The layouts refer to it, so they are cleared as well.
+*/
+struct Atlas : boost::noncopyable {
+	SmartPointer<SDL_Renderer> m_renderer; // before m_texture, so that it is destroyed after it
+	Texture m_texture;
+	bool m_failed;
+	std::unordered_map<Uint32, Glyph> m_glyphs;
+	int m_x, m_y, m_rowH; // where the next glyph goes
+	int m_generation; // counts the resets
+
+	Atlas() : m_failed(false), m_x(0), m_y(0), m_rowH(0), m_generation(0) {}
+
+	bool _create() {
+		if(m_failed) return false;
+		m_renderer = rendererRef;
+		m_texture.m_texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, AtlasSize, AtlasSize);
+		if(!m_texture) {
+			errors << "cannot create the glyph atlas: " << SDL_GetError() << endl;
+			m_renderer = NULL;
+			m_failed = true;
+			return false;
 		}
+		SDL_SetTextureBlendMode(m_texture.m_texture, SDL_BLENDMODE_BLEND);
+#if SDL_VERSION_ATLEAST(2,0,12)
+		// Always drawn 1:1.
+		SDL_SetTextureScaleMode(m_texture.m_texture, SDL_ScaleModeNearest);
+#endif
+		_reset();
+		return true;
 	}
 
-	~Font() {
-		if(m_font)
-			TTF_CloseFont(m_font);
-		m_font = 0;
+	void _reset() {
+		std::vector<Uint32> transparent(AtlasSize * AtlasSize, 0);
+		SDL_UpdateTexture(m_texture.m_texture, NULL, &transparent[0], AtlasSize * 4);
+		m_glyphs.clear();
+		m_x = m_y = m_rowH = 0;
+		m_generation++;
+		cache.clear();
+	}
+
+	void clear() {
+		m_glyphs.clear();
+		if(m_texture.m_texture)
+			SDL_DestroyTexture(m_texture.m_texture);
+		m_texture.m_texture = NULL;
+		m_renderer = NULL;
+		m_x = m_y = m_rowH = 0;
+		m_generation++;
+		cache.clear();
 	}
 
-	operator bool() const { return m_font != NULL; }
+	// Rasterizes it if it is not in the atlas yet. The pointer is valid until the next call.
+	const Glyph* glyph(Uint32 c) {
+		auto it = m_glyphs.find(c);
+		if(it != m_glyphs.end()) return &it->second;
+		if(!m_texture && !_create()) return NULL;
+
+		ProfileScope scope("rasterize glyph");
+		Glyph g;
+		g.src.x = g.src.y = g.src.w = g.src.h = 0;
+		g.advance = _advance(c);
+		Surface surface(_renderGlyph(c));
+		if(surface && surface.m_surf->format->format != SDL_PIXELFORMAT_ARGB8888) {
+			Surface converted(SDL_ConvertSurfaceFormat(surface.m_surf, SDL_PIXELFORMAT_ARGB8888, 0));
+			std::swap(surface.m_surf, converted.m_surf);
+		}
+		if(surface && surface.m_surf->w > 0 && surface.m_surf->h > 0) {
+			const int w = std::min(surface.m_surf->w, AtlasSize);
+			const int h = std::min(surface.m_surf->h, AtlasSize);
+			if(m_x + w > AtlasSize) {
+				m_x = 0;
+				m_y += m_rowH + AtlasPadding;
+				m_rowH = 0;
+			}
+			if(m_y + h > AtlasSize)
+				_reset();
+			g.src.x = m_x;
+			g.src.y = m_y;
+			g.src.w = w;
+			g.src.h = h;
+			SDL_UpdateTexture(m_texture.m_texture, &g.src, surface.m_surf->pixels, surface.m_surf->pitch);
+			m_x += w + AtlasPadding;
+			m_rowH = std::max(m_rowH, h);
+		}
+		return &(m_glyphs[c] = g);
+	}
 };
 
-static Font font;
+static Atlas atlas;
+
+
+static void _layoutText(const std::string& t, Layout& l) {
+	l.m_quads.clear();
+	l.m_size.x = 0;
+	l.m_size.y = TTF_FontHeight(font.m_font);
+	int x = 0;
+	Uint32 prev = 0;
+	for(size_t i = 0; i < t.size();) {
+		Uint32 c = _nextCodepoint(t, i);
+		if(!_glyphProvided(c)) c = '?';
+		const Glyph* g = atlas.glyph(c);
+		if(!g) continue;
+		if(prev) x += _kerning(prev, c);
+		if(g->src.w > 0) {
+			Layout::Quad q;
+			q.src = g->src;
+			q.x = x;
+			l.m_quads.push_back(q);
+			l.m_size.x = std::max(l.m_size.x, x + g->src.w);
+		}
+		x += g->advance;
+		prev = c;
+	}
+	l.m_size.x = std::max(l.m_size.x, x);
+}
 
+static const Layout* _layout(const std::string& t) {
+	auto e = cache.find(t);
+	if(e) return &e->value;
 
-std::shared_ptr<Texture> getTextureForText(const std::string& t, SDL_Color fg) {
-	Cache::Key key(t, fg);
+	if(!font.open()) return NULL;
+	ProfileScope scope("layout text");
 
-	auto it = cache.byString.find(key);
-	if(it != cache.byString.end()) {
-		RenderedText* r = it->second;
-		r->moveTop();
-		return r->m_texture;
+	Layout l;
+	// If the atlas was reset meanwhile, the first glyphs are gone, so once again.
+	// Only a string with more glyphs than fit into the atlas needs more.
+	for(int attempt = 0; attempt < 2; ++attempt) {
+		const int generation = atlas.m_generation;
+		_layoutText(t, l);
+		if(atlas.m_generation == generation) break;
 	}
 
-	if(!font) return NULL;
+	const size_t bytes = l.bytes(t);
+	e = cache.put(t, std::move(l), bytes);
+	cache.evict();
+	return &e->value;
+}
 
-	if(cache.list.size() >= CacheLimit)
-		cache.removeBottom();
+SDL_Point textSize(const std::string& t) {
+	const Layout* l = _layout(t);
+	if(l) return l->m_size;
+	SDL_Point size = {0, 0};
+	return size;
+}
 
-	Surface surface(TTF_RenderUTF8_Blended(font.m_font, t.c_str(), fg));
-	if(!surface) {
-		errors << "TTF_RenderUTF8_Blended failed: " << TTF_GetError() << endl;
-		return NULL;
+SDL_Point drawText(const std::string& t, int x, int y, SDL_Color fg) {
+	const Layout* l = _layout(t);
+	if(!l) {
+		SDL_Point size = {0, 0};
+		return size;
+	}
+	if(l->m_quads.empty() || !atlas.m_texture) return l->m_size;
+
+#if SDL_VERSION_ATLEAST(2,0,18)
+	// All glyphs in one draw call. The vertex color tints the white glyphs.
+	static std::vector<SDL_Vertex> vertices;
+	static std::vector<int> indices;
+	static const int QuadIndices[6] = {0, 1, 2, 1, 3, 2};
+	const float scale = 1.0f / AtlasSize;
+	vertices.clear();
+	indices.clear();
+	for(auto& q : l->m_quads) {
+		const int base = int(vertices.size());
+		for(int k = 0; k < 4; ++k) {
+			const int dx = (k & 1) ? q.src.w : 0;
+			const int dy = (k & 2) ? q.src.h : 0;
+			SDL_Vertex v;
+			v.position.x = float(x + q.x + dx);
+			v.position.y = float(y + dy);
+			v.color = fg;
+			v.tex_coord.x = (q.src.x + dx) * scale;
+			v.tex_coord.y = (q.src.y + dy) * scale;
+			vertices.push_back(v);
+		}
+		for(int k : QuadIndices)
+			indices.push_back(base + k);
 	}
+	SDL_RenderGeometry(renderer, atlas.m_texture.m_texture,
+		&vertices[0], int(vertices.size()), &indices[0], int(indices.size()));
+#else
+	SDL_SetTextureColorMod(atlas.m_texture.m_texture, fg.r, fg.g, fg.b);
+	SDL_SetTextureAlphaMod(atlas.m_texture.m_texture, fg.a);
+	for(auto& q : l->m_quads) {
+		SDL_Rect dst = {x + q.x, y, q.src.w, q.src.h};
+		SDL_RenderCopy(renderer, atlas.m_texture.m_texture, &q.src, &dst);
+	}
+#endif
+	return l->m_size;
+}
 
-	std::shared_ptr<Texture> texture(new Texture(renderer, surface.m_surf));
-	if(!*texture) return NULL;
-	SDL_SetTextureBlendMode(texture->m_texture, SDL_BLENDMODE_BLEND);
+int textGlyphCount() {
+	return int(atlas.m_glyphs.size());
+}
 
-	// put into cache
-	RenderedText* r = new RenderedText();
-	cache.list.push_front(r);
-	cache.byString[key] = r;
-	r->m_listPtr = cache.list.begin();
-	r->m_key = key;
-	r->m_texture = texture;
+void clearText() {
+	atlas.clear();
+}
 
-	return texture;
+void setFontFile(const fs::path& file) {
+	font.m_file = file;
 }
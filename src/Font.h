@@ -1,11 +1,28 @@
 #ifndef __ImageViewer_Font_h__
 #define __ImageViewer_Font_h__
 
-#include <memory>
 #include <string>
 #include <SDL.h>
-#include "Gfx.h"
+#include <boost/filesystem.hpp>
 
-std::shared_ptr<Texture> getTextureForText(const std::string& t, SDL_Color fg);
+/*
+Text for the overlays. Every glyph is rasterized only once, into a shared
+atlas texture. A string is laid out from the glyph metrics (UTF-8, with
+kerning) and drawn as one batch of quads, so changing text (counters,
+timings) does not create any textures.
+UI thread only.
+*/
+
+// Width and height of t in pixels.
+SDL_Point textSize(const std::string& t);
+// Draws t with its top left corner at (x, y). Returns its size.
+SDL_Point drawText(const std::string& t, int x, int y, SDL_Color fg);
+// Number of glyphs in the atlas.
+int textGlyphCount();
+// Releases the atlas texture. Before the renderer goes away.
+void clearText();
+
+// Overrides the font lookup. Before the first text is drawn.
+void setFontFile(const boost::filesystem::path& file);
 
 #endif
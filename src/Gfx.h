@@ -6,6 +6,8 @@
 #include <iostream>
 #include <assert.h>
 #include <stdint.h>
+#include "SmartPointer.h"
+#include "PixelPool.h"
 
 struct Surface : boost::noncopyable {
 	SDL_Surface* m_surf;
@@ -13,7 +15,7 @@ struct Surface : boost::noncopyable {
 	operator bool() const { return m_surf != NULL; }
 	~Surface() {
 		if(m_surf)
-			SDL_FreeSurface(m_surf);
+			freeSurface(m_surf);
 		m_surf = 0;
 	}
 };
@@ -35,6 +37,10 @@ struct Texture : boost::noncopyable {
 };
 
 extern SDL_Renderer* renderer;
+// The main loop only draws a frame when something changed. Requests another one. UI thread only.
+void requestRedraw();
+// Same as renderer. Keeps it alive as long as some SurfaceTexture uses it.
+extern SmartPointer<SDL_Renderer> rendererRef;
 
 static inline SDL_Color Color(uint8_t r, uint8_t g, uint8_t b, uint8_t a) {
 	SDL_Color c;
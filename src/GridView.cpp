@@ -0,0 +1,304 @@
+#include <SDL.h>
+#include <algorithm>
+#include <iostream>
+#include "GridView.h"
+#include "Gfx.h"
+#include "Pictures.h"
+#include "WorkerPool.h"
+#include "ThumbnailStore.h"
+#include "Scale.h"
+
+static auto &errors = std::cerr;
+using std::endl;
+
+namespace fs = boost::filesystem;
+
+GridView gridView;
+
+// below the region decoding (0) and the picture prefetching (1)
+static const int ThumbnailQueue = 2;
+static const int MaxPages = 8;
+
+GridView::GridView()
+: m_frame(0), m_scrollY(0), m_columns(1), m_wantedSlots(0),
+m_requestedFirst(0), m_requestedLast(0), m_requestedCount(0),
+m_active(false), m_selected(0) {}
+
+GridView::~GridView() {
+	clear();
+}
+
+void GridView::clear() {
+	workerPool.clearQueue(ThumbnailQueue);
+	m_pages.clear();
+	m_slots.clear();
+	m_freeSlots.clear();
+	m_slotByOwner.clear();
+	std::lock_guard<std::mutex> lock(m_doneMutex);
+	m_done.clear();
+}
+
+void GridView::enter() {
+	m_active = true;
+	m_selected = pictures.curIndex();
+	m_requestedFirst = m_requestedLast = m_requestedCount = 0;
+	_select(m_selected);
+}
+
+void GridView::catalogueChanged() {
+	m_requestedFirst = m_requestedLast = m_requestedCount = 0;
+	if(m_active) _select(m_selected);
+}
+
+void GridView::leave() {
+	m_active = false;
+	workerPool.clearQueue(ThumbnailQueue);
+	pictures.selectIndex(m_selected);
+}
+
+int GridView::_viewHeight() {
+	int w = 0, h = 0;
+	SDL_GetRendererOutputSize(renderer, &w, &h);
+	m_columns = std::max(w / CellSize, 1);
+	return h;
+}
+
+void GridView::_select(size_t idx) {
+	const size_t count = pictures.size();
+	if(count == 0) return;
+	m_selected = std::min(idx, count - 1);
+	// scroll such that it is visible
+	const int row = int(m_selected / m_columns);
+	const int viewH = _viewHeight();
+	if(row * CellSize < m_scrollY) m_scrollY = row * CellSize;
+	if((row + 1) * CellSize > m_scrollY + viewH) m_scrollY = (row + 1) * CellSize - viewH;
+}
+
+bool GridView::onKeyDown(const SDL_KeyboardEvent& ev) {
+	const size_t count = pictures.size();
+	const int viewH = _viewHeight();
+	const size_t pageCells = std::max(viewH / CellSize, 1) * m_columns;
+	switch(ev.keysym.sym) {
+		case SDLK_ESCAPE:
+		case SDLK_RETURN:
+		case 'g':
+			leave();
+			return true;
+		case SDLK_LEFT:
+			if(m_selected > 0) _select(m_selected - 1);
+			return true;
+		case SDLK_RIGHT:
+			_select(m_selected + 1);
+			return true;
+		case SDLK_UP:
+			if(m_selected >= (size_t) m_columns) _select(m_selected - m_columns);
+			return true;
+		case SDLK_DOWN:
+			if(m_selected + m_columns < count) _select(m_selected + m_columns);
+			return true;
+		case SDLK_PAGEUP:
+			_select(m_selected >= pageCells ? m_selected - pageCells : 0);
+			return true;
+		case SDLK_PAGEDOWN:
+			_select(m_selected + pageCells);
+			return true;
+		case SDLK_HOME:
+			_select(0);
+			return true;
+		case SDLK_END:
+			if(count > 0) _select(count - 1);
+			return true;
+		default:
+			return false;
+	}
+}
+
+bool GridView::onMouseWheel(const SDL_MouseWheelEvent& ev) {
+	m_scrollY -= ev.y * CellSize / 2;
+	return true;
+}
+
+bool GridView::onMouseButtonDown(const SDL_MouseButtonEvent& ev) {
+	if(ev.button != SDL_BUTTON_LEFT) return false;
+	const int col = ev.x / CellSize;
+	if(col >= m_columns) return true;
+	const size_t idx = size_t((ev.y + m_scrollY) / CellSize) * m_columns + col;
+	if(idx >= pictures.size()) return true;
+	_select(idx);
+	if(ev.clicks >= 2) leave();
+	return true;
+}
+
+SDL_Rect GridView::_slotRect(int slot) const {
+	const int i = slot % SlotsPerPage;
+	SDL_Rect r;
+	r.x = (i % SlotsPerRow) * ThumbSize;
+	r.y = (i / SlotsPerRow) * ThumbSize;
+	r.w = m_slots[slot].w;
+	r.h = m_slots[slot].h;
+	return r;
+}
+
+int GridView::_allocSlot() {
+	if(!m_freeSlots.empty()) {
+		const int slot = m_freeSlots.back();
+		m_freeSlots.pop_back();
+		return slot;
+	}
+	// Otherwise the least recently used one, unless it is visible right now,
+	// in which case all are. Uploads come before the cells of this frame are
+	// stamped, thus what was drawn in the last frame counts as visible.
+	LruCache<PictureState*, int>::Entry* oldest = m_slotByOwner.oldest();
+	const int best = (oldest && m_frame - m_slots[oldest->value].lastUsedFrame > 1) ? oldest->value : -1;
+	if((best < 0 || m_slots.size() < m_wantedSlots) && (int) m_pages.size() < MaxPages) {
+		SDL_Texture* page = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, AtlasSize, AtlasSize);
+		if(!page) {
+			errors << "GridView: cannot create atlas texture: " << SDL_GetError() << endl;
+			return best;
+		}
+		m_pages.push_back(page);
+		Slot free;
+		free.w = free.h = 0;
+		free.lastUsedFrame = 0;
+		m_slots.resize(m_slots.size() + SlotsPerPage, free);
+		for(int i = (int) m_slots.size() - 1; i > (int) m_slots.size() - SlotsPerPage; --i)
+			m_freeSlots.push_back(i);
+		return (int) m_slots.size() - SlotsPerPage;
+	}
+	if(best >= 0) {
+		m_slotByOwner.erase(oldest);
+		m_slots[best].owner.reset();
+	}
+	return best;
+}
+
+void GridView::_upload(const Done& done) {
+	if(m_slotByOwner.peek(done.owner.get())) return; // duplicate
+	const int slot = _allocSlot();
+	if(slot < 0) return;
+	Slot& s = m_slots[slot];
+	s.owner = done.owner;
+	s.w = std::min(done.thumb->w, (int) ThumbSize);
+	s.h = std::min(done.thumb->h, (int) ThumbSize);
+	s.lastUsedFrame = m_frame;
+	SDL_Rect r = _slotRect(slot);
+	SDL_UpdateTexture(m_pages[slot / SlotsPerPage].get(), &r, done.thumb->pixels, done.thumb->pitch);
+	m_slotByOwner.put(done.owner.get(), slot, 1);
+}
+
+void GridView::_requestThumbnails(size_t first, size_t last, size_t margin) {
+	const size_t count = pictures.size();
+	if(first == m_requestedFirst && last == m_requestedLast && count == m_requestedCount) return;
+	m_requestedFirst = first;
+	m_requestedLast = last;
+	m_requestedCount = count;
+
+	// the visible ones first, then the next page, then the previous page
+	std::vector<WorkerPool::Job> jobs;
+	auto addRange = [&](size_t a, size_t b) {
+		const Catalogue& catalogue = pictures.m_catalogue;
+		for(size_t i = a; i < b; ++i) {
+			if(m_slotByOwner.peek(catalogue.stateAt(i).get())) continue;
+			std::shared_ptr<PictureState> owner = catalogue.stateAt(i);
+			fs::path path = catalogue.pathAt(i);
+			jobs.push_back([this, owner, path]() {
+				int fullW = 0, fullH = 0;
+				SmartPointer<SDL_Surface> thumb = thumbnailStore.getOrCreate(path, &fullW, &fullH);
+				if(!thumb.get()) return;
+				thumb = fitSurface(thumb, ThumbSize, ThumbSize);
+				if(!thumb.get()) return;
+				{
+					std::lock_guard<std::mutex> lock(m_doneMutex);
+					Done done;
+					done.owner = owner;
+					done.thumb = thumb;
+					m_done.push_back(done);
+				}
+				pushDecodedEvent();
+			});
+		}
+	};
+	addRange(first, last);
+	addRange(last, std::min(last + margin, count));
+	addRange(first >= margin ? first - margin : 0, first);
+	workerPool.setQueue(ThumbnailQueue, jobs);
+}
+
+void GridView::render() {
+	int viewW = 0, viewH = 0;
+	SDL_GetRendererOutputSize(renderer, &viewW, &viewH);
+	m_columns = std::max(viewW / CellSize, 1);
+	const size_t count = pictures.size();
+	const int rows = int((count + m_columns - 1) / m_columns);
+	m_scrollY = std::max(std::min(m_scrollY, rows * CellSize - viewH), 0);
+
+	const size_t first = size_t(m_scrollY / CellSize) * m_columns;
+	const size_t last = std::min(size_t((m_scrollY + viewH - 1) / CellSize + 1) * m_columns, count);
+	_requestThumbnails(first, last, last - first);
+	// the visible ones plus the margin on both sides
+	m_wantedSlots = (last - first) * 3;
+
+	// Upload finished thumbnails. Limited per frame, so that we don't stutter
+	// while scrolling. The rest is done in the next frames.
+	{
+		std::vector<Done> done;
+		{
+			std::lock_guard<std::mutex> lock(m_doneMutex);
+			const size_t n = std::min(m_done.size(), (size_t) MaxUploadsPerFrame);
+			done.assign(m_done.begin(), m_done.begin() + n);
+			m_done.erase(m_done.begin(), m_done.begin() + n);
+			if(!m_done.empty()) requestRedraw(); // the rest in the next frame
+		}
+		for(auto& d : done)
+			_upload(d);
+	}
+
+	// Collect what to draw. Grouped by atlas page below, so that the renderer can batch it.
+	struct Cell { int slot; SDL_Rect dst; };
+	std::vector<Cell> cells;
+	std::vector<SDL_Rect> placeholders;
+	SDL_Rect selectedRect = {0, 0, 0, 0};
+	for(size_t i = first; i < last; ++i) {
+		SDL_Rect cellRect;
+		cellRect.x = int(i % m_columns) * CellSize;
+		cellRect.y = int(i / m_columns) * CellSize - m_scrollY;
+		cellRect.w = cellRect.h = CellSize;
+		if(i == m_selected) selectedRect = cellRect;
+
+		auto slotIt = m_slotByOwner.find(pictures.m_catalogue.stateAt(i).get());
+		if(!slotIt) {
+			SDL_Rect r = cellRect;
+			r.x += (CellSize - ThumbSize) / 2;
+			r.y += (CellSize - ThumbSize) / 2;
+			r.w = r.h = ThumbSize;
+			placeholders.push_back(r);
+			continue;
+		}
+		Slot& slot = m_slots[slotIt->value];
+		slot.lastUsedFrame = m_frame;
+		Cell c;
+		c.slot = slotIt->value;
+		c.dst.w = slot.w;
+		c.dst.h = slot.h;
+		c.dst.x = cellRect.x + (CellSize - slot.w) / 2;
+		c.dst.y = cellRect.y + (CellSize - slot.h) / 2;
+		cells.push_back(c);
+	}
+
+	SDL_SetRenderDrawColor(renderer, 40, 40, 40, 255);
+	if(!placeholders.empty())
+		SDL_RenderFillRects(renderer, &placeholders[0], (int) placeholders.size());
+	for(size_t page = 0; page < m_pages.size(); ++page)
+		for(auto& c : cells) {
+			if(size_t(c.slot / SlotsPerPage) != page) continue;
+			SDL_Rect src = _slotRect(c.slot);
+			SDL_RenderCopy(renderer, m_pages[page].get(), &src, &c.dst);
+		}
+	if(selectedRect.w > 0) {
+		SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+		SDL_RenderDrawRect(renderer, &selectedRect);
+	}
+	SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+
+	m_frame++;
+}
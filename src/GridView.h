@@ -0,0 +1,89 @@
+#ifndef __ImageViewer_GridView_h__
+#define __ImageViewer_GridView_h__
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <SDL.h>
+#include <boost/noncopyable.hpp>
+#include "SmartPointer.h"
+#include "LruCache.h"
+
+struct PictureState;
+
+/*
+Contact sheet of all pictures. Only the visible cells are drawn and only
+for those, thumbnails are requested from the decode workers. Finished
+thumbnails are uploaded into slots of a few big atlas textures, so drawing
+a screen full of thumbnails are just a few batched copies from the same
+textures. Slots are reused in LRU order.
+*/
+class GridView : boost::noncopyable {
+public:
+	enum {
+		CellSize = 160,
+		ThumbSize = 150, // max thumbnail width/height within a cell
+		AtlasSize = 2048,
+		SlotsPerRow = AtlasSize / ThumbSize,
+		SlotsPerPage = SlotsPerRow * SlotsPerRow,
+		MaxUploadsPerFrame = 16
+	};
+
+private:
+	struct Slot {
+		std::shared_ptr<PictureState> owner; // NULL if free
+		int w, h;
+		Uint32 lastUsedFrame;
+	};
+
+	struct Done {
+		std::shared_ptr<PictureState> owner;
+		SmartPointer<SDL_Surface> thumb;
+	};
+
+	std::vector<SmartPointer<SDL_Texture> > m_pages;
+	std::vector<Slot> m_slots;
+	std::vector<int> m_freeSlots;
+	LruCache<PictureState*, int> m_slotByOwner; // most recently drawn first
+
+	std::mutex m_doneMutex;
+	std::vector<Done> m_done; // from the workers, not yet uploaded
+
+	Uint32 m_frame;
+	int m_scrollY;
+	int m_columns;
+	size_t m_wantedSlots;
+	size_t m_requestedFirst, m_requestedLast, m_requestedCount;
+
+	bool m_active;
+	size_t m_selected;
+
+	int _allocSlot();
+	void _upload(const Done& done);
+	void _requestThumbnails(size_t first, size_t last, size_t margin);
+	void _select(size_t idx);
+	int _viewHeight();
+	SDL_Rect _slotRect(int slot) const;
+
+public:
+	GridView();
+	~GridView();
+
+	bool isActive() const { return m_active; }
+	void enter();
+	void leave();
+	void clear();
+	// Pictures were added or removed. Requests the thumbnails again.
+	void catalogueChanged();
+
+	// Returns true if handled.
+	bool onKeyDown(const SDL_KeyboardEvent& ev);
+	bool onMouseWheel(const SDL_MouseWheelEvent& ev);
+	bool onMouseButtonDown(const SDL_MouseButtonEvent& ev);
+
+	void render();
+};
+
+extern GridView gridView;
+
+#endif
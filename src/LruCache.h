@@ -0,0 +1,210 @@
+#ifndef __ImageViewer_LruCache_h__
+#define __ImageViewer_LruCache_h__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <assert.h>
+#include <algorithm>
+#include <functional>
+#include <utility>
+#include <vector>
+#include <boost/noncopyable.hpp>
+
+/*
+Hash table plus most-recently-used list. Intrusive: each entry is a single
+allocation which holds the key, the value, its size and the links of both
+the hash chain and the list, so a lookup is O(1) and moving an entry to the
+front is just relinking it.
+Entries are accounted in bytes (or any other unit) against a budget,
+unlimited by default. evict() removes from the least recently used end while
+over budget. The most recently used entry is never evicted, so that what
+was just put() stays valid.
+Not thread-safe, the owner has to lock.
+*/
+template<typename Key, typename Value, typename Hash = std::hash<Key> >
+class LruCache : boost::noncopyable {
+public:
+	class Entry : boost::noncopyable {
+		friend class LruCache;
+		Entry* m_newer;
+		Entry* m_older;
+		Entry* m_nextInBucket;
+		size_t m_hash;
+		size_t m_bytes;
+		Entry(const Key& _key, Value&& _value, size_t hash, size_t bytes)
+		: m_newer(NULL), m_older(NULL), m_nextInBucket(NULL), m_hash(hash), m_bytes(bytes),
+		key(_key), value(std::move(_value)) {}
+	public:
+		const Key key;
+		Value value;
+		size_t bytes() const { return m_bytes; }
+		// Towards the most / least recently used one. NULL at the end.
+		Entry* newer() const { return m_newer; }
+		Entry* older() const { return m_older; }
+	};
+
+private:
+	std::vector<Entry*> m_buckets; // size is a power of two
+	int m_bucketBits;
+	Entry* m_newest;
+	Entry* m_oldest;
+	size_t m_size;
+	size_t m_bytes;
+	size_t m_budget;
+	size_t m_hits, m_misses;
+	Hash m_hash;
+
+	size_t _bucket(size_t hash) const {
+		// Fibonacci hashing. std::hash of a pointer or an int is the identity,
+		// so the low bits alone would be badly distributed.
+		return size_t((uint64_t(hash) * 0x9e3779b97f4a7c15ull) >> (64 - m_bucketBits));
+	}
+
+	Entry* _lookup(const Key& key) const {
+		const size_t hash = m_hash(key);
+		for(Entry* e = m_buckets[_bucket(hash)]; e; e = e->m_nextInBucket)
+			if(e->m_hash == hash && e->key == key)
+				return e;
+		return NULL;
+	}
+
+	void _unlink(Entry* e) {
+		(e->m_newer ? e->m_newer->m_older : m_newest) = e->m_older;
+		(e->m_older ? e->m_older->m_newer : m_oldest) = e->m_newer;
+		e->m_newer = e->m_older = NULL;
+	}
+
+	void _linkFront(Entry* e) {
+		e->m_older = m_newest;
+		e->m_newer = NULL;
+		(m_newest ? m_newest->m_newer : m_oldest) = e;
+		m_newest = e;
+	}
+
+	void _rehash(int bits) {
+		std::vector<Entry*> buckets(size_t(1) << bits, (Entry*) NULL);
+		m_bucketBits = bits;
+		for(Entry* e = m_oldest; e; e = e->m_newer) {
+			Entry*& head = buckets[_bucket(e->m_hash)];
+			e->m_nextInBucket = head;
+			head = e;
+		}
+		m_buckets.swap(buckets);
+	}
+
+public:
+	explicit LruCache(size_t budget = SIZE_MAX)
+	: m_buckets(16, (Entry*) NULL), m_bucketBits(4), m_newest(NULL), m_oldest(NULL),
+	m_size(0), m_bytes(0), m_budget(budget), m_hits(0), m_misses(0) {}
+
+	~LruCache() { clear(); }
+
+	// Counts a hit or a miss. A hit becomes the most recently used one.
+	Entry* find(const Key& key) {
+		Entry* e = _lookup(key);
+		if(!e) {
+			m_misses++;
+			return NULL;
+		}
+		m_hits++;
+		touch(e);
+		return e;
+	}
+
+	// Neither counts nor changes the order.
+	Entry* peek(const Key& key) const { return _lookup(key); }
+
+	// Inserts or replaces it, as the most recently used one. Does not evict.
+	Entry* put(const Key& key, Value value, size_t bytes) {
+		Entry* e = _lookup(key);
+		if(e) {
+			e->value = std::move(value);
+			setBytes(e, bytes);
+			touch(e);
+			return e;
+		}
+		if(m_size >= m_buckets.size())
+			_rehash(m_bucketBits + 1);
+		const size_t hash = m_hash(key);
+		e = new Entry(key, std::move(value), hash, bytes);
+		Entry*& head = m_buckets[_bucket(hash)];
+		e->m_nextInBucket = head;
+		head = e;
+		_linkFront(e);
+		m_size++;
+		m_bytes += bytes;
+		return e;
+	}
+
+	void touch(Entry* e) {
+		if(e == m_newest) return;
+		_unlink(e);
+		_linkFront(e);
+	}
+
+	void setBytes(Entry* e, size_t bytes) {
+		m_bytes -= e->m_bytes;
+		e->m_bytes = bytes;
+		m_bytes += bytes;
+	}
+
+	void erase(Entry* e) {
+		Entry** p = &m_buckets[_bucket(e->m_hash)];
+		while(*p != e) p = &(*p)->m_nextInBucket;
+		*p = e->m_nextInBucket;
+		_unlink(e);
+		m_size--;
+		m_bytes -= e->m_bytes;
+		delete e;
+	}
+
+	bool erase(const Key& key) {
+		Entry* e = _lookup(key);
+		if(!e) return false;
+		erase(e);
+		return true;
+	}
+
+	// While over budget, from the least recently used end: entries for which
+	// canEvict(entry) is true are passed to onEvict(entry) and then erased.
+	template<typename CanEvict, typename OnEvict>
+	void evict(CanEvict canEvict, OnEvict onEvict) {
+		Entry* e = m_oldest;
+		while(m_bytes > m_budget && e && e != m_newest) {
+			Entry* next = e->m_newer;
+			if(canEvict(*e)) {
+				onEvict(*e);
+				erase(e);
+			}
+			e = next;
+		}
+	}
+
+	void evict() {
+		evict([](const Entry&) { return true; }, [](Entry&) {});
+	}
+
+	void clear() {
+		for(Entry* e = m_oldest; e;) {
+			Entry* next = e->m_newer;
+			delete e;
+			e = next;
+		}
+		m_newest = m_oldest = NULL;
+		std::fill(m_buckets.begin(), m_buckets.end(), (Entry*) NULL);
+		m_size = 0;
+		m_bytes = 0;
+	}
+
+	Entry* newest() const { return m_newest; }
+	Entry* oldest() const { return m_oldest; }
+	size_t size() const { return m_size; }
+	bool empty() const { return m_size == 0; }
+	size_t bytes() const { return m_bytes; }
+	size_t budget() const { return m_budget; }
+	void setBudget(size_t budget) { m_budget = budget; }
+	size_t hits() const { return m_hits; }
+	size_t misses() const { return m_misses; }
+};
+
+#endif
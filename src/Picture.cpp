@@ -0,0 +1,386 @@
+#include <SDL.h>
+#include <math.h>
+#include <iostream>
+#include <atomic>
+#include "Picture.h"
+#include "Font.h"
+#include "PictureCache.h"
+#include "Decoder.h"
+#include "Scale.h"
+#include "ThumbnailStore.h"
+#include "Profiler.h"
+#include "WorkerPool.h"
+
+// What is visible right now comes first, before the prefetching (1).
+static const int RegionQueue = 0;
+// After the prefetching (1) and the grid thumbnails (2).
+static const int MipmapQueue = 3;
+// No levels smaller than that, it's not worth it.
+static const int MinMipSize = 64;
+// After that many failed region decodes in a row, it is not tried again.
+static const int MaxRegionFailures = 3;
+
+static auto &errors = std::cerr;
+using std::endl;
+
+namespace fs = boost::filesystem;
+
+Uint32 PictureDecodedEvent = (Uint32) -1;
+static std::atomic<bool> decodedEventQueued(false);
+
+void pushDecodedEvent() {
+	if(PictureDecodedEvent == (Uint32) -1) return;
+	// The main loop takes everything which is ready anyway, one wake-up is enough.
+	if(decodedEventQueued.exchange(true)) return;
+	SDL_Event ev;
+	SDL_memset(&ev, 0, sizeof(ev));
+	ev.type = PictureDecodedEvent;
+	if(SDL_PushEvent(&ev) != 1)
+		decodedEventQueued = false;
+}
+
+void decodedEventHandled() {
+	decodedEventQueued = false;
+}
+
+bool PictureState::needsUpgrade(int boxW, int boxH) const {
+	if(status != Decoded || upgrading) return false;
+	if(decodedW >= fullW && decodedH >= fullH) return false;
+	const bool capped = capDecodeBox(fullW, fullH, boxW, boxH);
+	const float s = fitScale(fullW, fullH, boxW, boxH);
+	// +1 to allow for rounding in the decoder. If capped, it can be down to half of it.
+	const int slack = capped ? 2 : 1;
+	return (decodedW + 1) * slack < int(fullW * s) || (decodedH + 1) * slack < int(fullH * s);
+}
+
+void Picture::decode(int boxW, int boxH) {
+	{
+		std::lock_guard<std::mutex> lock(m_state->mutex);
+		if(m_state->status == PictureState::Idle)
+			m_state->status = PictureState::Decoding;
+		else if(m_state->needsUpgrade(boxW, boxH))
+			m_state->upgrading = true;
+		else
+			return;
+	}
+
+	int fullW = 0, fullH = 0;
+	SmartPointer<SDL_Surface> surf = decodePicture(m_path, boxW, boxH, &fullW, &fullH);
+
+	{
+		std::lock_guard<std::mutex> lock(m_state->mutex);
+		m_state->upgrading = false;
+		if(surf.get()) {
+			m_state->surface = surf;
+			m_state->fullW = fullW;
+			m_state->fullH = fullH;
+			m_state->decodedW = surf->w;
+			m_state->decodedH = surf->h;
+			m_state->status = PictureState::Decoded;
+		}
+		else if(m_state->status == PictureState::Decoding)
+			m_state->status = PictureState::Failed;
+	}
+	if(surf.get())
+		pictureCache.setBytes(m_state, size_t(surf->pitch) * surf->h);
+
+	pushDecodedEvent();
+
+	// We have it decoded anyway, so the thumbnail is cheap now.
+	// Only after it is shown, the surface is only read from here on.
+	if(surf.get() && thumbnailStore.isOpen() && !thumbnailStore.contains(m_path)) {
+		SmartPointer<SDL_Surface> thumb = fitSurface(surf, ThumbnailStore::Size, ThumbnailStore::Size);
+		if(thumb.get())
+			thumbnailStore.put(m_path, thumb.get(), fullW, fullH);
+	}
+}
+
+void Picture::decodeRegion(const SDL_Rect& rect, double scale) {
+	SDL_Rect r = rect;
+	int fullW = 0, fullH = 0;
+	bool unsupported = false;
+	SmartPointer<SDL_Surface> surf = decodePictureRegion(m_path, r,
+		int(ceil(rect.w * scale)), int(ceil(rect.h * scale)), &fullW, &fullH, &unsupported);
+	{
+		std::lock_guard<std::mutex> lock(m_state->mutex);
+		m_state->regionDecoding = false;
+		if(surf.get()) {
+			m_state->region = surf;
+			m_state->regionRect = r;
+			m_state->regionScale = scale;
+			m_state->regionFailures = 0;
+		}
+		// Other errors might go away (e.g. it is still being written), the next render() tries again.
+		else if(unsupported || ++m_state->regionFailures >= MaxRegionFailures)
+			m_state->regionUnsupported = true;
+	}
+	if(surf.get()) pushDecodedEvent();
+}
+
+bool Picture::needsPreview() {
+	std::lock_guard<std::mutex> lock(m_state->mutex);
+	return m_state->status != PictureState::Decoded && m_state->status != PictureState::Failed
+		&& !m_state->previewStarted;
+}
+
+void Picture::decodePreview(int boxW, int boxH) {
+	{
+		std::lock_guard<std::mutex> lock(m_state->mutex);
+		if(m_state->status == PictureState::Decoded || m_state->status == PictureState::Failed) return;
+		if(m_state->previewStarted) return;
+		m_state->previewStarted = true;
+	}
+
+	int fullW = 0, fullH = 0;
+	SmartPointer<SDL_Surface> surf = thumbnailStore.get(m_path, &fullW, &fullH);
+	if(!surf.get())
+		surf = ::decodePreview(m_path, boxW, boxH, &fullW, &fullH);
+	if(!surf.get()) return;
+
+	{
+		std::lock_guard<std::mutex> lock(m_state->mutex);
+		// the full decode might have been faster
+		if(m_state->status == PictureState::Decoded) return;
+		m_state->preview = surf;
+		m_state->fullW = fullW;
+		m_state->fullH = fullH;
+	}
+
+	pushDecodedEvent();
+}
+
+bool Picture::needsDecode(int boxW, int boxH) {
+	std::lock_guard<std::mutex> lock(m_state->mutex);
+	return m_state->status == PictureState::Idle || m_state->needsUpgrade(boxW, boxH);
+}
+
+void Picture::load() {
+	ProfileScope scope("Picture::load");
+	SmartPointer<SDL_Surface> surf, preview, region;
+	std::vector<std::pair<int, SmartPointer<SDL_Surface> > > mipmaps;
+	{
+		std::lock_guard<std::mutex> lock(m_state->mutex);
+		preview = m_state->preview;
+		m_state->preview = NULL;
+		mipmaps.swap(m_state->mipmaps);
+		if(m_state->region.get()) {
+			region = m_state->region;
+			m_state->region = NULL;
+			m_state->regionTextureRect = m_state->regionRect;
+			m_state->regionTextureScale = m_state->regionScale;
+		}
+		if(m_state->status == PictureState::Decoded) {
+			surf = m_state->surface;
+			// The texture holds the data from now on.
+			m_state->surface = NULL;
+		}
+	}
+
+	if(region.get()) {
+		// Independent of the texture, it is in original picture pixels.
+		m_state->regionTexture.reset(new SurfaceTexture(rendererRef, region));
+		_updateMipBytes();
+	}
+	if(preview.get() && !*this) {
+		m_state->previewTexture.reset(new SurfaceTexture(rendererRef, preview));
+		pictureCache.setBytes(m_state, size_t(preview->pitch) * preview->h * 2);
+	}
+	if(!surf.get()) {
+		// Levels come in order and only for the current texture.
+		bool added = false;
+		for(auto& m : mipmaps) {
+			if(!*this || size_t(m.first) != m_state->mipTextures.size() + 1) continue;
+			m_state->mipTextures.push_back(std::make_shared<SurfaceTexture>(rendererRef, m.second));
+			added = true;
+		}
+		if(added) _updateMipBytes();
+		return; // nothing new
+	}
+
+	std::shared_ptr<SurfaceTexture> texture(new SurfaceTexture(rendererRef, surf));
+	if(!*texture) {
+		if(*this) return; // keep the old one
+		std::lock_guard<std::mutex> lock(m_state->mutex);
+		m_state->status = PictureState::Failed;
+		return;
+	}
+	// Both are only used in the UI thread, thus this switch is atomic
+	// with respect to rendering, i.e. a frame shows either one or the other.
+	m_state->texture = texture;
+	m_state->previewTexture.reset();
+	pictureCache.setBytes(m_state, size_t(surf->pitch) * surf->h);
+	// the mipmaps of the old one are useless now
+	m_state->mipTextures.clear();
+	{
+		std::lock_guard<std::mutex> lock(m_state->mutex);
+		m_state->mipmaps.clear();
+		m_state->mipBase = surf.get();
+	}
+	_updateMipBytes();
+}
+
+void Picture::buildMipmaps(const SDL_Surface* base, SmartPointer<SDL_Surface> from, int fromLevel, int toLevel) {
+	for(int level = fromLevel + 1; level <= toLevel && from.get(); ++level) {
+		{
+			ProfileScope scope("halveSurface");
+			from = halveSurface(from.get());
+		}
+		if(!from.get()) break;
+		{
+			std::lock_guard<std::mutex> lock(m_state->mutex);
+			if(m_state->mipBase != base) break; // decoded again meanwhile
+			m_state->mipmaps.push_back(std::make_pair(level, from));
+		}
+		pushDecodedEvent();
+	}
+	std::lock_guard<std::mutex> lock(m_state->mutex);
+	m_state->mipBuilding = false;
+}
+
+void Picture::_updateMipBytes() {
+	size_t bytes = 0;
+	for(auto& t : m_state->mipTextures) {
+		const SDL_Surface* surf = t->surface().get();
+		bytes += size_t(surf->pitch) * surf->h + t->textureBytes();
+	}
+	if(m_state->regionTexture) {
+		const SDL_Surface* surf = m_state->regionTexture->surface().get();
+		bytes += size_t(surf->pitch) * surf->h + m_state->regionTexture->textureBytes();
+	}
+	pictureCache.setMipBytes(m_state, bytes);
+}
+
+SurfaceTexture& Picture::_mipmapFor(const Viewport& viewport) {
+	SurfaceTexture& texture = *m_state->texture;
+	const int picW = (viewport.picW > 0) ? viewport.picW : texture.width();
+	const int picH = (viewport.picH > 0) ? viewport.picH : texture.height();
+	// The smallest level which is not smaller than it is displayed.
+	const double dispW = picW * viewport.zoom, dispH = picH * viewport.zoom;
+	int level = 0;
+	while(true) {
+		const int w = texture.width() >> (level + 1), h = texture.height() >> (level + 1);
+		if(w < dispW || h < dispH || std::min(w, h) < MinMipSize) break;
+		level++;
+	}
+	if(level == 0) return texture;
+
+	const int have = int(m_state->mipTextures.size());
+	if(have < level) {
+		bool start = false;
+		{
+			std::lock_guard<std::mutex> lock(m_state->mutex);
+			if(!m_state->mipBuilding) start = m_state->mipBuilding = true;
+		}
+		if(start) {
+			// continue from the smallest level we have
+			SmartPointer<SDL_Surface> from = (have > 0) ? m_state->mipTextures[have - 1]->surface() : texture.surface();
+			const SDL_Surface* base = texture.surface().get();
+			Picture pic = *this;
+			auto job = [pic, base, from, have, level]() mutable { pic.buildMipmaps(base, from, have, level); };
+			if(workerPool.numThreads() > 0)
+				workerPool.push(MipmapQueue, job);
+			else
+				job();
+		}
+	}
+	// the closest one we have meanwhile
+	if(have == 0) return texture;
+	return *m_state->mipTextures[std::min(have, level) - 1];
+}
+
+void Picture::_renderRegion(const Viewport& viewport) {
+	int fullW = 0, fullH = 0;
+	bool unsupported = false;
+	{
+		std::lock_guard<std::mutex> lock(m_state->mutex);
+		fullW = m_state->fullW;
+		fullH = m_state->fullH;
+		unsupported = m_state->regionUnsupported;
+	}
+	if(size_t(fullW) * size_t(fullH) <= MaxDecodePixels) return;
+	// decoded pixels per original pixel, as displayed
+	const double scale = std::min(viewport.zoom, 1.0);
+	if(m_state->texture->width() + 1 >= fullW * scale) {
+		// the picture itself is good enough (again)
+		if(m_state->regionTexture) {
+			m_state->regionTexture.reset();
+			_updateMipBytes();
+		}
+		return;
+	}
+
+	const SDL_Rect visible = viewport.visibleRect();
+	const SDL_Rect& part = m_state->regionTextureRect;
+	const bool covered = m_state->regionTexture && m_state->regionTextureScale >= scale * 0.999
+		&& visible.x >= part.x && visible.y >= part.y
+		&& visible.x + visible.w <= part.x + part.w && visible.y + visible.h <= part.y + part.h;
+	if(!covered && !unsupported && visible.w > 0 && visible.h > 0) {
+		bool start = false;
+		{
+			std::lock_guard<std::mutex> lock(m_state->mutex);
+			if(!m_state->regionDecoding) start = m_state->regionDecoding = true;
+		}
+		if(start) {
+			// Half the view as margin on each side, so that panning a bit does not need a new one.
+			const SDL_Rect wanted = {visible.x - visible.w / 2, visible.y - visible.h / 2, visible.w * 2, visible.h * 2};
+			const SDL_Rect whole = {0, 0, fullW, fullH};
+			SDL_Rect rect;
+			SDL_IntersectRect(&wanted, &whole, &rect);
+			Picture pic = *this;
+			auto job = [pic, rect, scale]() mutable { pic.decodeRegion(rect, scale); };
+			if(workerPool.numThreads() > 0)
+				workerPool.push(RegionQueue, job);
+			else
+				job();
+		}
+	}
+
+	// Meanwhile the old one, as far as it goes.
+	if(!m_state->regionTexture) return;
+	SurfaceTexture& texture = *m_state->regionTexture;
+	SDL_Rect srcRect, dstRect;
+	if(!viewport.rects(part, texture.width(), texture.height(), srcRect, dstRect)) return;
+	const size_t oldTextureBytes = texture.textureBytes();
+	texture.render(&srcRect, &dstRect);
+	if(texture.textureBytes() != oldTextureBytes)
+		_updateMipBytes();
+}
+
+void Picture::pictureSize(int& w, int& h) {
+	{
+		std::lock_guard<std::mutex> lock(m_state->mutex);
+		w = m_state->fullW;
+		h = m_state->fullH;
+	}
+	if(w > 0 && h > 0) return;
+	w = h = 0;
+	const SurfaceTexture* texture = *this ? m_state->texture.get() : hasPreview() ? m_state->previewTexture.get() : NULL;
+	if(!texture) return;
+	w = texture->width();
+	h = texture->height();
+}
+
+void Picture::render(const Viewport& viewport) {
+	if(!*this && !hasPreview()) return;
+	ProfileScope scope("Picture::render");
+
+	SurfaceTexture& texture = *this ? _mipmapFor(viewport) : *m_state->previewTexture;
+	// TODO: rotate
+	// Only the visible part, i.e. at high zoom, only those tiles are uploaded and drawn.
+	SDL_Rect srcRect, dstRect;
+	if(viewport.rects(texture.width(), texture.height(), srcRect, dstRect)) {
+		const size_t oldTextureBytes = texture.textureBytes();
+		texture.render(&srcRect, &dstRect);
+		if(*this && texture.textureBytes() != oldTextureBytes) {
+			if(&texture != m_state->texture.get())
+				_updateMipBytes();
+			else {
+				const SDL_Surface* surf = texture.surface().get();
+				pictureCache.setBytes(m_state, size_t(surf->pitch) * surf->h + texture.textureBytes());
+			}
+		}
+	}
+	if(*this) _renderRegion(viewport);
+
+	drawText(m_path.leaf().string(), 0, 0, ColorWhite());
+}
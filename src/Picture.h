@@ -0,0 +1,131 @@
+#ifndef __ImageViewer_Picture_h__
+#define __ImageViewer_Picture_h__
+
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <utility>
+#include <boost/filesystem.hpp>
+#include <boost/noncopyable.hpp>
+#include <SDL.h>
+#include "SmartPointer.h"
+#include "Gfx.h"
+#include "SurfaceTexture.h"
+#include "Viewport.h"
+
+// Pushed by the decode workers whenever a picture finished decoding.
+// Registered via SDL_RegisterEvents() in main(). At most one is queued at a
+// time, the main loop calls decodedEventHandled() when it gets it.
+extern Uint32 PictureDecodedEvent;
+void pushDecodedEvent();
+void decodedEventHandled();
+
+/*
+The decode state of a picture. This is shared between the UI thread and
+the decode workers, thus all access must hold the mutex.
+The workers only ever produce a surface; creating the texture from it
+is done in the UI thread because the renderer is not thread-safe.
+The surface stays referenced by the SurfaceTexture, which uploads
+the tiles lazily.
+The picture is decoded only as large as it is displayed. If it is
+displayed larger later on, it is decoded again (upgrading) while the
+old texture stays visible until the new surface is ready.
+Until the first full decode is done, a quickly decoded preview (e.g. the
+EXIF thumbnail) is shown instead.
+When the texture is displayed at less than half its size (e.g. zoomed out
+again after zooming in), a mipmap pyramid is built by a worker from the
+texture surface: level i is it halved i times. The smallest level which
+is still large enough is drawn instead, which is faster and not aliased.
+Pictures larger than MaxDecodePixels are never decoded in full. When
+zoomed in beyond what the picture is decoded at, the visible part of it
+(plus a margin for panning) is decoded separately at the displayed
+resolution, and drawn over it.
+The cache* and pinned members belong to PictureCache and are protected
+by its mutex.
+*/
+struct PictureState : boost::noncopyable {
+	enum Status { Idle, Decoding, Decoded, Failed };
+
+	std::mutex mutex;
+	Status status;
+	bool upgrading;
+	SmartPointer<SDL_Surface> surface; // decoded, not yet taken by load()
+	int fullW, fullH; // size of the original, 0 if not known yet
+	int decodedW, decodedH; // size of the most recently decoded surface
+	std::shared_ptr<SurfaceTexture> texture; // UI thread only
+	bool previewStarted;
+	SmartPointer<SDL_Surface> preview; // decoded, not yet taken by load()
+	std::shared_ptr<SurfaceTexture> previewTexture; // UI thread only
+	std::vector<std::pair<int, SmartPointer<SDL_Surface> > > mipmaps; // (level, surface) built, not yet taken by load()
+	std::vector<std::shared_ptr<SurfaceTexture> > mipTextures; // UI thread only. [i] is level i + 1
+	const SDL_Surface* mipBase; // the texture surface the mipmaps are built from
+	bool mipBuilding;
+	SmartPointer<SDL_Surface> region; // decoded, not yet taken by load()
+	SDL_Rect regionRect; // of region, in original picture pixels
+	double regionScale; // of region, decoded pixels per original pixel
+	std::shared_ptr<SurfaceTexture> regionTexture; // UI thread only
+	SDL_Rect regionTextureRect; // UI thread only
+	double regionTextureScale; // UI thread only
+	bool regionDecoding;
+	bool regionUnsupported; // not by the streaming decoder
+	int regionFailures; // errors in a row, e.g. truncated file
+
+	bool pinned;
+	size_t cacheBytes;
+	size_t cacheMipBytes; // mipmaps and region, separately because they are evicted first
+
+	PictureState()
+	: status(Idle), upgrading(false), fullW(0), fullH(0), decodedW(0), decodedH(0),
+	previewStarted(false), mipBase(NULL), mipBuilding(false),
+	regionScale(0), regionTextureScale(0), regionDecoding(false), regionUnsupported(false), regionFailures(0),
+	pinned(false), cacheBytes(0), cacheMipBytes(0) {
+		regionRect.x = regionRect.y = regionRect.w = regionRect.h = 0;
+		regionTextureRect = regionRect;
+	}
+
+	// Expects the mutex to be locked.
+	bool needsUpgrade(int boxW, int boxH) const;
+};
+
+struct Picture {
+	boost::filesystem::path m_path;
+	std::shared_ptr<PictureState> m_state;
+
+	Picture(const boost::filesystem::path& path)
+	: m_path(path), m_state(new PictureState()) {}
+	Picture(const boost::filesystem::path& path, const std::shared_ptr<PictureState>& state)
+	: m_path(path), m_state(state) {}
+
+	// Called from a decode worker (or the UI thread if there are no workers).
+	// boxW x boxH is the size it will be displayed fitted into, 0 for the full size.
+	void decode(int boxW, int boxH);
+	// Whether it needs a decode(), i.e. it is neither decoded (large enough) nor in progress.
+	bool needsDecode(int boxW, int boxH);
+	// Like decode() but only decodes the preview, which is much faster.
+	void decodePreview(int boxW, int boxH);
+	bool needsPreview();
+	// Called from a worker. Builds the levels after `from` (a level surface) up to `toLevel`.
+	// base is the texture surface they are for. They are dropped if that changed meanwhile.
+	void buildMipmaps(const SDL_Surface* base, SmartPointer<SDL_Surface> from, int fromLevel, int toLevel);
+	// Called from a worker. Decodes the part rect (in original picture pixels) at scale,
+	// i.e. decoded pixels per original pixel.
+	void decodeRegion(const SDL_Rect& rect, double scale);
+	// UI thread only. Creates the texture for the decoded surface.
+	void load();
+
+	operator bool() const { return m_state->texture.get() && *m_state->texture; }
+	bool hasPreview() const { return m_state->previewTexture.get() && *m_state->previewTexture; }
+	// Of the original. From the texture if not known yet. 0 if nothing is decoded yet.
+	void pictureSize(int& w, int& h);
+
+	void render(const Viewport& viewport);
+
+private:
+	// UI thread only. Selects the mipmap level, and requests it to be built if needed.
+	SurfaceTexture& _mipmapFor(const Viewport& viewport);
+	// UI thread only. Draws the region, and requests a new one if needed.
+	void _renderRegion(const Viewport& viewport);
+	void _updateMipBytes();
+};
+
+#endif
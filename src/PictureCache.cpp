@@ -0,0 +1,131 @@
+#include <SDL.h>
+#include <assert.h>
+#include "PictureCache.h"
+#include "Picture.h"
+
+PictureCache pictureCache;
+
+size_t PictureCache::defaultBudget() {
+	// a quarter of the physical memory
+	size_t ram = (size_t) SDL_GetSystemRAM(); // in MB
+	if(ram == 0) ram = 1024;
+	return ram / 4 * 1024 * 1024;
+}
+
+// Drops all decoded data of s, it must not be in the LRU anymore.
+static void release(PictureState& s) {
+	s.mipTextures.clear();
+	s.regionTexture.reset();
+	std::lock_guard<std::mutex> lock(s.mutex);
+	s.mipmaps.clear();
+	s.preview = NULL;
+	s.previewTexture.reset();
+	s.previewStarted = false;
+	s.region = NULL;
+	if(s.status != PictureState::Decoded) return;
+	s.surface = NULL;
+	s.texture.reset();
+	s.mipBase = NULL;
+	s.status = PictureState::Idle;
+}
+
+void PictureCache::setBytes(const std::shared_ptr<PictureState>& s, size_t bytes) {
+	std::lock_guard<std::mutex> lock(mutex);
+	s->cacheBytes = bytes;
+	lru.put(s.get(), s, s->cacheBytes + s->cacheMipBytes);
+}
+
+void PictureCache::setMipBytes(const std::shared_ptr<PictureState>& s, size_t bytes) {
+	std::lock_guard<std::mutex> lock(mutex);
+	s->cacheMipBytes = bytes;
+	Lru::Entry* e = lru.peek(s.get());
+	if(e) lru.setBytes(e, s->cacheBytes + s->cacheMipBytes);
+}
+
+void PictureCache::touch(const std::shared_ptr<PictureState>& s) {
+	std::lock_guard<std::mutex> lock(mutex);
+	lru.find(s.get());
+}
+
+void PictureCache::setPinned(const std::vector<std::shared_ptr<PictureState> >& pinned) {
+	std::lock_guard<std::mutex> lock(mutex);
+	for(auto& s : pinnedList)
+		s->pinned = false;
+	pinnedList = pinned;
+	for(auto& s : pinnedList)
+		s->pinned = true;
+}
+
+void PictureCache::setBudget(size_t bytes) {
+	std::lock_guard<std::mutex> lock(mutex);
+	lru.setBudget(bytes);
+}
+
+void PictureCache::evict() {
+	// Release the data outside of the lock. Texture destruction might be slow.
+	std::vector<std::shared_ptr<PictureState> > evicted, evictedMipmaps;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		// First only the mipmaps and regions. They are quickly built again.
+		for(Lru::Entry* e = lru.oldest(); lru.bytes() > lru.budget() && e; e = e->newer()) {
+			const std::shared_ptr<PictureState>& s = e->value;
+			if(s->pinned || s->cacheMipBytes == 0) continue;
+			s->cacheMipBytes = 0;
+			lru.setBytes(e, s->cacheBytes);
+			evictedMipmaps.push_back(s);
+		}
+		lru.evict(
+			[](const Lru::Entry& e) { return !e.value->pinned; },
+			[&](Lru::Entry& e) {
+				e.value->cacheBytes = 0;
+				e.value->cacheMipBytes = 0;
+				evicted.push_back(e.value);
+			});
+	}
+	for(auto& s : evictedMipmaps) {
+		s->mipTextures.clear();
+		s->regionTexture.reset();
+		std::lock_guard<std::mutex> lock(s->mutex);
+		s->mipmaps.clear();
+		s->region = NULL;
+	}
+	for(auto& s : evicted)
+		release(*s);
+}
+
+void PictureCache::remove(const std::shared_ptr<PictureState>& s) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		lru.erase(s.get());
+		s->cacheBytes = 0;
+		s->cacheMipBytes = 0;
+	}
+	release(*s);
+	// It might be another format now.
+	std::lock_guard<std::mutex> lock(s->mutex);
+	s->regionUnsupported = false;
+	s->regionFailures = 0;
+}
+
+void PictureCache::clear() {
+	std::lock_guard<std::mutex> lock(mutex);
+	for(Lru::Entry* e = lru.oldest(); e; e = e->newer()) {
+		const std::shared_ptr<PictureState>& s = e->value;
+		s->cacheBytes = 0;
+		s->cacheMipBytes = 0;
+		s->mipTextures.clear();
+		s->regionTexture.reset();
+		std::lock_guard<std::mutex> stateLock(s->mutex);
+		s->mipmaps.clear();
+		s->region = NULL;
+		s->mipBase = NULL;
+		s->surface = NULL;
+		s->texture.reset();
+		s->preview = NULL;
+		s->previewTexture.reset();
+		if(s->status == PictureState::Decoded)
+			s->status = PictureState::Idle;
+	}
+	lru.clear();
+	pinnedList.clear();
+}
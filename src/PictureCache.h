@@ -0,0 +1,50 @@
+#ifndef __ImageViewer_PictureCache_h__
+#define __ImageViewer_PictureCache_h__
+
+#include <memory>
+#include <vector>
+#include <mutex>
+#include <stddef.h>
+#include <boost/noncopyable.hpp>
+#include "LruCache.h"
+
+struct PictureState;
+
+/*
+LRU cache over all decoded picture data, i.e. both the CPU surfaces
+produced by the decode workers and the GPU textures created from them.
+It is accounted in bytes against a budget. Pinned pictures (the current
+one and the prefetch window) are never evicted, so we might go over the
+budget if the window itself does not fit.
+Mipmaps and regions are accounted separately and are evicted before any picture.
+
+Eviction touches textures, thus evict() must be called from the UI thread.
+setBytes()/touch() can be called from any thread.
+*/
+struct PictureCache : boost::noncopyable {
+	// Accounted with cacheBytes + cacheMipBytes.
+	typedef LruCache<PictureState*, std::shared_ptr<PictureState> > Lru;
+
+	std::mutex mutex;
+	Lru lru;
+	std::vector<std::shared_ptr<PictureState> > pinnedList;
+
+	void setBytes(const std::shared_ptr<PictureState>& s, size_t bytes);
+	// The mipmaps and the region, in addition to the bytes above.
+	void setMipBytes(const std::shared_ptr<PictureState>& s, size_t bytes);
+	// When it is shown. Counts a hit if it is in the cache.
+	void touch(const std::shared_ptr<PictureState>& s);
+	void setPinned(const std::vector<std::shared_ptr<PictureState> >& pinned);
+	void setBudget(size_t bytes);
+	void evict();
+	// The picture was rewritten or removed. Drops its data, and forgets that
+	// regions could not be decoded. UI thread.
+	void remove(const std::shared_ptr<PictureState>& s);
+	void clear();
+
+	static size_t defaultBudget();
+};
+
+extern PictureCache pictureCache;
+
+#endif
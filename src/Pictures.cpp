@@ -0,0 +1,386 @@
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include "Pictures.h"
+#include "WorkerPool.h"
+#include "PictureCache.h"
+#include "Video.h"
+#include "Animation.h"
+
+static auto &errors = std::cerr;
+static auto &notes = std::cout;
+using std::endl;
+
+namespace fs = boost::filesystem;
+
+// After the region of the current picture (0), before the grid thumbnails (2).
+static const int PrefetchQueue = 1;
+// What we follow will be on screen next, like the region of the current picture.
+static const int FollowQueue = 0;
+
+Pictures pictures;
+
+void Pictures::addPicture(fs::path path) {
+	m_catalogue.add(std::move(path));
+}
+
+void Pictures::loadFromList(const fs::path& f) {
+	m_scanDir = f;
+	m_scanner.startList(f);
+}
+
+void Pictures::loadDir(const fs::path& dir, int maxDepth) {
+	m_scanDir = dir;
+	// Before the scan, so that nothing which appears meanwhile is missed.
+	// What both see is added only once, see pollScan().
+	m_watchDir = dir;
+	m_watchDepth = maxDepth;
+	m_watcher.start(dir, maxDepth);
+	m_scanner.start(dir, maxDepth);
+}
+
+void Pictures::stopWatching() {
+	m_watcher.stop();
+	m_watchDir.clear();
+}
+
+bool Pictures::pollScan() {
+	std::vector<fs::path> found;
+	const bool wasRunning = m_scanner.isRunning();
+	if(!m_scanner.takeFound(found)) {
+		if(!wasRunning && !m_scanDir.empty()) {
+			notes << "Found " << size() << " pictures in " << m_scanDir << endl;
+			m_scanDir.clear();
+		}
+		return false;
+	}
+	const size_t from = size();
+	const Catalogue::Id curId = (m_curPos != NoPos) ? m_catalogue.idAt(m_curPos) : 0;
+	const bool watching = m_watcher.isRunning();
+	for(auto& path : found) {
+		Catalogue::Id id;
+		if(watching && m_catalogue.find(path, id)) continue;
+		addPicture(std::move(path));
+	}
+	// Merged in sorted, so the order does not jump around while scanning.
+	m_catalogue.sortTail(from, m_sortMode);
+	// New neighbours of the current picture. The first one is selected by render().
+	if(m_curPos != NoPos) {
+		m_curPos = m_catalogue.positionOf(curId);
+		prefetch();
+	}
+	return true;
+}
+
+void Pictures::_releaseState(Catalogue::Id id, Catalogue::Id curId) {
+	const std::shared_ptr<PictureState>& state = m_catalogue.states[id];
+	if(state) pictureCache.remove(state);
+	animationPlayer.invalidate(m_catalogue.paths[id]);
+	// render() starts it again if it is still there
+	if(m_curPos != NoPos && id == curId) videoPlayer.stop();
+}
+
+bool Pictures::pollWatch() {
+	std::vector<DirWatcher::Event> events;
+	bool overflow = false;
+	if(!m_watcher.takeChanges(events, overflow)) return false;
+	if(overflow) {
+		// Lost events. The scan adds what we missed; what went away meanwhile
+		// is noticed when we get there.
+		errors << "missed changes in " << m_watchDir << ", scanning it again" << endl;
+		m_scanDir = m_watchDir;
+		m_scanner.start(m_watchDir, m_watchDepth);
+	}
+
+	// All in one batch, so that a burst of thousands costs one pass over the order.
+	std::vector<Catalogue::Id> removed, rewritten;
+	std::vector<fs::path> added;
+	fs::path newest;
+	for(auto& e : events) {
+		Catalogue::Id id;
+		const bool known = m_catalogue.find(e.path, id);
+		if(e.change == DirWatcher::Removed) {
+			if(known) removed.push_back(id);
+			continue;
+		}
+		newest = e.path;
+		if(known) rewritten.push_back(id);
+		else added.push_back(std::move(e.path));
+	}
+	if(removed.empty() && rewritten.empty() && added.empty()) return false;
+
+	const Catalogue::Id curId = (m_curPos != NoPos) ? m_catalogue.idAt(m_curPos) : 0;
+	// If the current one goes away, the next one which stays takes its place,
+	// or else the one before. By id, positions shift with the batch.
+	Catalogue::Id nextId = curId;
+	if(m_curPos != NoPos && std::find(removed.begin(), removed.end(), curId) != removed.end()) {
+		std::vector<uint8_t> gone(m_catalogue.paths.size(), 0);
+		for(Catalogue::Id id : removed) gone[id] = 1;
+		const size_t n = size();
+		bool found = false;
+		for(size_t pos = m_curPos + 1; pos < n && !found; ++pos)
+			if(!gone[m_catalogue.idAt(pos)]) { nextId = m_catalogue.idAt(pos); found = true; }
+		for(size_t pos = m_curPos; pos > 0 && !found; --pos)
+			if(!gone[m_catalogue.idAt(pos - 1)]) { nextId = m_catalogue.idAt(pos - 1); found = true; }
+	}
+	for(Catalogue::Id id : removed) _releaseState(id, curId);
+	for(Catalogue::Id id : rewritten) _releaseState(id, curId);
+	m_catalogue.remove(removed);
+	// Their metadata might have changed, and with it their place.
+	const bool resort = m_sortMode != Catalogue::SortNone && m_sortMode != Catalogue::SortName;
+	m_catalogue.invalidate(rewritten, resort);
+	const size_t from = size() - (resort ? rewritten.size() : 0);
+	for(auto& path : added)
+		addPicture(std::move(path));
+	m_catalogue.sortTail(from, m_sortMode);
+
+	if(m_curPos != NoPos) {
+		if(!m_catalogue.contains(curId)) {
+			m_curPos = m_catalogue.contains(nextId) ? m_catalogue.positionOf(nextId) : NoPos;
+			prepareSelectedPic();
+		}
+		else {
+			m_curPos = m_catalogue.positionOf(curId);
+			// also decodes it again if it was rewritten
+			prefetch();
+		}
+	}
+	Catalogue::Id newestId;
+	if(m_follow && !newest.empty() && m_catalogue.find(newest, newestId))
+		_follow(newestId);
+	return true;
+}
+
+void Pictures::setFollow(bool follow) {
+	m_follow = follow;
+	m_followPending = false;
+	notes << (follow ? "Following new pictures" : "Not following new pictures") << endl;
+}
+
+void Pictures::_follow(Catalogue::Id id) {
+	// A newer one replaces one which is not shown yet.
+	m_followId = id;
+	m_followPending = true;
+	Picture pic = pictureAt(m_catalogue.positionOf(id));
+	const int boxW = m_viewW, boxH = m_viewH;
+	if(!pic.needsDecode(boxW, boxH)) return;
+	if(workerPool.numThreads() > 0)
+		workerPool.push(FollowQueue, [pic, boxW, boxH]() mutable { pic.decode(boxW, boxH); });
+	else
+		pic.decode(boxW, boxH);
+	// Pinned until it is shown.
+	prefetch();
+}
+
+void Pictures::_pollFollow() {
+	if(!m_catalogue.contains(m_followId)) {
+		// gone again
+		m_followPending = false;
+		return;
+	}
+	const size_t pos = m_catalogue.positionOf(m_followId);
+	Picture pic = pictureAt(pos);
+	{
+		std::lock_guard<std::mutex> lock(pic.m_state->mutex);
+		if(pic.m_state->status != PictureState::Decoded && pic.m_state->status != PictureState::Failed)
+			return;
+	}
+	m_followPending = false;
+	if(pos == m_curPos) return;
+	m_direction = 1;
+	m_curPos = pos;
+	prepareSelectedPic();
+}
+
+void Pictures::selectIndex(size_t idx) {
+	if(idx >= size()) return;
+	if(idx == m_curPos) return;
+	m_direction = (m_curPos == NoPos || idx >= m_curPos) ? 1 : -1;
+	m_curPos = idx;
+	prepareSelectedPic();
+}
+
+void Pictures::selectPic() {
+	m_curPos = empty() ? NoPos : 0;
+	prepareSelectedPic();
+}
+
+void Pictures::nextPic() {
+	step(1);
+}
+
+void Pictures::prevPic() {
+	step(-1);
+}
+
+void Pictures::step(long delta) {
+	if(m_curPos == NoPos || delta == 0) return;
+	const long n = long(size());
+	m_curPos = size_t(((long(m_curPos) + delta) % n + n) % n);
+	m_direction = (delta > 0) ? 1 : -1;
+	prepareSelectedPic();
+}
+
+void Pictures::jump(long delta) {
+	if(m_curPos == NoPos) return;
+	const long last = long(size()) - 1;
+	selectIndex(size_t(std::max(std::min(long(m_curPos) + delta, last), 0L)));
+}
+
+void Pictures::jumpToFraction(float fraction) {
+	if(empty()) return;
+	fraction = std::max(std::min(fraction, 1.0f), 0.0f);
+	selectIndex(std::min(size_t(fraction * size()), size() - 1));
+}
+
+void Pictures::setSortMode(Catalogue::SortMode mode) {
+	m_sortMode = mode;
+	if(empty()) return;
+	const Catalogue::Id curId = (m_curPos != NoPos) ? m_catalogue.idAt(m_curPos) : 0;
+	m_catalogue.sort(mode);
+	if(m_curPos != NoPos) {
+		m_curPos = m_catalogue.positionOf(curId);
+		// the neighbours changed
+		prefetch();
+	}
+	notes << "Sorted by " << Catalogue::sortModeName(mode) << endl;
+}
+
+size_t Pictures::_skipMissing(size_t pos, int direction) {
+	const size_t n = size();
+	for(size_t i = 0; i < n; ++i) {
+		const Catalogue::Id id = m_catalogue.idAt(pos);
+		const bool checked = m_catalogue.flags[id] & Catalogue::HaveStat;
+		if(m_catalogue.exists(pos)) return pos;
+		if(!checked)
+			errors << "file does not exist: " << m_catalogue.paths[id].string() << endl;
+		pos = (pos + n + direction) % n;
+	}
+	return NoPos;
+}
+
+void Pictures::prepareSelectedPic() {
+	if(m_curPos == NoPos) return;
+	m_curPos = _skipMissing(m_curPos, m_direction);
+	if(m_curPos == NoPos) return;
+	Picture pic = pictureAt(m_curPos);
+	m_viewport.reset();
+	pictureCache.touch(pic.m_state);
+	// Without workers, this decodes it right here.
+	prefetch();
+	pic.load();
+}
+
+void Pictures::prefetch() {
+	if(m_curPos == NoPos) return;
+
+	// Collect the pictures around the current one, with wrap-around.
+	// The priority is the distance, relative to the window size of that side,
+	// so that with ahead=4, behind=1, we get the order +0, +1, +2, +3, (+4, -1).
+	struct Candidate {
+		float prio;
+		size_t pos;
+		bool operator<(const Candidate& other) const { return prio < other.prio; }
+	};
+	std::vector<Candidate> candidates;
+	candidates.push_back({0.0f, m_curPos});
+
+	const size_t count = size();
+	const int forward = (m_direction >= 0) ? m_prefetchAhead : m_prefetchBehind;
+	const int backward = (m_direction >= 0) ? m_prefetchBehind : m_prefetchAhead;
+	for(int i = 1; i <= forward && size_t(i) < count; ++i)
+		candidates.push_back({float(i) / forward, (m_curPos + i) % count});
+	for(int i = 1; i <= backward && size_t(i) < count; ++i)
+		candidates.push_back({float(i) / backward, (m_curPos + count - i) % count});
+	std::stable_sort(candidates.begin(), candidates.end());
+
+	std::vector<WorkerPool::Job> jobs;
+	std::vector<std::shared_ptr<PictureState> > window;
+	if(workerPool.numThreads() > 0 && pictureAt(m_curPos).needsPreview()) {
+		// This is much faster than the full decode, so do it first,
+		// so that we show something as soon as possible.
+		Picture pic = pictureAt(m_curPos);
+		const int boxW = m_viewW, boxH = m_viewH;
+		jobs.push_back([pic, boxW, boxH]() mutable { pic.decodePreview(boxW, boxH); });
+	}
+	for(auto& c : candidates) {
+		const std::shared_ptr<PictureState>& state = m_catalogue.stateAt(c.pos);
+		if(std::find(window.begin(), window.end(), state) != window.end()) continue;
+		window.push_back(state);
+		// No background decoding, only the current one, right here.
+		if(workerPool.numThreads() == 0 && c.pos != m_curPos) continue;
+		Picture pic = pictureAt(c.pos); // the job keeps its own reference to the state
+		int boxW = m_viewW, boxH = m_viewH;
+		if(c.pos == m_curPos) m_viewport.decodeBox(boxW, boxH); // maybe zoomed in
+		if(!pic.needsDecode(boxW, boxH)) continue;
+		if(workerPool.numThreads() == 0) {
+			pic.decode(boxW, boxH);
+			continue;
+		}
+		jobs.push_back([pic, boxW, boxH]() mutable { pic.decode(boxW, boxH); });
+	}
+	if(m_followPending && m_catalogue.contains(m_followId)) {
+		const std::shared_ptr<PictureState>& state = m_catalogue.stateAt(m_catalogue.positionOf(m_followId));
+		if(std::find(window.begin(), window.end(), state) == window.end())
+			window.push_back(state);
+	}
+	// Replaces all outstanding prefetch jobs. Those which are not in the
+	// window anymore are dropped and stay Idle.
+	if(workerPool.numThreads() > 0)
+		workerPool.setQueue(PrefetchQueue, jobs);
+	pictureCache.setPinned(window);
+}
+
+void Pictures::setViewSize(int w, int h) {
+	if(w == m_viewW && h == m_viewH) return;
+	m_viewW = w;
+	m_viewH = h;
+	m_viewport.setViewSize(w, h);
+	// pictures which are too small for the new size get decoded again
+	prefetch();
+}
+
+void Pictures::zoom(double factor, int x, int y) {
+	if(m_curPos == NoPos) return;
+	m_viewport.zoomBy(factor, x, y);
+	// maybe it needs to be decoded larger now
+	prefetch();
+}
+
+void Pictures::toggleZoom(int x, int y) {
+	if(m_curPos == NoPos) return;
+	m_viewport.toggleOneToOne(x, y);
+	prefetch();
+}
+
+void Pictures::pan(int dx, int dy) {
+	m_viewport.pan(dx, dy);
+}
+
+void Pictures::render() {
+	if(m_followPending) _pollFollow();
+	if(m_curPos == NoPos) selectPic();
+	if(m_curPos == NoPos) return;
+	Picture pic = pictureAt(m_curPos);
+	pic.load();
+	pictureCache.evict();
+	const bool video = videoPlayer.play(pic.m_path);
+	const bool animation = animationPlayer.play(pic.m_path, m_viewW, m_viewH);
+	int picW = 0, picH = 0;
+	pic.pictureSize(picW, picH);
+	if(video && picW == 0) videoPlayer.size(picW, picH);
+	if(animation && picW == 0) animationPlayer.size(picW, picH);
+	m_viewport.setPictureSize(picW, picH);
+	if(!m_viewport.fit) {
+		// When we zoomed in while it was still decoding, the larger decode is started only now.
+		int boxW = 0, boxH = 0;
+		m_viewport.decodeBox(boxW, boxH);
+		if(pic.needsDecode(boxW, boxH)) {
+			prefetch();
+			pic.load(); // without workers, it is decoded already
+		}
+	}
+	// The first frame, until the playback has one.
+	if(!(video && videoPlayer.render(m_viewport)) && !(animation && animationPlayer.render(m_viewport)))
+		pic.render(m_viewport);
+}
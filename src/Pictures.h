@@ -0,0 +1,99 @@
+#ifndef __ImageViewer_Pictures_h__
+#define __ImageViewer_Pictures_h__
+
+#include <boost/filesystem.hpp>
+#include "Picture.h"
+#include "Catalogue.h"
+#include "DirScanner.h"
+#include "DirWatcher.h"
+#include "Viewport.h"
+
+struct Pictures {
+	static const size_t NoPos = size_t(-1);
+
+	Catalogue m_catalogue;
+	size_t m_curPos; // position in the catalogue order, NoPos if none is selected
+	Catalogue::SortMode m_sortMode;
+
+	// Prefetch window, relative to the direction of travel.
+	int m_prefetchAhead;
+	int m_prefetchBehind;
+	int m_direction; // +1 or -1, last navigation direction
+
+	// Size of the view. Pictures are decoded only as large as needed for it.
+	int m_viewW, m_viewH;
+	// Zoom and pan of the current picture. Reset when another one is selected.
+	Viewport m_viewport;
+
+	DirScanner m_scanner;
+	boost::filesystem::path m_scanDir;
+
+	// Keeps the catalogue up to date with the directory given to loadDir().
+	DirWatcher m_watcher;
+	boost::filesystem::path m_watchDir;
+	int m_watchDepth;
+	// Follow mode: each new (or rewritten) picture is selected, once it is decoded.
+	bool m_follow;
+	bool m_followPending;
+	Catalogue::Id m_followId;
+
+	Pictures()
+	: m_curPos(NoPos), m_sortMode(Catalogue::SortName), m_prefetchAhead(4), m_prefetchBehind(1), m_direction(1),
+	m_viewW(0), m_viewH(0), m_watchDepth(0), m_follow(false), m_followPending(false), m_followId(0) {}
+
+	void addPicture(boost::filesystem::path path);
+	// Reads it in the background like loadDir(), "-" for stdin.
+	void loadFromList(const boost::filesystem::path& f);
+	// Starts a background scan, and watches the directory from then on.
+	// Call pollScan() and pollWatch() regularly to get the results.
+	void loadDir(const boost::filesystem::path& dir, int maxDepth = 0);
+	// Returns true if new pictures were added.
+	bool pollScan();
+	// Applies what the watcher saw: adds new pictures, removes those which went
+	// away and forgets what we know about rewritten ones, incl. the decoded data.
+	// Returns true if the catalogue changed.
+	bool pollWatch();
+	void setFollow(bool follow);
+	void stopWatching();
+
+	size_t size() const { return m_catalogue.size(); }
+	bool empty() const { return m_catalogue.empty(); }
+	Picture pictureAt(size_t idx) const { return m_catalogue.pictureAt(idx); }
+	size_t curIndex() const { return m_curPos; }
+	void selectIndex(size_t idx);
+
+	void selectPic();
+	void nextPic();
+	void prevPic();
+	// Relative to the current one, with wrap-around like nextPic()/prevPic().
+	void step(long delta);
+	// Relative to the current one, without wrap-around. Used for Page Up/Down.
+	void jump(long delta);
+	// Jumps to the picture at fraction (0..1) of the list.
+	void jumpToFraction(float fraction);
+	// Keeps the current picture selected.
+	void setSortMode(Catalogue::SortMode mode);
+	void prepareSelectedPic();
+	void prefetch();
+	void setViewSize(int w, int h);
+	// factor relative to the current zoom, around the view position (x, y)
+	void zoom(double factor, int x, int y);
+	// between fit and 1:1
+	void toggleZoom(int x, int y);
+	void pan(int dx, int dy);
+	void render();
+
+private:
+	// From pos on in direction, the first one whose file exists.
+	// The files of a list are only checked when we get there.
+	size_t _skipMissing(size_t pos, int direction);
+	// Drops the decoded data of a picture which is rewritten or removed.
+	void _releaseState(Catalogue::Id id, Catalogue::Id curId);
+	// Decodes it ahead, render() selects it once that is done.
+	void _follow(Catalogue::Id id);
+	void _pollFollow();
+};
+
+extern Pictures pictures;
+
+#endif
@@ -0,0 +1,280 @@
+#include <SDL.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+// Compiled for AVX2 via the target attribute, used only if the CPU has it.
+#define HAVE_AVX2_KERNELS
+#include <immintrin.h>
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#include "PixelKernels.h"
+
+// round(c * a / 255), exactly, for c, a <= 255. The SIMD variants do the same in 16bit.
+static inline Uint32 mulAlpha(Uint32 c, Uint32 a) {
+	const Uint32 t = c * a + 128;
+	return (t + (t >> 8)) >> 8;
+}
+
+static void rgb24ToArgbScalar(const Uint8* src, Uint32* dst, int n) {
+	for(int i = 0; i < n; ++i, src += 3)
+		dst[i] = 0xff000000u | (Uint32(src[0]) << 16) | (Uint32(src[1]) << 8) | src[2];
+}
+
+static void bgr24ToArgbScalar(const Uint8* src, Uint32* dst, int n) {
+	for(int i = 0; i < n; ++i, src += 3)
+		dst[i] = 0xff000000u | (Uint32(src[2]) << 16) | (Uint32(src[1]) << 8) | src[0];
+}
+
+static void abgrToArgbScalar(Uint32* px, int n) {
+	for(int i = 0; i < n; ++i) {
+		const Uint32 p = px[i];
+		px[i] = (p & 0xff00ff00u) | ((p >> 16) & 0xff) | ((p & 0xff) << 16);
+	}
+}
+
+static void premultiplyScalar(Uint32* px, int n) {
+	for(int i = 0; i < n; ++i) {
+		const Uint32 p = px[i], a = p >> 24;
+		if(a == 255) continue;
+		px[i] = (a << 24) | (mulAlpha((p >> 16) & 0xff, a) << 16) | (mulAlpha((p >> 8) & 0xff, a) << 8) | mulAlpha(p & 0xff, a);
+	}
+}
+
+static void halveRowScalar(const Uint8* row0, const Uint8* row1, Uint8* dst, int dw) {
+	for(int x = 0; x < dw; ++x) {
+		const Uint8* a = row0 + x * 8;
+		const Uint8* b = row1 + x * 8;
+		for(int c = 0; c < 4; ++c)
+			dst[x * 4 + c] = Uint8((a[c] + a[c + 4] + b[c] + b[c + 4] + 2) >> 2);
+	}
+}
+
+static void accumulateRowScalar(const Uint8* src, Uint32* acc, int n, Uint32 weight) {
+	for(int i = 0; i < n; ++i)
+		acc[i] += src[i] * weight;
+}
+
+static const PixelKernels scalarKernels = {
+	"scalar", rgb24ToArgbScalar, bgr24ToArgbScalar, abgrToArgbScalar, premultiplyScalar, halveRowScalar, accumulateRowScalar
+};
+
+#ifdef __SSE2__
+
+// 4 channels of 2 pixels in 16bit lanes. Leaves the alpha lanes as they are.
+static inline __m128i premultiply16(__m128i v, __m128i bias, __m128i alphaMask) {
+	const __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+	__m128i t = _mm_add_epi16(_mm_mullo_epi16(v, a), bias);
+	t = _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+	return _mm_or_si128(_mm_andnot_si128(alphaMask, t), _mm_and_si128(alphaMask, v));
+}
+
+static void abgrToArgbSse2(Uint32* px, int n) {
+	const __m128i keep = _mm_set1_epi32(int(0xff00ff00u)), low = _mm_set1_epi32(0xff);
+	int i = 0;
+	for(; i + 4 <= n; i += 4) {
+		const __m128i p = _mm_loadu_si128((const __m128i*) (px + i));
+		const __m128i r = _mm_or_si128(_mm_and_si128(p, keep),
+			_mm_or_si128(_mm_and_si128(_mm_srli_epi32(p, 16), low), _mm_slli_epi32(_mm_and_si128(p, low), 16)));
+		_mm_storeu_si128((__m128i*) (px + i), r);
+	}
+	abgrToArgbScalar(px + i, n - i);
+}
+
+static void premultiplySse2(Uint32* px, int n) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i bias = _mm_set1_epi16(128);
+	const __m128i alphaMask = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+	int i = 0;
+	for(; i + 4 <= n; i += 4) {
+		const __m128i p = _mm_loadu_si128((const __m128i*) (px + i));
+		const __m128i lo = premultiply16(_mm_unpacklo_epi8(p, zero), bias, alphaMask);
+		const __m128i hi = premultiply16(_mm_unpackhi_epi8(p, zero), bias, alphaMask);
+		_mm_storeu_si128((__m128i*) (px + i), _mm_packus_epi16(lo, hi));
+	}
+	premultiplyScalar(px + i, n - i);
+}
+
+static void halveRowSse2(const Uint8* row0, const Uint8* row1, Uint8* dst, int dw) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi16(2);
+	int x = 0;
+	for(; x + 4 <= dw; x += 4) {
+		// 8 source pixels from each row -> 4 destination pixels
+		__m128i a0 = _mm_loadu_si128((const __m128i*) (row0 + x * 8));
+		__m128i a1 = _mm_loadu_si128((const __m128i*) (row0 + x * 8 + 16));
+		__m128i b0 = _mm_loadu_si128((const __m128i*) (row1 + x * 8));
+		__m128i b1 = _mm_loadu_si128((const __m128i*) (row1 + x * 8 + 16));
+		// vertical sums, 16bit per channel, 2 pixels per register
+		__m128i s0 = _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero));
+		__m128i s1 = _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero));
+		__m128i s2 = _mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero));
+		__m128i s3 = _mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero));
+		// horizontal sums: [p0+p1, p2+p3] and [p4+p5, p6+p7]
+		__m128i h0 = _mm_add_epi16(_mm_unpacklo_epi64(s0, s1), _mm_unpackhi_epi64(s0, s1));
+		__m128i h1 = _mm_add_epi16(_mm_unpacklo_epi64(s2, s3), _mm_unpackhi_epi64(s2, s3));
+		h0 = _mm_srli_epi16(_mm_add_epi16(h0, round), 2);
+		h1 = _mm_srli_epi16(_mm_add_epi16(h1, round), 2);
+		_mm_storeu_si128((__m128i*) (dst + x * 4), _mm_packus_epi16(h0, h1));
+	}
+	halveRowScalar(row0 + x * 8, row1 + x * 8, dst + x * 4, dw - x);
+}
+
+static void accumulateRowSse2(const Uint8* src, Uint32* acc, int n, Uint32 weight) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i w = _mm_set1_epi16(short(weight));
+	int i = 0;
+	for(; i + 16 <= n; i += 16) {
+		const __m128i v = _mm_loadu_si128((const __m128i*) (src + i));
+		__m128i* a = (__m128i*) (acc + i);
+		for(int half = 0; half < 2; ++half) {
+			const __m128i v16 = half ? _mm_unpackhi_epi8(v, zero) : _mm_unpacklo_epi8(v, zero);
+			// the 32bit products from their low and high 16bit halves
+			const __m128i lo = _mm_mullo_epi16(v16, w), hi = _mm_mulhi_epu16(v16, w);
+			_mm_storeu_si128(a + half * 2, _mm_add_epi32(_mm_loadu_si128(a + half * 2), _mm_unpacklo_epi16(lo, hi)));
+			_mm_storeu_si128(a + half * 2 + 1, _mm_add_epi32(_mm_loadu_si128(a + half * 2 + 1), _mm_unpackhi_epi16(lo, hi)));
+		}
+	}
+	accumulateRowScalar(src + i, acc + i, n - i, weight);
+}
+
+// No SSE2 way to shuffle bytes, that needs SSSE3. AVX2 covers it.
+static const PixelKernels sse2Kernels = {
+	"sse2", rgb24ToArgbScalar, bgr24ToArgbScalar, abgrToArgbSse2, premultiplySse2, halveRowSse2, accumulateRowSse2
+};
+
+#endif // __SSE2__
+
+#ifdef HAVE_AVX2_KERNELS
+
+// 8 pixels per iteration, 4 per 128bit lane, as the byte shuffle only works within a lane.
+AVX2_TARGET static inline void expand24Avx2(const Uint8* src, Uint32* dst, int n, __m256i mask,
+											void (*scalar)(const Uint8*, Uint32*, int)) {
+	const __m256i alpha = _mm256_set1_epi32(int(0xff000000u));
+	int i = 0;
+	// +2 because the second load reads 4 bytes beyond the 8 pixels
+	for(; i + 10 <= n; i += 8) {
+		const __m128i lo = _mm_loadu_si128((const __m128i*) (src + i * 3));
+		const __m128i hi = _mm_loadu_si128((const __m128i*) (src + i * 3 + 12));
+		const __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+		_mm256_storeu_si256((__m256i*) (dst + i), _mm256_or_si256(_mm256_shuffle_epi8(v, mask), alpha));
+	}
+	scalar(src + i * 3, dst + i, n - i);
+}
+
+AVX2_TARGET static void rgb24ToArgbAvx2(const Uint8* src, Uint32* dst, int n) {
+	// ARGB8888 is B, G, R, A in memory
+	const __m256i mask = _mm256_setr_epi8(
+		2, 1, 0, -128, 5, 4, 3, -128, 8, 7, 6, -128, 11, 10, 9, -128,
+		2, 1, 0, -128, 5, 4, 3, -128, 8, 7, 6, -128, 11, 10, 9, -128);
+	expand24Avx2(src, dst, n, mask, rgb24ToArgbScalar);
+}
+
+AVX2_TARGET static void bgr24ToArgbAvx2(const Uint8* src, Uint32* dst, int n) {
+	const __m256i mask = _mm256_setr_epi8(
+		0, 1, 2, -128, 3, 4, 5, -128, 6, 7, 8, -128, 9, 10, 11, -128,
+		0, 1, 2, -128, 3, 4, 5, -128, 6, 7, 8, -128, 9, 10, 11, -128);
+	expand24Avx2(src, dst, n, mask, bgr24ToArgbScalar);
+}
+
+AVX2_TARGET static void abgrToArgbAvx2(Uint32* px, int n) {
+	const __m256i mask = _mm256_setr_epi8(
+		2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+		2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+	int i = 0;
+	for(; i + 8 <= n; i += 8) {
+		const __m256i p = _mm256_loadu_si256((const __m256i*) (px + i));
+		_mm256_storeu_si256((__m256i*) (px + i), _mm256_shuffle_epi8(p, mask));
+	}
+	abgrToArgbScalar(px + i, n - i);
+}
+
+AVX2_TARGET static inline __m256i premultiply16Avx2(__m256i v, __m256i bias, __m256i alphaMask) {
+	const __m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(v, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+	__m256i t = _mm256_add_epi16(_mm256_mullo_epi16(v, a), bias);
+	t = _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+	return _mm256_or_si256(_mm256_andnot_si256(alphaMask, t), _mm256_and_si256(alphaMask, v));
+}
+
+AVX2_TARGET static void premultiplyAvx2(Uint32* px, int n) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i bias = _mm256_set1_epi16(128);
+	const __m256i alphaMask = _mm256_set1_epi64x((long long) 0xffff000000000000ull);
+	int i = 0;
+	for(; i + 8 <= n; i += 8) {
+		const __m256i p = _mm256_loadu_si256((const __m256i*) (px + i));
+		// unpack and pack are both within the lanes, thus the order stays
+		const __m256i lo = premultiply16Avx2(_mm256_unpacklo_epi8(p, zero), bias, alphaMask);
+		const __m256i hi = premultiply16Avx2(_mm256_unpackhi_epi8(p, zero), bias, alphaMask);
+		_mm256_storeu_si256((__m256i*) (px + i), _mm256_packus_epi16(lo, hi));
+	}
+	premultiplyScalar(px + i, n - i);
+}
+
+AVX2_TARGET static void halveRowAvx2(const Uint8* row0, const Uint8* row1, Uint8* dst, int dw) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i round = _mm256_set1_epi16(2);
+	int x = 0;
+	for(; x + 8 <= dw; x += 8) {
+		// 16 source pixels from each row -> 8 destination pixels
+		__m256i a0 = _mm256_loadu_si256((const __m256i*) (row0 + x * 8));
+		__m256i a1 = _mm256_loadu_si256((const __m256i*) (row0 + x * 8 + 32));
+		__m256i b0 = _mm256_loadu_si256((const __m256i*) (row1 + x * 8));
+		__m256i b1 = _mm256_loadu_si256((const __m256i*) (row1 + x * 8 + 32));
+		// Like the SSE2 one, per lane. s0 has the pixels [0,1 | 4,5], s1 [2,3 | 6,7].
+		__m256i s0 = _mm256_add_epi16(_mm256_unpacklo_epi8(a0, zero), _mm256_unpacklo_epi8(b0, zero));
+		__m256i s1 = _mm256_add_epi16(_mm256_unpackhi_epi8(a0, zero), _mm256_unpackhi_epi8(b0, zero));
+		__m256i s2 = _mm256_add_epi16(_mm256_unpacklo_epi8(a1, zero), _mm256_unpacklo_epi8(b1, zero));
+		__m256i s3 = _mm256_add_epi16(_mm256_unpackhi_epi8(a1, zero), _mm256_unpackhi_epi8(b1, zero));
+		// destination pixels [0,1 | 2,3] and [4,5 | 6,7]
+		__m256i h0 = _mm256_add_epi16(_mm256_unpacklo_epi64(s0, s1), _mm256_unpackhi_epi64(s0, s1));
+		__m256i h1 = _mm256_add_epi16(_mm256_unpacklo_epi64(s2, s3), _mm256_unpackhi_epi64(s2, s3));
+		h0 = _mm256_srli_epi16(_mm256_add_epi16(h0, round), 2);
+		h1 = _mm256_srli_epi16(_mm256_add_epi16(h1, round), 2);
+		// packed per lane: [0,1,4,5 | 2,3,6,7]
+		const __m256i packed = _mm256_packus_epi16(h0, h1);
+		_mm256_storeu_si256((__m256i*) (dst + x * 4), _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0)));
+	}
+	halveRowScalar(row0 + x * 8, row1 + x * 8, dst + x * 4, dw - x);
+}
+
+AVX2_TARGET static void accumulateRowAvx2(const Uint8* src, Uint32* acc, int n, Uint32 weight) {
+	const __m256i w = _mm256_set1_epi32(int(weight));
+	int i = 0;
+	for(; i + 8 <= n; i += 8) {
+		const __m256i v = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) (src + i)));
+		__m256i* a = (__m256i*) (acc + i);
+		_mm256_storeu_si256(a, _mm256_add_epi32(_mm256_loadu_si256(a), _mm256_mullo_epi32(v, w)));
+	}
+	accumulateRowScalar(src + i, acc + i, n - i, weight);
+}
+
+static const PixelKernels avx2Kernels = {
+	"avx2", rgb24ToArgbAvx2, bgr24ToArgbAvx2, abgrToArgbAvx2, premultiplyAvx2, halveRowAvx2, accumulateRowAvx2
+};
+
+static bool cpuHasAvx2() {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+
+#endif // HAVE_AVX2_KERNELS
+
+std::vector<const PixelKernels*> supportedPixelKernels() {
+	std::vector<const PixelKernels*> res;
+	res.push_back(&scalarKernels);
+#ifdef __SSE2__
+	res.push_back(&sse2Kernels);
+#endif
+#ifdef HAVE_AVX2_KERNELS
+	if(cpuHasAvx2())
+		res.push_back(&avx2Kernels);
+#endif
+	return res;
+}
+
+const PixelKernels& pixelKernels() {
+	// The last one is the fastest. Initialized only once, thread-safe.
+	static const PixelKernels* best = supportedPixelKernels().back();
+	return *best;
+}
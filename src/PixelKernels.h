@@ -0,0 +1,35 @@
+#ifndef __ImageViewer_PixelKernels_h__
+#define __ImageViewer_PixelKernels_h__
+
+#include <vector>
+#include <SDL.h>
+
+/*
+The per-row pixel loops of the decode pipeline, in a scalar, an SSE2 and
+an AVX2 variant. The variant is selected at runtime for the CPU we run on,
+so the binary does not need to be built for a specific one.
+All variants produce exactly the same output as the scalar one; the
+tests (tests/PixelKernelsTest.cpp) check that, --bench measures them.
+The 32bit pixels are always SDL_PIXELFORMAT_ARGB8888.
+*/
+struct PixelKernels {
+	const char* name;
+	// n pixels of SDL_PIXELFORMAT_RGB24 / BGR24 to opaque ARGB8888.
+	void (*rgb24ToArgb)(const Uint8* src, Uint32* dst, int n);
+	void (*bgr24ToArgb)(const Uint8* src, Uint32* dst, int n);
+	// In place, SDL_PIXELFORMAT_ABGR8888 to ARGB8888, i.e. red and blue swapped.
+	void (*abgrToArgb)(Uint32* px, int n);
+	// In place. Each color channel gets multiplied by alpha / 255, rounded.
+	void (*premultiply)(Uint32* px, int n);
+	// 2x2 box filter of two source rows (2 * dw pixels each) into dw pixels.
+	void (*halveRow)(const Uint8* row0, const Uint8* row1, Uint8* dst, int dw);
+	// acc[i] += src[i] * weight for n bytes. weight <= 1 << 15.
+	void (*accumulateRow)(const Uint8* src, Uint32* acc, int n, Uint32 weight);
+};
+
+// The fastest variant supported by this CPU.
+const PixelKernels& pixelKernels();
+// All variants supported by this CPU, the scalar reference first.
+std::vector<const PixelKernels*> supportedPixelKernels();
+
+#endif
@@ -0,0 +1,206 @@
+#include <SDL.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <iostream>
+#include "PixelPool.h"
+
+static const size_t PageSize = 4096;
+static const size_t HugePageSize = 2 * 1024 * 1024;
+// Pooled buffers unused for that long are unmapped.
+static const Uint32 IdleMs = 10000;
+static const Uint32 TrimIntervalMs = 5000;
+
+static auto &errors = std::cerr;
+using std::endl;
+
+PixelPool& pixelPool = *new PixelPool();
+
+namespace {
+
+struct PooledPixels : SurfacePixels {
+	void* p;
+	size_t capacity;
+	PooledPixels(void* _p, size_t _capacity) : p(_p), capacity(_capacity) {}
+	~PooledPixels() { pixelPool.release(p, capacity); }
+};
+
+struct SurfaceRef : SurfacePixels {
+	SmartPointer<SDL_Surface> surf;
+	SurfaceRef(const SmartPointer<SDL_Surface>& _surf) : surf(_surf) {}
+};
+
+}
+
+PixelPool::PixelPool() : m_cap(256 * 1024 * 1024) {
+	m_stats.hits = m_stats.misses = 0;
+	m_stats.usedBytes = m_stats.usedCount = 0;
+	m_stats.pooledBytes = m_stats.pooledCount = 0;
+	m_stats.peakBytes = 0;
+}
+
+size_t PixelPool::_sizeClass(size_t size) {
+	// In steps of a quarter of the power of two below it, i.e. at most 25% waste.
+	size_t step = 1;
+	while(step * 8 <= size) step *= 2;
+	step = std::max(step, PageSize);
+	return (size + step - 1) / step * step;
+}
+
+void* PixelPool::_map(size_t capacity) {
+#ifdef MAP_ANONYMOUS
+	void* p = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(p == MAP_FAILED) return NULL;
+#ifdef MADV_HUGEPAGE
+	// Fewer TLB misses while scaling and uploading. Only a hint.
+	if(capacity >= HugePageSize)
+		madvise(p, capacity, MADV_HUGEPAGE);
+#endif
+	return p;
+#else
+	return malloc(capacity);
+#endif
+}
+
+void PixelPool::_unmap(void* p, size_t capacity) {
+#ifdef MAP_ANONYMOUS
+	munmap(p, capacity);
+#else
+	free(p);
+#endif
+}
+
+void* PixelPool::alloc(size_t size, size_t& capacity) {
+	capacity = _sizeClass(size);
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto it = m_free.find(capacity);
+		if(it != m_free.end() && !it->second.empty()) {
+			// the most recently used one, it is most likely still in the cache
+			void* p = it->second.back().p;
+			it->second.pop_back();
+			m_stats.hits++;
+			m_stats.pooledBytes -= capacity;
+			m_stats.pooledCount--;
+			m_stats.usedBytes += capacity;
+			m_stats.usedCount++;
+			return p;
+		}
+		m_stats.misses++;
+	}
+	void* p = _map(capacity);
+	if(!p) return NULL;
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_stats.usedBytes += capacity;
+	m_stats.usedCount++;
+	m_stats.peakBytes = std::max(m_stats.peakBytes, m_stats.usedBytes + m_stats.pooledBytes);
+	return p;
+}
+
+void PixelPool::release(void* p, size_t capacity) {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stats.usedBytes -= capacity;
+		m_stats.usedCount--;
+		if(m_stats.pooledBytes + capacity <= m_cap) {
+			Free f;
+			f.p = p;
+			f.since = SDL_GetTicks();
+			m_free[capacity].push_back(f);
+			m_stats.pooledBytes += capacity;
+			m_stats.pooledCount++;
+			return;
+		}
+	}
+	_unmap(p, capacity);
+}
+
+void PixelPool::setCap(size_t bytes) {
+	size_t pooled = 0;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_cap = bytes;
+		pooled = m_stats.pooledBytes;
+	}
+	if(pooled > bytes) trim(0);
+}
+
+size_t PixelPool::cap() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_cap;
+}
+
+void PixelPool::trim(Uint32 maxIdleMs) {
+	std::vector<std::pair<void*, size_t> > unmap;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		const Uint32 now = SDL_GetTicks();
+		for(auto it = m_free.begin(); it != m_free.end();) {
+			std::vector<Free>& list = it->second;
+			// the oldest are first
+			size_t n = 0;
+			while(n < list.size() && (maxIdleMs == 0 || now - list[n].since >= maxIdleMs))
+				unmap.push_back(std::make_pair(list[n++].p, it->first));
+			list.erase(list.begin(), list.begin() + n);
+			m_stats.pooledBytes -= n * it->first;
+			m_stats.pooledCount -= n;
+			if(list.empty()) it = m_free.erase(it);
+			else ++it;
+		}
+	}
+	// outside of the lock, unmapping can take a while
+	for(auto& u : unmap)
+		_unmap(u.first, u.second);
+}
+
+static Uint32 trimTimer(Uint32 interval, void*) {
+	pixelPool.trim(IdleMs);
+	return interval;
+}
+
+void PixelPool::startIdleTrim() {
+	if(!SDL_AddTimer(TrimIntervalMs, trimTimer, NULL))
+		errors << "cannot start the pixel pool timer: " << SDL_GetError() << endl;
+}
+
+PixelPool::Stats PixelPool::stats() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_stats;
+}
+
+SDL_Surface* PixelPool::createSurface(int w, int h, Uint32 format) {
+	assert(SDL_BYTESPERPIXEL(format) == 4);
+	const int pitch = w * 4;
+	const size_t size = size_t(pitch) * h;
+	if(size < MinPooledSize)
+		return SDL_CreateRGBSurfaceWithFormat(0, w, h, 32, format);
+	size_t capacity = 0;
+	void* p = alloc(size, capacity);
+	if(!p) {
+		SDL_SetError("out of memory for %ix%i pixels", w, h);
+		return NULL;
+	}
+	SDL_Surface* surf = SDL_CreateRGBSurfaceWithFormatFrom(p, w, h, 32, pitch, format);
+	if(!surf) {
+		release(p, capacity);
+		return NULL;
+	}
+	surf->userdata = new PooledPixels(p, capacity);
+	return surf;
+}
+
+void freeSurface(SDL_Surface* surf) {
+	// Only if this really frees it. SDL itself might hold a reference.
+	SurfacePixels* pixels = (surf->refcount == 1) ? (SurfacePixels*) surf->userdata : NULL;
+	SDL_FreeSurface(surf);
+	delete pixels;
+}
+
+SmartPointer<SDL_Surface> reinterpretSurface(const SmartPointer<SDL_Surface>& surf, Uint32 format) {
+	assert(surf->format->BytesPerPixel == 4 && SDL_BYTESPERPIXEL(format) == 4);
+	SDL_Surface* res = SDL_CreateRGBSurfaceWithFormatFrom(surf->pixels, surf->w, surf->h, 32, surf->pitch, format);
+	if(!res) return NULL;
+	res->userdata = new SurfaceRef(surf);
+	return res;
+}
@@ -0,0 +1,86 @@
+#ifndef __ImageViewer_PixelPool_h__
+#define __ImageViewer_PixelPool_h__
+
+#include <stddef.h>
+#include <mutex>
+#include <map>
+#include <vector>
+#include <SDL.h>
+#include <boost/noncopyable.hpp>
+#include "SmartPointer.h"
+
+/*
+Recycles the pixel buffers of the large surfaces (decoded pictures, their
+halved versions, mipmaps). Browsing allocates and frees many of them of
+similar sizes; with malloc, that fragments the heap and the RSS does not
+come down again.
+The buffers are mmap'd directly (huge pages where the system supports it),
+rounded up to size classes of at most 25% waste. Freed buffers go back into
+the pool as long as it stays below the cap, otherwise they are unmapped.
+Pooled buffers which have not been used for a while are unmapped by a timer
+(startIdleTrim()).
+Thread-safe. It is never destroyed, as surfaces might outlive main().
+*/
+class PixelPool : boost::noncopyable {
+public:
+	static const size_t MinPooledSize = 256 * 1024; // smaller ones come from SDL as usual
+
+	struct Stats {
+		size_t hits, misses; // of alloc()
+		size_t usedBytes, usedCount; // handed out
+		size_t pooledBytes, pooledCount; // free, in the pool
+		size_t peakBytes; // used + pooled
+	};
+
+	PixelPool();
+
+	// Like SDL_CreateRGBSurfaceWithFormat() but with pooled pixels, which are not
+	// initialized. Only 32bit formats. To be freed with freeSurface(), i.e. usually
+	// it goes into a SmartPointer.
+	SDL_Surface* createSurface(int w, int h, Uint32 format);
+
+	// Returns at least size bytes, capacity is the actual size.
+	void* alloc(size_t size, size_t& capacity);
+	void release(void* p, size_t capacity);
+
+	void setCap(size_t bytes);
+	size_t cap();
+	// Unmaps the pooled buffers which were unused for at least maxIdleMs.
+	void trim(Uint32 maxIdleMs);
+	void startIdleTrim();
+	Stats stats();
+
+private:
+	struct Free {
+		void* p;
+		Uint32 since; // SDL_GetTicks()
+	};
+
+	std::mutex m_mutex;
+	std::map<size_t, std::vector<Free> > m_free; // by capacity, most recently released last
+	size_t m_cap;
+	Stats m_stats;
+
+	static size_t _sizeClass(size_t size);
+	static void* _map(size_t capacity);
+	static void _unmap(void* p, size_t capacity);
+};
+
+extern PixelPool& pixelPool;
+
+/*
+The pixels of a surface which does not own them itself (SDL_PREALLOC).
+The surface keeps it in its userdata, and freeSurface() deletes it.
+*/
+struct SurfacePixels : boost::noncopyable {
+	virtual ~SurfacePixels() {}
+};
+
+// SDL_FreeSurface(), and releases its SurfacePixels. Used by SmartPointer and Surface.
+void freeSurface(SDL_Surface* surf);
+
+// A surface in another 32bit format over the same pixels, to convert them in place.
+// It keeps surf alive.
+SmartPointer<SDL_Surface> reinterpretSurface(const SmartPointer<SDL_Surface>& surf, Uint32 format);
+
+#endif
@@ -0,0 +1,216 @@
+#include <stdio.h>
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include "Profiler.h"
+#include "Gfx.h"
+#include "Font.h"
+#include "WorkerPool.h"
+#include "PictureCache.h"
+#include "PixelPool.h"
+#include "ThumbnailStore.h"
+#include "Video.h"
+#include "Animation.h"
+
+static auto &errors = std::cerr;
+static auto &notes = std::cout;
+using std::endl;
+
+namespace fs = boost::filesystem;
+
+Profiler profiler;
+
+// Number of frames the frame time in the overlay is averaged over.
+static const size_t FrameHistory = 120;
+// The per-name stats in the overlay are over that time.
+static const double StatWindowSecs = 1.0;
+// The overlay text is updated only that often, so that it is readable,
+// and we don't fill up the text cache with a new line every frame.
+static const double OverlayUpdateSecs = 0.5;
+// About 32 MB. The trace stops recording after that.
+static const size_t MaxTraceEvents = 1024 * 1024;
+
+static double toMs(Uint64 ticks) {
+	return double(ticks) * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+Profiler::Profiler()
+: m_enabled(false), m_overlay(false), m_windowStart(0), m_frameTimes(FrameHistory, 0), m_frameCount(0), m_traceStart(0), m_overlayTime(0) {}
+
+int Profiler::_threadId() {
+	auto it = m_threadIds.find(std::this_thread::get_id());
+	if(it == m_threadIds.end())
+		it = m_threadIds.insert(std::make_pair(std::this_thread::get_id(), int(m_threadIds.size()) + 1)).first;
+	return it->second;
+}
+
+void Profiler::record(const char* name, Uint64 start, Uint64 end) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	Stat& stat = m_stats[name];
+	stat.count++;
+	stat.total += end - start;
+	stat.max = std::max(stat.max, end - start);
+
+	if(!m_traceFile.empty() && m_events.size() < MaxTraceEvents) {
+		Event ev = { name, _threadId(), start, end };
+		m_events.push_back(ev);
+	}
+}
+
+void Profiler::frameDone(Uint64 frameStart) {
+	if(!frameStart) return;
+	const Uint64 end = SDL_GetPerformanceCounter();
+	record("frame", frameStart, end);
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_frameTimes[m_frameCount++ % FrameHistory] = end - frameStart;
+	if(end - m_windowStart >= Uint64(StatWindowSecs * SDL_GetPerformanceFrequency())) {
+		m_lastStats.swap(m_stats);
+		m_stats.clear();
+		m_windowStart = end;
+	}
+}
+
+void Profiler::setOverlay(bool overlay) {
+	m_overlay = overlay;
+	_updateEnabled();
+}
+
+int Profiler::overlayTimeoutMs() const {
+	if(!m_overlay) return -1;
+	if(m_overlayLines.empty()) return 0;
+	const double elapsed = double(SDL_GetPerformanceCounter() - m_overlayTime) / SDL_GetPerformanceFrequency();
+	return std::max(int((OverlayUpdateSecs - elapsed) * 1000) + 1, 0);
+}
+
+void Profiler::_updateOverlayLines() {
+	std::vector<std::string>& lines = m_overlayLines;
+	lines.clear();
+	char buf[256];
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		const size_t n = std::min(m_frameCount, FrameHistory);
+		Uint64 sum = 0, max = 0;
+		for(size_t i = 0; i < n; ++i) {
+			sum += m_frameTimes[i];
+			max = std::max(max, m_frameTimes[i]);
+		}
+		snprintf(buf, sizeof(buf), "frame: %.2f ms avg, %.2f ms max (last %i)",
+				n ? toMs(sum) / n : 0.0, toMs(max), int(n));
+		lines.push_back(buf);
+		for(auto& it : m_lastStats) {
+			if(strcmp(it.first, "frame") == 0) continue;
+			snprintf(buf, sizeof(buf), "%s: %i x, %.2f ms avg, %.2f ms max",
+					it.first, int(it.second.count), toMs(it.second.total) / it.second.count, toMs(it.second.max));
+			lines.push_back(buf);
+		}
+	}
+	snprintf(buf, sizeof(buf), "decode queue: %i pending, %i running",
+			int(workerPool.pendingCount()), workerPool.runningCount());
+	lines.push_back(buf);
+	{
+		std::lock_guard<std::mutex> lock(pictureCache.mutex);
+		const PictureCache::Lru& lru = pictureCache.lru;
+		const size_t total = lru.hits() + lru.misses();
+		snprintf(buf, sizeof(buf), "picture cache: %i%% hits (%i/%i), %i/%i MB",
+				total ? int(lru.hits() * 100 / total) : 0, int(lru.hits()), int(total),
+				int(lru.bytes() >> 20), int(lru.budget() >> 20));
+		lines.push_back(buf);
+	}
+	{
+		const PixelPool::Stats pool = pixelPool.stats();
+		const size_t total = pool.hits + pool.misses;
+		snprintf(buf, sizeof(buf), "pixel pool: %i%% hits (%i/%i), %i MB used, %i/%i MB pooled, peak %i MB",
+				total ? int(pool.hits * 100 / total) : 0, int(pool.hits), int(total),
+				int(pool.usedBytes >> 20), int(pool.pooledBytes >> 20), int(pixelPool.cap() >> 20), int(pool.peakBytes >> 20));
+		lines.push_back(buf);
+	}
+	{
+		const size_t total = thumbnailStore.hits() + thumbnailStore.misses();
+		snprintf(buf, sizeof(buf), "thumbnails: %i%% hits (%i/%i)",
+				total ? int(thumbnailStore.hits() * 100 / total) : 0, int(thumbnailStore.hits()), int(total));
+		lines.push_back(buf);
+	}
+	snprintf(buf, sizeof(buf), "glyph atlas: %i glyphs", textGlyphCount());
+	lines.push_back(buf);
+	if(videoPlayer.isPlaying()) {
+		const VideoPlayer::Stats video = videoPlayer.stats();
+		int w = 0, h = 0;
+		videoPlayer.size(w, h);
+		snprintf(buf, sizeof(buf), "video: %ix%i, %i decoded, %i shown, %i dropped",
+				w, h, int(video.decoded), int(video.shown), int(video.dropped));
+		lines.push_back(buf);
+	}
+	{
+		const AnimationPlayer::Stats anim = animationPlayer.stats();
+		if(anim.frames > 0 || anim.cacheCount > 0) {
+			snprintf(buf, sizeof(buf), "animation: %i frames, %i shown, %i skipped, cache %i MB (%i)",
+					int(anim.frames), int(anim.shown), int(anim.skipped), int(anim.cacheBytes >> 20), int(anim.cacheCount));
+			lines.push_back(buf);
+		}
+	}
+}
+
+void Profiler::renderOverlay() {
+	if(!m_overlay) return;
+	const Uint64 now = SDL_GetPerformanceCounter();
+	if(m_overlayLines.empty() || now - m_overlayTime >= Uint64(OverlayUpdateSecs * SDL_GetPerformanceFrequency())) {
+		_updateOverlayLines();
+		m_overlayTime = now;
+	}
+
+	SDL_Rect bg = {0, 20, 0, 0};
+	int y = bg.y + 4;
+	for(auto& line : m_overlayLines) {
+		const SDL_Point size = textSize(line);
+		y += size.y;
+		bg.w = std::max(bg.w, size.x + 16);
+	}
+	bg.h = y + 4 - bg.y;
+
+	SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+	SDL_SetRenderDrawColor(renderer, 0, 0, 0, 160);
+	SDL_RenderFillRect(renderer, &bg);
+	// RenderClear uses it, so restore
+	SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+	SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+	y = bg.y + 4;
+	for(auto& line : m_overlayLines)
+		y += drawText(line, 8, y, ColorWhite()).y;
+}
+
+void Profiler::startTrace(const fs::path& file) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_traceFile = file;
+	m_traceStart = SDL_GetPerformanceCounter();
+	_threadId(); // the calling thread is the main thread and gets 1
+	_updateEnabled();
+}
+
+void Profiler::writeTrace() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if(m_traceFile.empty()) return;
+	std::ofstream f(m_traceFile.string().c_str());
+	const double freq = double(SDL_GetPerformanceFrequency());
+	f << "{\"traceEvents\":[";
+	const char* sep = "";
+	for(auto& it : m_threadIds) {
+		f << sep << endl << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << it.second
+			<< ",\"args\":{\"name\":\"" << (it.second == 1 ? "main" : "worker") << " " << it.second << "\"}}";
+		sep = ",";
+	}
+	f.precision(3);
+	f << std::fixed;
+	for(auto& ev : m_events) {
+		// names are our own string literals, i.e. don't need escaping
+		f << sep << endl << "{\"name\":\"" << ev.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << ev.tid
+			<< ",\"ts\":" << double(ev.start - m_traceStart) * 1e6 / freq
+			<< ",\"dur\":" << double(ev.end - ev.start) * 1e6 / freq << "}";
+	}
+	f << endl << "]}" << endl;
+	if(!f) {
+		errors << "cannot write trace " << m_traceFile << endl;
+		return;
+	}
+	notes << "Wrote " << m_events.size() << " trace events to " << m_traceFile
+		<< (m_events.size() >= MaxTraceEvents ? " (limit reached)" : "") << endl;
+}
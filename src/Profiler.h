@@ -0,0 +1,91 @@
+#ifndef __ImageViewer_Profiler_h__
+#define __ImageViewer_Profiler_h__
+
+#include <atomic>
+#include <mutex>
+#include <map>
+#include <vector>
+#include <string>
+#include <thread>
+#include <string.h>
+#include <SDL.h>
+#include <boost/filesystem.hpp>
+#include <boost/noncopyable.hpp>
+
+/*
+Timing of the hot paths. Put a scoped timer around them:
+	ProfileScope scope("Picture::load");
+As long as neither the overlay nor the trace is enabled, that is just
+a check of a bool. Otherwise, the time goes into per-name statistics,
+which the overlay shows, and with a trace file, also into a Chrome
+trace (chrome://tracing, ui.perfetto.dev), which is written at exit.
+All of this can be used from any thread, except the overlay.
+*/
+class Profiler : boost::noncopyable {
+	struct Stat {
+		size_t count;
+		Uint64 total, max; // in performance counter ticks
+		Stat() : count(0), total(0), max(0) {}
+	};
+	struct CStrLess {
+		bool operator()(const char* a, const char* b) const { return strcmp(a, b) < 0; }
+	};
+	struct Event {
+		const char* name; // static strings only
+		int tid;
+		Uint64 start, end;
+	};
+
+	std::atomic<bool> m_enabled;
+	bool m_overlay;
+	std::mutex m_mutex;
+	std::map<const char*, Stat, CStrLess> m_stats; // since m_windowStart
+	std::map<const char*, Stat, CStrLess> m_lastStats; // of the last full window, shown in the overlay
+	Uint64 m_windowStart;
+	std::vector<Uint64> m_frameTimes; // ring buffer
+	size_t m_frameCount;
+	boost::filesystem::path m_traceFile;
+	std::vector<Event> m_events;
+	std::map<std::thread::id, int> m_threadIds;
+	Uint64 m_traceStart;
+	std::vector<std::string> m_overlayLines;
+	Uint64 m_overlayTime;
+
+	int _threadId(); // expects the mutex to be locked
+	void _updateOverlayLines();
+
+	void _updateEnabled() { m_enabled = m_overlay || !m_traceFile.empty(); }
+
+public:
+	Profiler();
+
+	bool enabled() const { return m_enabled.load(std::memory_order_relaxed); }
+	// 0 if disabled.
+	Uint64 now() const { return enabled() ? SDL_GetPerformanceCounter() : 0; }
+	void record(const char* name, Uint64 start, Uint64 end);
+	// Call after SDL_RenderPresent() with the now() from the start of the frame.
+	void frameDone(Uint64 frameStart);
+
+	bool overlay() const { return m_overlay; }
+	void setOverlay(bool overlay);
+	// Until the overlay wants to be drawn again with new numbers, in ms. -1 if it is off.
+	int overlayTimeoutMs() const;
+	// UI thread only.
+	void renderOverlay();
+
+	void startTrace(const boost::filesystem::path& file);
+	void writeTrace();
+};
+
+extern Profiler profiler;
+
+struct ProfileScope : boost::noncopyable {
+	const char* m_name;
+	Uint64 m_start;
+	ProfileScope(const char* name) : m_name(name), m_start(profiler.now()) {}
+	~ProfileScope() {
+		if(m_start) profiler.record(m_name, m_start, SDL_GetPerformanceCounter());
+	}
+};
+
+#endif
@@ -0,0 +1,127 @@
+#include <SDL.h>
+#include <assert.h>
+#include <algorithm>
+#include <vector>
+#include "Scale.h"
+#include "PixelKernels.h"
+#include "PixelPool.h"
+
+// Fixed point of the resize weights.
+static const int WeightBits = 14;
+
+float fitScale(int w, int h, int boxW, int boxH) {
+	if(w <= 0 || h <= 0) return 1;
+	float s = 1;
+	if(boxW > 0) s = std::min(s, float(boxW) / w);
+	if(boxH > 0) s = std::min(s, float(boxH) / h);
+	return s;
+}
+
+SmartPointer<SDL_Surface> halveSurface(SDL_Surface* src) {
+	assert(src->format->BytesPerPixel == 4);
+	const int dw = std::max(src->w / 2, 1), dh = std::max(src->h / 2, 1);
+	SmartPointer<SDL_Surface> dst = pixelPool.createSurface(dw, dh, src->format->format);
+	if(!dst.get()) return NULL;
+
+	const PixelKernels& kernels = pixelKernels();
+	for(int y = 0; y < dh; ++y) {
+		const Uint8* row0 = (const Uint8*) src->pixels + std::min(y * 2, src->h - 1) * src->pitch;
+		const Uint8* row1 = (const Uint8*) src->pixels + std::min(y * 2 + 1, src->h - 1) * src->pitch;
+		Uint8* out = (Uint8*) dst->pixels + y * dst->pitch;
+		if(src->w >= 2)
+			kernels.halveRow(row0, row1, out, dw);
+		else
+			// 1 pixel wide, just average vertically
+			for(int c = 0; c < 4; ++c)
+				out[c] = Uint8((row0[c] + row1[c] + 1) >> 1);
+	}
+	return dst;
+}
+
+SmartPointer<SDL_Surface> reduceSurface(const SmartPointer<SDL_Surface>& src, int boxW, int boxH) {
+	SmartPointer<SDL_Surface> surf = src;
+	const float s = fitScale(surf->w, surf->h, boxW, boxH);
+	const int needW = int(surf->w * s + 0.5f), needH = int(surf->h * s + 0.5f);
+	while(surf->w / 2 >= needW && surf->h / 2 >= needH && surf->w >= 2 && surf->h >= 2) {
+		SmartPointer<SDL_Surface> half = halveSurface(surf.get());
+		if(!half.get()) break;
+		surf = half;
+	}
+	return surf;
+}
+
+namespace {
+// The source pixels [first, first + weights.size()) which make up one destination pixel.
+struct Taps {
+	int first;
+	std::vector<Uint32> weights; // sum up to 1 << WeightBits
+};
+}
+
+// Each source pixel is weighted by how much of it the destination pixel covers.
+static std::vector<Taps> areaTaps(int srcSize, int dstSize) {
+	std::vector<Taps> res(dstSize);
+	// In units where a source pixel is dstSize long and a destination pixel srcSize.
+	for(int d = 0; d < dstSize; ++d) {
+		const Sint64 start = Sint64(d) * srcSize, end = start + srcSize;
+		Taps& taps = res[d];
+		taps.first = int(start / dstSize);
+		Sint64 covered = 0;
+		Uint32 done = 0;
+		for(int s = taps.first; Sint64(s) * dstSize < end; ++s) {
+			covered += std::min(Sint64(s + 1) * dstSize, end) - std::max(Sint64(s) * dstSize, start);
+			// from the cumulative coverage, so that they sum up exactly
+			const Uint32 upTo = Uint32((covered << WeightBits) / srcSize);
+			taps.weights.push_back(upTo - done);
+			done = upTo;
+		}
+	}
+	return res;
+}
+
+SmartPointer<SDL_Surface> resizeSurface(SDL_Surface* src, int w, int h) {
+	assert(src->format->BytesPerPixel == 4);
+	assert(w > 0 && h > 0);
+	SmartPointer<SDL_Surface> dst = pixelPool.createSurface(w, h, src->format->format);
+	if(!dst.get()) return NULL;
+
+	// Separable: first the source rows into one row (SIMD), then that row horizontally.
+	const PixelKernels& kernels = pixelKernels();
+	const std::vector<Taps> rows = areaTaps(src->h, h), cols = areaTaps(src->w, w);
+	const int n = src->w * 4;
+	std::vector<Uint32> acc(n);
+	std::vector<Uint16> line(n); // 8 bits more precision than the result
+	for(int y = 0; y < h; ++y) {
+		std::fill(acc.begin(), acc.end(), 0);
+		const Taps& rowTaps = rows[y];
+		for(size_t j = 0; j < rowTaps.weights.size(); ++j) {
+			const Uint8* in = (const Uint8*) src->pixels + (rowTaps.first + j) * src->pitch;
+			kernels.accumulateRow(in, &acc[0], n, rowTaps.weights[j]);
+		}
+		for(int i = 0; i < n; ++i)
+			line[i] = Uint16((acc[i] + (1 << (WeightBits - 9))) >> (WeightBits - 8));
+
+		Uint8* out = (Uint8*) dst->pixels + y * dst->pitch;
+		for(int x = 0; x < w; ++x) {
+			const Taps& colTaps = cols[x];
+			Uint32 sum[4] = {0, 0, 0, 0};
+			const Uint16* in = &line[colTaps.first * 4];
+			for(size_t j = 0; j < colTaps.weights.size(); ++j, in += 4)
+				for(int c = 0; c < 4; ++c)
+					sum[c] += in[c] * colTaps.weights[j];
+			for(int c = 0; c < 4; ++c)
+				out[x * 4 + c] = Uint8((sum[c] + (1 << (WeightBits + 7))) >> (WeightBits + 8));
+		}
+	}
+	return dst;
+}
+
+SmartPointer<SDL_Surface> fitSurface(const SmartPointer<SDL_Surface>& src, int boxW, int boxH) {
+	const float s = fitScale(src->w, src->h, boxW, boxH);
+	if(s >= 1) return src;
+	// Halve first, that is cheap, and the box filter then only averages a few pixels.
+	SmartPointer<SDL_Surface> surf = reduceSurface(src, boxW, boxH);
+	const int w = std::max(int(src->w * s + 0.5f), 1), h = std::max(int(src->h * s + 0.5f), 1);
+	if(surf->w == w && surf->h == h) return surf;
+	return resizeSurface(surf.get(), w, h);
+}
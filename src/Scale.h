@@ -0,0 +1,29 @@
+#ifndef __ImageViewer_Scale_h__
+#define __ImageViewer_Scale_h__
+
+#include <SDL.h>
+#include "SmartPointer.h"
+
+// Scale factor to fit w x h into boxW x boxH. Never above 1.
+// A box size <= 0 means unlimited.
+float fitScale(int w, int h, int boxW, int boxH);
+
+// Returns a surface of half the size (rounded down, at least 1x1),
+// 2x2 box filtered. Only for 32bit surfaces.
+SmartPointer<SDL_Surface> halveSurface(SDL_Surface* src);
+
+// Halves the surface as long as it still covers the size it would be
+// displayed at when fitted into boxW x boxH.
+SmartPointer<SDL_Surface> reduceSurface(const SmartPointer<SDL_Surface>& src, int boxW, int boxH);
+
+// Area averaging resize to exactly w x h, for downscaling: each source pixel
+// counts as much as it is covered. Only for 32bit surfaces.
+// Like the halving, this expects premultiplied alpha, otherwise the color of
+// transparent pixels bleeds into the visible ones.
+SmartPointer<SDL_Surface> resizeSurface(SDL_Surface* src, int w, int h);
+
+// Fits the surface into boxW x boxH, keeping the aspect ratio.
+// Returns the surface itself if it already fits.
+SmartPointer<SDL_Surface> fitSurface(const SmartPointer<SDL_Surface>& src, int boxW, int boxH);
+
+#endif
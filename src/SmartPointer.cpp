@@ -1,9 +1,10 @@
 #include <SDL.h>
 #include "SmartPointer.h"
+#include "PixelPool.h"
 
 
 template <> void SmartPointer_ObjectDeinit<SDL_Surface> ( SDL_Surface * obj ) {
-	SDL_FreeSurface(obj);
+	freeSurface(obj);
 }
 template <> void SmartPointer_ObjectDeinit<SDL_Texture> ( SDL_Texture * obj ) {
 	SDL_DestroyTexture(obj);
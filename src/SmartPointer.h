@@ -9,7 +9,7 @@
 
 #include <limits.h>
 #include <cassert>
-#include <SDL_mutex.h>
+#include <atomic>
 
 template < typename _Type, typename _SpecificInitFunctor >
 class SmartPointer;
@@ -31,7 +31,7 @@ class CMap;
 class CGameScript;
 
 // Specialized de-init functions, for each simple struct-like type that has no destructor
-template <> void SmartPointer_ObjectDeinit<SDL_Surface> ( SDL_Surface * obj ); // Calls gfxFreeSurface(obj);
+template <> void SmartPointer_ObjectDeinit<SDL_Surface> ( SDL_Surface * obj ); // Calls freeSurface(obj);
 template <> void SmartPointer_ObjectDeinit<SDL_Texture> ( SDL_Texture * obj );
 template <> void SmartPointer_ObjectDeinit<SDL_Renderer> ( SDL_Renderer * obj );
 template <> void SmartPointer_ObjectDeinit<SDL_Window> ( SDL_Window * obj );
@@ -46,6 +46,10 @@ template <> void SmartPointer_ObjectDeinit<SDL_Window> ( SDL_Window * obj );
 	object in different threads. Also there is absolutly no
 	thread safty on the pointer itself, you have to care
 	about this yourself.
+
+	The count lives in one small control block next to the pointer
+	and is atomic, i.e. copying and destroying is lock-free.
+	Moving doesn't touch the count at all.
 */
 
 
@@ -61,88 +65,84 @@ class SmartPointer {
 public:
 	typedef _Type value_type;
 private:
+	struct Counter {
+		std::atomic<int> refCount;
+		Counter() : refCount(1) {}
+	};
+
 	_Type* obj;
-	int* refCount;
-	SDL_mutex* mutex;
+	Counter* counter;
 
 
 	void init(_Type* newObj) {
 		if( newObj == NULL )
 			return;
-		if(!mutex) {
-			mutex = SDL_CreateMutex();
-			obj = newObj;
-			refCount = new int;
-			*refCount = 1;
-		}
+		obj = newObj;
+		counter = new Counter();
 	}
 
 	void reset() {
-		if(mutex) {
-			lock();
-			(*refCount)--;
-			if(*refCount == 0) {
-				SmartPointer_ObjectDeinit( obj );
-				delete refCount; // safe, because there is no other ref anymore
-				obj = NULL;
-				refCount = NULL;
-				unlock();
-				SDL_DestroyMutex(mutex); // safe because there is no other ref anymore
-				mutex = NULL;
-		 	} else
-		 		unlock();
+		// release, so that everything done with obj happens before the deinit in another thread
+		if(counter && counter->refCount.fetch_sub(1, std::memory_order_release) == 1) {
+			std::atomic_thread_fence(std::memory_order_acquire);
+			SmartPointer_ObjectDeinit( obj );
+			delete counter; // safe, because there is no other ref anymore
 		}
 		obj = NULL;
-		refCount = NULL;
-		mutex = NULL;
+		counter = NULL;
 	}
 
-	void incCounter() {
-		assert(*refCount > 0 && *refCount < INT_MAX);
-		(*refCount)++;
-	}
-
-	void lock() {
-		//printf("SmartPointer::lock    (%10p %10p %10p %10p %3i)\n", this, obj, refCount, mutex, refCount?*refCount:-99);
-		SDL_mutexP(mutex);
-	}
-	void unlock() {
-		//printf("SmartPointer::unlock  (%10p %10p %10p %10p %3i)\n", this, obj, refCount, mutex, refCount?*refCount:-99);
-		SDL_mutexV(mutex);
+	static void incCounter(Counter* c) {
+		// relaxed is enough, there is a ref already, so it cannot go away meanwhile
+		assert(c->refCount.load(std::memory_order_relaxed) > 0);
+		assert(c->refCount.load(std::memory_order_relaxed) < INT_MAX);
+		c->refCount.fetch_add(1, std::memory_order_relaxed);
 	}
 
 public:
-	SmartPointer() : obj(NULL), refCount(NULL), mutex(NULL) {
-		//printf("SmartPointer::construc(%10p %10p %10p %10p %3i)\n", this, obj, refCount, mutex, refCount?*refCount:-99);
+	SmartPointer() : obj(NULL), counter(NULL) {
 		_SpecificInitFunctor()(this);
 	}
 	~SmartPointer() {
-		//printf("SmartPointer::destruct(%10p %10p %10p %10p %3i)\n", this, obj, refCount, mutex, refCount?*refCount:-99);
 		reset();
 	}
 
 	// Default copy constructor and operator=
 	// If you specify any template<> params here these funcs will be silently ignored by compiler
-	SmartPointer(const SmartPointer& pt) : obj(NULL), refCount(NULL), mutex(NULL) { operator=(pt); }
+	SmartPointer(const SmartPointer& pt) : obj(NULL), counter(NULL) { operator=(pt); }
 	SmartPointer& operator=(const SmartPointer& pt) {
-		if(mutex == pt.mutex) return *this; // ignore this case
+		if(counter == pt.counter) return *this; // ignore this case
+		// Take the new ref first. pt might be owned by what we release.
+		_Type* newObj = pt.obj;
+		Counter* newCounter = pt.counter;
+		if(newCounter) incCounter(newCounter);
 		reset();
-		mutex = pt.mutex;
-		if(mutex) {
-			lock();
-			obj = pt.obj; refCount = pt.refCount;
-			incCounter();
-			unlock();
-		} else { obj = NULL; refCount = NULL; }
+		obj = newObj;
+		counter = newCounter;
+		return *this;
+	}
+
+	SmartPointer(SmartPointer&& pt) : obj(pt.obj), counter(pt.counter) {
+		pt.obj = NULL;
+		pt.counter = NULL;
+	}
+	SmartPointer& operator=(SmartPointer&& pt) {
+		if(this == &pt) return *this;
+		_Type* newObj = pt.obj;
+		Counter* newCounter = pt.counter;
+		pt.obj = NULL;
+		pt.counter = NULL;
+		reset();
+		obj = newObj;
+		counter = newCounter;
 		return *this;
 	}
 
 	// WARNING: Be carefull, don't assing a pointer to different SmartPointer objects,
 	// else they will get freed twice in the end. Always copy the SmartPointer itself.
 	// In short: SmartPointer ptr(SomeObj); SmartPointer ptr1( ptr.get() ); // It's wrong, don't do that.
-	SmartPointer(_Type* pt): obj(NULL), refCount(NULL), mutex(NULL) { operator=(pt); }
+	SmartPointer(_Type* pt): obj(NULL), counter(NULL) { operator=(pt); }
 	SmartPointer& operator=(_Type* pt) {
-		//printf("SmartPointer::op=Type (%10p %10p %10p %10p %3i)\n", this, obj, refCount, mutex, refCount?*refCount:-99);
 		if(obj == pt) return *this; // ignore this case
 		reset();
 		init(pt);
@@ -157,30 +157,19 @@ public:
 	_Type * operator -> () const { return obj; };
 	
 	// refcount may be changed from another thread, though if refcount==1 or 0 it won't change
-	int getRefCount() {
-		int ret = 0;
-		if(mutex) {
-			lock();
-			ret = *refCount;
-			unlock(); // Here the other thread may change refcount, that's why it's approximate
-		}
-		return ret;
+	int getRefCount() const {
+		return counter ? counter->refCount.load(std::memory_order_acquire) : 0;
 	}
 
 	// Returns true only if the data is deleted (no other smartpointer used it), sets pointer to NULL then
 	bool tryDeleteData() {
-		if(mutex) {
-			lock();
-			if( *refCount == 1 )
-			{
-				unlock(); // Locks mutex again inside reset(), since we're only ones using data refcount cannot change from other thread
-				reset();
-				return true;	// Data deleted
-			}
-			unlock();
-			return false; // Data not deleted
+		if(!counter) return true; // Data was already deleted
+		// Since we're the only ones using the data, the refcount cannot change from another thread
+		if(getRefCount() == 1) {
+			reset();
+			return true; // Data deleted
 		}
-		return true;	// Data was already deleted
+		return false; // Data not deleted
 	}
 
 };
@@ -9,13 +9,23 @@
 #include <SDL.h>
 #include <assert.h>
 #include <iostream>
+#include <algorithm>
 #include "SurfaceTexture.h"
+#include "Profiler.h"
 
 using std::endl;
+
 static auto& errors = std::cerr;
 
+// The surfaces from the decoder have premultiplied alpha.
+static SDL_BlendMode premultipliedBlendMode() {
+	return SDL_ComposeCustomBlendMode(
+		SDL_BLENDFACTOR_ONE, SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA, SDL_BLENDOPERATION_ADD,
+		SDL_BLENDFACTOR_ONE, SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA, SDL_BLENDOPERATION_ADD);
+}
+
 SurfaceTexture::SurfaceTexture(const SmartPointer<SDL_Renderer>& renderer, const SmartPointer<SDL_Surface>& surf)
-: w(0), h(0), maxTextureWidth(0), maxTextureHeight(0), numTexturesHoriz(0), numTexturesVert(0)
+: w(0), h(0), m_textureBytes(0)
 {
 	m_renderer = renderer;
 	m_surface = surf;
@@ -25,63 +35,72 @@ SurfaceTexture::SurfaceTexture(const SmartPointer<SDL_Renderer>& renderer, const
 }
 
 void SurfaceTexture::_init() {
-	w = m_surface->w;
-	h = m_surface->h;
-	if(w <= 0 || h <= 0) {
-		errors << "SurfaceTexture: invalid surface size" << endl;
-		w = h = 0;
-		return;
-	}
-	
-	{
+	int maxTextureWidth = 0, maxTextureHeight = 0;
+	if(m_surface->w > 0 && m_surface->h > 0) {
 		SDL_RendererInfo info;
 		if(SDL_GetRendererInfo(m_renderer.get(), &info) == 0) {
 			maxTextureWidth = info.max_texture_width;
 			maxTextureHeight = info.max_texture_height;
 		} else {
 			errors << "SurfaceTexture: GetRendererInfo error: " << SDL_GetError() << endl;
-			w = h = 0;
 			return;
 		}
 	}
+	if(!m_layout.init(m_surface->w, m_surface->h, maxTextureWidth, maxTextureHeight)) {
+		errors << "SurfaceTexture: invalid surface size" << endl;
+		return;
+	}
+	w = m_layout.w;
+	h = m_layout.h;
 
-	numTexturesHoriz = (w - 1) / maxTextureWidth + 1;
-	numTexturesVert = (h - 1) / maxTextureHeight + 1;
-	assert(numTexturesHoriz >= 1 && numTexturesVert >= 1);
-
-	const int numTextures = numTexturesHoriz * numTexturesVert;
+	const int numTextures = m_layout.count();
 	assert(numTextures >= 1);
-	m_textures.resize(numTextures);
+	m_tiles.resize(numTextures);
 	for(int i = 0; i < numTextures; ++i) {
-		const int horizIdx = i % numTexturesHoriz;
-		const int vertIdx = i / numTexturesHoriz;
-		
-		int textureWidth, textureHeight;
-		if(horizIdx < numTexturesHoriz - 1) textureWidth = maxTextureWidth;
-		else textureWidth = w % maxTextureWidth;
-		if(vertIdx < numTexturesVert - 1) textureHeight = maxTextureHeight;
-		else textureHeight = w % maxTextureHeight;
-		
+		// everything needs to be uploaded initially
+		m_tiles[i].dirty = m_layout.tileRect(i);
+		m_tiles[i].dirty.x = m_tiles[i].dirty.y = 0;
+	}
+}
+
+SurfaceTexture::~SurfaceTexture() {
+	// all are automatically freed via SmartPointer
+}
+
+bool SurfaceTexture::_prepareTile(int idx) {
+	Tile& tile = m_tiles[idx];
+	const SDL_Rect tileRect = m_layout.tileRect(idx);
+
+	if(!tile.texture.get()) {
 		SDL_Texture* texture = SDL_CreateTexture
 		(
 			m_renderer.get(),
 			m_surface->format->format,
 			SDL_TEXTUREACCESS_STREAMING,
-			textureWidth, textureHeight
+			tileRect.w, tileRect.h
 		);
 		if(!texture) {
 			errors << "SurfaceTexture: could not create texture: " << SDL_GetError() << endl;
-			w = h = 0;
-			return;
+			return false;
 		}
-		
-		SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
-		m_textures[i] = texture;
+		// Not supported e.g. by the software renderer. Then transparent parts
+		// just come out as if on black.
+		if(SDL_SetTextureBlendMode(texture, premultipliedBlendMode()) != 0)
+			SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_NONE);
+		tile.texture = texture;
+		m_textureBytes += size_t(tileRect.w) * tileRect.h * m_surface->format->BytesPerPixel;
 	}
-}
 
-SurfaceTexture::~SurfaceTexture() {
-	// all are automatically freed via SmartPointer
+	if(tile.dirty.w > 0 && tile.dirty.h > 0) {
+		ProfileScope scope("SDL_UpdateTexture");
+		uint8_t* pixels =
+			(uint8_t*) m_surface->pixels
+			+ (tileRect.y + tile.dirty.y) * m_surface->pitch
+			+ (tileRect.x + tile.dirty.x) * m_surface->format->BytesPerPixel;
+		SDL_UpdateTexture(tile.texture.get(), &tile.dirty, pixels, m_surface->pitch);
+		tile.dirty.w = tile.dirty.h = 0;
+	}
+	return true;
 }
 
 void SurfaceTexture::updateArea(const SDL_Rect* _rect) {
@@ -96,41 +115,22 @@ void SurfaceTexture::updateArea(const SDL_Rect* _rect) {
 		rect.h = h;
 	}
 	
-	int vertIdx = rect.y / maxTextureHeight;
-	SDL_Rect sub;
-	sub.y = rect.y;
-	sub.h = (vertIdx + 1) * maxTextureHeight - rect.y;
-	while(vertIdx < numTexturesVert) {
-		if(sub.y + sub.h > rect.y + rect.h) sub.h = rect.y + rect.h - sub.y;
-		if(sub.h <= 0) break;
-		
-		int horizIdx = rect.x / maxTextureWidth;
-		sub.x = rect.x;
-		sub.w = (horizIdx + 1) * maxTextureWidth - rect.x;
-		while(horizIdx < numTexturesHoriz) {
-			if(sub.x + sub.w > rect.x + rect.w) sub.w = rect.x + rect.w - sub.x;
-			if(sub.w <= 0) break;
-			
-			int idx = vertIdx * numTexturesHoriz + horizIdx;
-			SDL_Rect texRect;
-			texRect.x = sub.x - horizIdx * maxTextureWidth;
-			texRect.y = sub.y - vertIdx * maxTextureHeight;
-			texRect.w = sub.w;
-			texRect.h = sub.h;
-			uint8_t* pixels =
-				(uint8_t*) m_surface->pixels
-				+ sub.y * m_surface->pitch
-				+ sub.x * m_surface->format->BytesPerPixel;
-			SDL_UpdateTexture(m_textures[idx].get(), &texRect, pixels, m_surface->pitch);
-			
-			horizIdx++;
-			sub.x = horizIdx * maxTextureWidth;
-			sub.w = maxTextureWidth;
-		}
-		
-		vertIdx++;
-		sub.y = vertIdx * maxTextureHeight;
-		sub.h = maxTextureHeight;
+	// Only mark as dirty. It will be uploaded when the tile becomes visible.
+	int horizStart, horizEnd, vertStart, vertEnd;
+	if(!m_layout.tileRange(rect, horizStart, horizEnd, vertStart, vertEnd)) return;
+	for(int vertIdx = vertStart; vertIdx < vertEnd; ++vertIdx)
+	for(int horizIdx = horizStart; horizIdx < horizEnd; ++horizIdx) {
+		const int idx = vertIdx * m_layout.numHoriz + horizIdx;
+		const SDL_Rect tileRect = m_layout.tileRect(idx);
+		SDL_Rect sub;
+		if(!SDL_IntersectRect(&rect, &tileRect, &sub)) continue;
+		sub.x -= tileRect.x;
+		sub.y -= tileRect.y;
+		Tile& tile = m_tiles[idx];
+		if(tile.dirty.w > 0 && tile.dirty.h > 0)
+			SDL_UnionRect(&tile.dirty, &sub, &tile.dirty);
+		else
+			tile.dirty = sub;
 	}
 }
 
@@ -153,46 +153,25 @@ void SurfaceTexture::render(const SDL_Rect* _srcrect, const SDL_Rect* _dstrect)
 		dstrect.w = w;
 		dstrect.h = h;
 	}
+	if(rect.w <= 0 || rect.h <= 0) return;
 	
-	float scaleX = float(dstrect.w) / rect.w;
-	float scaleY = float(dstrect.h) / rect.h;
-	
-	int vertIdx = rect.y / maxTextureHeight;
-	SDL_Rect sub;
-	sub.y = rect.y;
-	sub.h = (vertIdx + 1) * maxTextureHeight - rect.y;
-	while(vertIdx < numTexturesVert) {
-		if(sub.y + sub.h > rect.y + rect.h) sub.h = rect.y + rect.h - sub.y;
-		if(sub.h <= 0) break;
-		
-		int horizIdx = rect.x / maxTextureWidth;
-		sub.x = rect.x;
-		sub.w = (horizIdx + 1) * maxTextureWidth - rect.x;
-		while(horizIdx < numTexturesHoriz) {
-			if(sub.x + sub.w > rect.x + rect.w) sub.w = rect.x + rect.w - sub.x;
-			if(sub.w <= 0) break;
-			
-			int idx = vertIdx * numTexturesHoriz + horizIdx;
-			SDL_Rect rendSrcRect;
-			rendSrcRect.x = sub.x - horizIdx * maxTextureWidth;
-			rendSrcRect.y = sub.y - vertIdx * maxTextureHeight;
-			rendSrcRect.w = sub.w;
-			rendSrcRect.h = sub.h;
-			SDL_Rect rendDstRect;
-			rendDstRect.x = dstrect.x + int((rect.x - sub.x) * scaleX);
-			rendDstRect.y = dstrect.y + int((rect.y - sub.y) * scaleY);
-			rendDstRect.w = int(sub.w * scaleX);
-			rendDstRect.h = int(sub.h * scaleY);			
-			SDL_RenderCopy(m_renderer.get(), m_textures[idx].get(), &rendSrcRect, &rendDstRect);
-			
-			horizIdx++;
-			sub.x = horizIdx * maxTextureWidth;
-			sub.w = maxTextureWidth;
-		}
-		
-		vertIdx++;
-		sub.y = vertIdx * maxTextureHeight;
-		sub.h = maxTextureHeight;
+	int horizStart, horizEnd, vertStart, vertEnd;
+	if(!m_layout.tileRange(rect, horizStart, horizEnd, vertStart, vertEnd)) return;
+	for(int vertIdx = vertStart; vertIdx < vertEnd; ++vertIdx)
+	for(int horizIdx = horizStart; horizIdx < horizEnd; ++horizIdx) {
+		const int idx = vertIdx * m_layout.numHoriz + horizIdx;
+		const SDL_Rect tileRect = m_layout.tileRect(idx);
+		SDL_Rect sub;
+		if(!SDL_IntersectRect(&rect, &tileRect, &sub)) continue;
+		if(!_prepareTile(idx)) continue;
+
+		SDL_Rect rendSrcRect;
+		rendSrcRect.x = sub.x - tileRect.x;
+		rendSrcRect.y = sub.y - tileRect.y;
+		rendSrcRect.w = sub.w;
+		rendSrcRect.h = sub.h;
+		const SDL_Rect rendDstRect = TileLayout::mapRect(sub, rect, dstrect);
+		if(rendDstRect.w <= 0 || rendDstRect.h <= 0) continue;
+		SDL_RenderCopy(m_renderer.get(), m_tiles[idx].texture.get(), &rendSrcRect, &rendDstRect);
 	}
 }
-
@@ -10,30 +10,40 @@
 #define __OpenLieroX__SurfaceTexture__
 
 #include <vector>
+#include <stddef.h>
+#include <SDL_rect.h>
 #include <boost/noncopyable.hpp>
 #include "SmartPointer.h"
+#include "TileLayout.h"
 
 struct SDL_Renderer;
 struct SDL_Texture;
 struct SDL_Surface;
-struct SDL_Rect;
 
 /*
 This represents a big virtual texture, composed of multiple smaller textures,
 which is backed up by a surface.
 So, you can update the surface, and then you need to upload the modified
 area back into the texture by updateArea().
+The textures are created and uploaded lazily in render(), i.e. only the
+tiles which are actually visible are ever uploaded.
 */
 class SurfaceTexture : boost::noncopyable {
+	struct Tile {
+		SmartPointer<SDL_Texture> texture;
+		SDL_Rect dirty; // in tile coordinates, w == 0 if nothing to upload
+	};
+
 	SmartPointer<SDL_Renderer> m_renderer;
 	SmartPointer<SDL_Surface> m_surface;
-	std::vector<SmartPointer<SDL_Texture> > m_textures;
+	std::vector<Tile> m_tiles;
 
 	int w, h;
-	int maxTextureWidth, maxTextureHeight;
-	int numTexturesHoriz, numTexturesVert;
+	TileLayout m_layout;
+	size_t m_textureBytes;
 	
 	void _init();
+	bool _prepareTile(int idx);
 	
 public:
 	SurfaceTexture(const SmartPointer<SDL_Renderer>& renderer, const SmartPointer<SDL_Surface>& surf);
@@ -41,6 +51,9 @@ public:
 
 	int width() const { return w; }
 	int height() const { return h; }
+	operator bool() const { return w > 0; }
+	const SmartPointer<SDL_Surface>& surface() const { return m_surface; }
+	size_t textureBytes() const { return m_textureBytes; }
 	
 	void updateArea(const SDL_Rect* rect);
 	void render(const SDL_Rect* srcrect, const SDL_Rect* dstrect);
@@ -0,0 +1,427 @@
+#include <SDL.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include "ThumbnailStore.h"
+#include "Decoder.h"
+#include "Scale.h"
+
+static auto &errors = std::cerr;
+using std::endl;
+
+namespace fs = boost::filesystem;
+
+ThumbnailStore thumbnailStore;
+
+namespace {
+
+const char Magic[8] = {'I', 'V', 'T', 'H', 'U', 'M', 'B', 0};
+const uint32_t Version = 1;
+const uint32_t DefaultSlotCount = 1 << 16;
+// Rebuilt when there are more dead records than live ones, but at least that many.
+const uint64_t MinGarbage = 1024;
+enum { FormatRaw = 0, FormatJpeg = 1 };
+
+struct Header {
+	char magic[8];
+	uint32_t version;
+	uint32_t slotCount; // power of two
+	uint64_t dataEnd;
+	uint64_t count;
+	uint64_t garbage; // records which are not referenced anymore
+	char reserved[24];
+};
+
+struct Slot {
+	uint64_t hash; // 0 if empty
+	uint64_t offset;
+};
+
+// followed by the path and the data
+struct Record {
+	uint64_t hash;
+	int64_t fileSize;
+	int64_t mtime;
+	uint32_t pathLen;
+	uint16_t w, h;
+	uint32_t fullW, fullH;
+	uint32_t format;
+	uint32_t dataLen;
+};
+
+uint64_t hashPath(const std::string& s) {
+	// FNV-1a
+	uint64_t h = 14695981039346656037ULL;
+	for(char c : s) {
+		h ^= (unsigned char) c;
+		h *= 1099511628211ULL;
+	}
+	return h ? h : 1;
+}
+
+size_t dataStart(uint32_t slotCount) {
+	return sizeof(Header) + size_t(slotCount) * sizeof(Slot);
+}
+
+size_t align8(size_t s) {
+	return (s + 7) & ~size_t(7);
+}
+
+bool writeAll(int fd, const void* data, size_t size, size_t offset) {
+	const char* p = (const char*) data;
+	while(size > 0) {
+		ssize_t n = pwrite(fd, p, size, offset);
+		if(n <= 0) return false;
+		p += n;
+		size -= n;
+		offset += n;
+	}
+	return true;
+}
+
+bool fileKey(const fs::path& path, int64_t& fileSize, int64_t& mtime) {
+	boost::system::error_code ec;
+	fileSize = (int64_t) fs::file_size(path, ec);
+	if(ec) return false;
+	mtime = (int64_t) fs::last_write_time(path, ec);
+	return !ec;
+}
+
+}
+
+ThumbnailStore::ThumbnailStore() : m_fd(-1), m_map(NULL), m_mapSize(0), m_hits(0), m_misses(0) {}
+
+ThumbnailStore::~ThumbnailStore() {
+	close();
+}
+
+fs::path ThumbnailStore::defaultFile() {
+	fs::path dir;
+	if(getenv("XDG_CACHE_HOME"))
+		dir = getenv("XDG_CACHE_HOME");
+	else if(getenv("HOME"))
+#ifdef __APPLE__
+		dir = fs::path(getenv("HOME")) / "Library" / "Caches";
+#else
+		dir = fs::path(getenv("HOME")) / ".cache";
+#endif
+	else
+		dir = fs::temp_directory_path();
+	return dir / "ImageViewer" / "thumbs.pack";
+}
+
+bool ThumbnailStore::open(const fs::path& file) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	_close();
+	boost::system::error_code ec;
+	fs::create_directories(file.parent_path(), ec);
+	return _open(file.string(), DefaultSlotCount);
+}
+
+void ThumbnailStore::close() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	_close();
+}
+
+bool ThumbnailStore::_open(const std::string& filename, uint32_t slotCount) {
+	m_filename = filename;
+	m_fd = ::open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+	if(m_fd < 0) {
+		errors << "cannot open thumbnail store " << filename << ": " << strerror(errno) << endl;
+		return false;
+	}
+
+	// Another instance might be initializing it at the same time.
+	if(flock(m_fd, LOCK_EX) != 0) {
+		errors << "cannot lock thumbnail store " << filename << ": " << strerror(errno) << endl;
+		_close();
+		return false;
+	}
+	Header header;
+	bool valid =
+		pread(m_fd, &header, sizeof(header), 0) == (ssize_t) sizeof(header)
+		&& memcmp(header.magic, Magic, sizeof(Magic)) == 0
+		&& header.version == Version
+		&& header.slotCount > 0 && (header.slotCount & (header.slotCount - 1)) == 0
+		&& header.dataEnd >= dataStart(header.slotCount);
+	if(!valid) {
+		// new or incompatible, start from scratch
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, Magic, sizeof(Magic));
+		header.version = Version;
+		header.slotCount = slotCount;
+		header.dataEnd = dataStart(slotCount);
+		if(ftruncate(m_fd, 0) != 0 || ftruncate(m_fd, header.dataEnd) != 0
+		   || !writeAll(m_fd, &header, sizeof(header), 0)) {
+			errors << "cannot initialize thumbnail store " << filename << ": " << strerror(errno) << endl;
+			_close();
+			return false;
+		}
+	}
+	flock(m_fd, LOCK_UN);
+
+	if(!_remap(header.dataEnd)) {
+		_close();
+		return false;
+	}
+	return true;
+}
+
+void ThumbnailStore::_close() {
+	if(m_map) munmap(m_map, m_mapSize);
+	m_map = NULL;
+	m_mapSize = 0;
+	if(m_fd >= 0) ::close(m_fd);
+	m_fd = -1;
+}
+
+bool ThumbnailStore::_lock() {
+	for(int tries = 0; tries < 3; ++tries) {
+		if(flock(m_fd, LOCK_EX) != 0) {
+			errors << "cannot lock thumbnail store: " << strerror(errno) << endl;
+			return false;
+		}
+		// Another instance might have rebuilt it meanwhile. Then ours is the old file.
+		struct stat ours, current;
+		if(fstat(m_fd, &ours) == 0 && stat(m_filename.c_str(), &current) == 0
+		   && ours.st_ino == current.st_ino && ours.st_dev == current.st_dev) {
+			// and it might have appended
+			Header header;
+			memcpy(&header, m_map, sizeof(header));
+			if(_remap(header.dataEnd)) return true;
+			_unlock();
+			return false;
+		}
+		const std::string filename = m_filename;
+		_close(); // also unlocks
+		if(!_open(filename, DefaultSlotCount)) return false;
+	}
+	return false;
+}
+
+void ThumbnailStore::_unlock() {
+	if(m_fd >= 0) flock(m_fd, LOCK_UN);
+}
+
+bool ThumbnailStore::_remap(size_t size) {
+	if(m_map && size <= m_mapSize) return true;
+	// Map a bit more than needed, so that we don't need to remap on every put().
+	// We never access the mapping beyond the end of the file.
+	size_t newSize = std::max(size + size / 4, size_t(64) * 1024 * 1024);
+	if(m_map) munmap(m_map, m_mapSize);
+	m_map = (unsigned char*) mmap(NULL, newSize, PROT_READ, MAP_SHARED, m_fd, 0);
+	if(m_map == MAP_FAILED) {
+		errors << "cannot mmap thumbnail store: " << strerror(errno) << endl;
+		m_map = NULL;
+		m_mapSize = 0;
+		return false;
+	}
+	m_mapSize = newSize;
+	return true;
+}
+
+// Returns the index of the slot for the given path, which is either
+// the slot with its record, or the empty slot where it would go.
+// Expects the mutex to be locked and the store to be open.
+static uint32_t findSlot(const unsigned char* map, uint64_t hash, const std::string& path) {
+	const Header* header = (const Header*) map;
+	const Slot* slots = (const Slot*) (map + sizeof(Header));
+	const uint32_t mask = header->slotCount - 1;
+	for(uint32_t i = uint32_t(hash) & mask; ; i = (i + 1) & mask) {
+		const Slot& slot = slots[i];
+		if(slot.hash == 0) return i;
+		if(slot.hash != hash) continue;
+		if(slot.offset + sizeof(Record) > header->dataEnd) continue; // broken
+		const Record* r = (const Record*) (map + slot.offset);
+		if(r->pathLen == path.size() && memcmp(r + 1, path.data(), path.size()) == 0)
+			return i;
+	}
+}
+
+SmartPointer<SDL_Surface> ThumbnailStore::get(const fs::path& path, int* fullW, int* fullH) {
+	int64_t fileSize, mtime;
+	if(!fileKey(path, fileSize, mtime)) return NULL;
+	const std::string pathStr = path.string();
+	const uint64_t hash = hashPath(pathStr);
+
+	Record r;
+	std::vector<unsigned char> data;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		// Another instance might have appended beyond our mapping.
+		if(!m_map || !_remap(((const Header*) m_map)->dataEnd)) return NULL;
+		const Header* header = (const Header*) m_map;
+		const Slot& slot = ((const Slot*) (m_map + sizeof(Header)))[findSlot(m_map, hash, pathStr)];
+		if(slot.hash == 0) {
+			m_misses++;
+			return NULL;
+		}
+		memcpy(&r, m_map + slot.offset, sizeof(r));
+		const size_t dataOffset = slot.offset + sizeof(Record) + r.pathLen;
+		if(r.fileSize != fileSize || r.mtime != mtime || dataOffset + r.dataLen > header->dataEnd) {
+			m_misses++;
+			return NULL;
+		}
+		// copy out, so that we can decode without the lock
+		data.assign(m_map + dataOffset, m_map + dataOffset + r.dataLen);
+		m_hits++;
+	}
+
+	SmartPointer<SDL_Surface> surf;
+	if(r.format == FormatJpeg)
+		surf = decodeJpegData(&data[0], data.size());
+	else if(r.format == FormatRaw && data.size() == size_t(r.w) * r.h * 4) {
+		surf = SDL_CreateRGBSurfaceWithFormat(0, r.w, r.h, 32, SDL_PIXELFORMAT_ARGB8888);
+		if(surf.get())
+			for(int y = 0; y < r.h; ++y)
+				memcpy((unsigned char*) surf->pixels + y * surf->pitch, &data[y * r.w * 4], r.w * 4);
+	}
+	if(!surf.get()) return NULL;
+	*fullW = r.fullW;
+	*fullH = r.fullH;
+	return surf;
+}
+
+bool ThumbnailStore::contains(const fs::path& path) {
+	int64_t fileSize, mtime;
+	if(!fileKey(path, fileSize, mtime)) return false;
+	const std::string pathStr = path.string();
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if(!m_map || !_remap(((const Header*) m_map)->dataEnd)) return false;
+	const Slot& slot = ((const Slot*) (m_map + sizeof(Header)))[findSlot(m_map, hashPath(pathStr), pathStr)];
+	if(slot.hash == 0) return false;
+	const Record* r = (const Record*) (m_map + slot.offset);
+	return r->fileSize == fileSize && r->mtime == mtime;
+}
+
+void ThumbnailStore::put(const fs::path& path, SDL_Surface* thumb, int fullW, int fullH) {
+	int64_t fileSize, mtime;
+	if(!fileKey(path, fileSize, mtime)) return;
+	if(thumb->format->format != SDL_PIXELFORMAT_ARGB8888) return;
+	const std::string pathStr = path.string();
+
+	std::vector<unsigned char> data;
+	uint32_t format = FormatJpeg;
+	if(!encodeJpeg(thumb, 85, data)) {
+		format = FormatRaw;
+		data.resize(size_t(thumb->w) * thumb->h * 4);
+		for(int y = 0; y < thumb->h; ++y)
+			memcpy(&data[y * thumb->w * 4], (unsigned char*) thumb->pixels + y * thumb->pitch, thumb->w * 4);
+	}
+	if(data.empty()) return;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	// Serializes the appends of several instances.
+	if(!m_map || !_lock()) return;
+	_put(hashPath(pathStr), pathStr, fileSize, mtime, thumb->w, thumb->h, fullW, fullH, format, &data[0], data.size());
+	_unlock();
+}
+
+bool ThumbnailStore::_put(uint64_t hash, const std::string& path, int64_t fileSize, int64_t mtime,
+						  uint16_t w, uint16_t h, uint32_t fullW, uint32_t fullH,
+						  uint32_t format, const unsigned char* data, uint32_t dataLen) {
+	Header header;
+	memcpy(&header, m_map, sizeof(header));
+	// Too full, or too much garbage of rewritten pictures.
+	const bool full = (header.count + 1) * 10 > uint64_t(header.slotCount) * 7;
+	if(full || (header.garbage >= MinGarbage && header.garbage > header.count)) {
+		// _rebuild() replaces the file, which has to be locked again.
+		if(!_rebuild(full ? header.slotCount * 2 : header.slotCount) || !_lock()) return false;
+		memcpy(&header, m_map, sizeof(header));
+	}
+
+	Record r;
+	memset(&r, 0, sizeof(r));
+	r.hash = hash;
+	r.fileSize = fileSize;
+	r.mtime = mtime;
+	r.pathLen = path.size();
+	r.w = w;
+	r.h = h;
+	r.fullW = fullW;
+	r.fullH = fullH;
+	r.format = format;
+	r.dataLen = dataLen;
+
+	// Write the record first, then the slot, then the header.
+	// If we get interrupted, the record is just garbage.
+	const size_t offset = header.dataEnd;
+	if(!writeAll(m_fd, &r, sizeof(r), offset)
+	   || !writeAll(m_fd, path.data(), path.size(), offset + sizeof(r))
+	   || !writeAll(m_fd, data, dataLen, offset + sizeof(r) + path.size())) {
+		errors << "cannot write thumbnail store: " << strerror(errno) << endl;
+		return false;
+	}
+
+	const uint32_t slotIdx = findSlot(m_map, hash, path);
+	Slot slot;
+	memcpy(&slot, m_map + sizeof(Header) + slotIdx * sizeof(Slot), sizeof(slot));
+	if(slot.hash == 0) header.count++;
+	else header.garbage++;
+	slot.hash = hash;
+	slot.offset = offset;
+	header.dataEnd = align8(offset + sizeof(r) + path.size() + dataLen);
+	if(!writeAll(m_fd, &slot, sizeof(slot), sizeof(Header) + slotIdx * sizeof(Slot))
+	   || !writeAll(m_fd, &header, sizeof(header), 0)) {
+		errors << "cannot write thumbnail store: " << strerror(errno) << endl;
+		return false;
+	}
+	return _remap(header.dataEnd);
+}
+
+bool ThumbnailStore::_rebuild(uint32_t slotCount) {
+	// Copy all live records into a new file, which drops the garbage.
+	// Expects the lock to be held, thus no other instance rebuilds at the same time.
+	const Header* header = (const Header*) m_map;
+	const std::string tmpFilename = m_filename + ".tmp";
+	unlink(tmpFilename.c_str());
+	ThumbnailStore tmp;
+	if(!tmp._open(tmpFilename, slotCount)) return false;
+
+	const Slot* slots = (const Slot*) (m_map + sizeof(Header));
+	for(uint32_t i = 0; i < header->slotCount; ++i) {
+		if(slots[i].hash == 0) continue;
+		if(slots[i].offset + sizeof(Record) > header->dataEnd) continue;
+		const Record* r = (const Record*) (m_map + slots[i].offset);
+		const unsigned char* path = (const unsigned char*) (r + 1);
+		if(slots[i].offset + sizeof(Record) + r->pathLen + r->dataLen > header->dataEnd) continue;
+		if(!tmp._put(r->hash, std::string((const char*) path, r->pathLen), r->fileSize, r->mtime,
+					 r->w, r->h, r->fullW, r->fullH, r->format, path + r->pathLen, r->dataLen)) {
+			tmp._close();
+			unlink(tmpFilename.c_str());
+			return false;
+		}
+	}
+	tmp._close();
+
+	// Replaced while we still hold the lock on the old one, so that no other
+	// instance appends to it meanwhile.
+	const std::string filename = m_filename;
+	if(rename(tmpFilename.c_str(), filename.c_str()) != 0) {
+		errors << "cannot replace thumbnail store: " << strerror(errno) << endl;
+		unlink(tmpFilename.c_str());
+	}
+	_close();
+	return _open(filename, DefaultSlotCount);
+}
+
+SmartPointer<SDL_Surface> ThumbnailStore::getOrCreate(const fs::path& path, int* fullW, int* fullH) {
+	SmartPointer<SDL_Surface> thumb = get(path, fullW, fullH);
+	if(thumb.get()) return thumb;
+
+	SmartPointer<SDL_Surface> surf = decodePicture(path, Size, Size, fullW, fullH);
+	if(!surf.get()) return NULL;
+	thumb = fitSurface(surf, Size, Size);
+	if(!thumb.get()) return NULL;
+	put(path, thumb.get(), *fullW, *fullH);
+	return thumb;
+}
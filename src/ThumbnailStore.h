@@ -0,0 +1,77 @@
+#ifndef __ImageViewer_ThumbnailStore_h__
+#define __ImageViewer_ThumbnailStore_h__
+
+#include <string>
+#include <mutex>
+#include <stdint.h>
+#include <stddef.h>
+#include <SDL.h>
+#include <boost/filesystem.hpp>
+#include <boost/noncopyable.hpp>
+#include "SmartPointer.h"
+
+/*
+Persistent store of thumbnails, in a single file which is memory-mapped.
+
+The file starts with a header, followed by the index, which is a hash
+table (open addressing) from the key hash to the record offset,
+followed by the records, which are only ever appended.
+The key is the picture path, its file size and mtime. If the picture
+changes, the new record replaces the old one in the index, and the old
+one is garbage until the next rebuild, which happens when the index
+gets too full or there are more dead records than live ones.
+
+Several instances can share the file. Appends and rebuilds hold an
+exclusive flock(). A rebuild replaces the file, the others notice that
+when they lock it the next time and open it again.
+
+Thumbnails are stored JPEG-compressed if we have libjpeg-turbo, otherwise raw.
+All functions are thread-safe.
+*/
+class ThumbnailStore : boost::noncopyable {
+public:
+	enum { Size = 256 }; // max width/height of a thumbnail
+
+private:
+	std::mutex m_mutex;
+	std::string m_filename;
+	int m_fd;
+	unsigned char* m_map;
+	size_t m_mapSize;
+	size_t m_hits, m_misses;
+
+	bool _open(const std::string& filename, uint32_t slotCount);
+	void _close();
+	bool _remap(size_t size);
+	// Both expect the mutex to be locked. _lock() opens the file again if it was replaced.
+	bool _lock();
+	void _unlock();
+	bool _rebuild(uint32_t slotCount);
+	bool _put(uint64_t hash, const std::string& path, int64_t fileSize, int64_t mtime,
+			  uint16_t w, uint16_t h, uint32_t fullW, uint32_t fullH,
+			  uint32_t format, const unsigned char* data, uint32_t dataLen);
+
+public:
+	ThumbnailStore();
+	~ThumbnailStore();
+
+	bool open(const boost::filesystem::path& file);
+	void close();
+	bool isOpen() const { return m_map != NULL; }
+
+	// Returns NULL if it is not in the store or the picture has changed.
+	SmartPointer<SDL_Surface> get(const boost::filesystem::path& path, int* fullW, int* fullH);
+	bool contains(const boost::filesystem::path& path);
+	void put(const boost::filesystem::path& path, SDL_Surface* thumb, int fullW, int fullH);
+	// get(), or otherwise decode the picture and put() it.
+	SmartPointer<SDL_Surface> getOrCreate(const boost::filesystem::path& path, int* fullW, int* fullH);
+
+	size_t hits() const { return m_hits; }
+	size_t misses() const { return m_misses; }
+
+	static boost::filesystem::path defaultFile();
+};
+
+extern ThumbnailStore thumbnailStore;
+
+#endif
@@ -0,0 +1,59 @@
+#include <assert.h>
+#include <algorithm>
+#include "TileLayout.h"
+
+bool TileLayout::init(int _w, int _h, int maxTextureWidth, int maxTextureHeight) {
+	w = _w;
+	h = _h;
+	if(w <= 0 || h <= 0) {
+		w = h = tileW = tileH = numHoriz = numVert = 0;
+		return false;
+	}
+	// 0 means that there is no limit, e.g. for the software renderer
+	tileW = (maxTextureWidth > 0) ? maxTextureWidth : w;
+	tileH = (maxTextureHeight > 0) ? maxTextureHeight : h;
+	// Smaller tiles, so that at high zoom, only the visible part of a large picture is uploaded.
+	tileW = std::min(tileW, int(MaxTileSize));
+	tileH = std::min(tileH, int(MaxTileSize));
+	numHoriz = (w - 1) / tileW + 1;
+	numVert = (h - 1) / tileH + 1;
+	assert(numHoriz >= 1 && numVert >= 1);
+	return true;
+}
+
+SDL_Rect TileLayout::tileRect(int idx) const {
+	const int horizIdx = idx % numHoriz;
+	const int vertIdx = idx / numHoriz;
+	SDL_Rect r;
+	r.x = horizIdx * tileW;
+	r.y = vertIdx * tileH;
+	// The last tile in a row/column gets the remainder, which is
+	// a full tile if the size is a multiple of the max texture size.
+	r.w = (horizIdx < numHoriz - 1) ? tileW : (w - r.x);
+	r.h = (vertIdx < numVert - 1) ? tileH : (h - r.y);
+	assert(r.w > 0 && r.h > 0);
+	return r;
+}
+
+bool TileLayout::tileRange(const SDL_Rect& rect, int& horizStart, int& horizEnd, int& vertStart, int& vertEnd) const {
+	// clip to the surface, then get the range of tile indices [start, end)
+	const int x1 = std::min(rect.x + rect.w, w), y1 = std::min(rect.y + rect.h, h);
+	const int x0 = std::max(rect.x, 0), y0 = std::max(rect.y, 0);
+	if(x0 >= x1 || y0 >= y1) return false;
+	horizStart = x0 / tileW;
+	horizEnd = (x1 - 1) / tileW + 1;
+	vertStart = y0 / tileH;
+	vertEnd = (y1 - 1) / tileH + 1;
+	return true;
+}
+
+SDL_Rect TileLayout::mapRect(const SDL_Rect& sub, const SDL_Rect& src, const SDL_Rect& dst) {
+	const float scaleX = float(dst.w) / src.w;
+	const float scaleY = float(dst.h) / src.h;
+	SDL_Rect r;
+	r.x = dst.x + int((sub.x - src.x) * scaleX);
+	r.y = dst.y + int((sub.y - src.y) * scaleY);
+	r.w = dst.x + int((sub.x + sub.w - src.x) * scaleX) - r.x;
+	r.h = dst.y + int((sub.y + sub.h - src.y) * scaleY) - r.y;
+	return r;
+}
@@ -0,0 +1,30 @@
+#ifndef __ImageViewer_TileLayout_h__
+#define __ImageViewer_TileLayout_h__
+
+#include <SDL_rect.h>
+
+/*
+How a w x h surface is split into tiles of at most the max texture size
+(0: no limit), and at most MaxTileSize. The tiles in the last row/column
+get the remainder. Separate from SurfaceTexture, so that the tests can
+check the edge tiles for any max texture size, without a renderer.
+*/
+struct TileLayout {
+	enum { MaxTileSize = 2048 };
+	int w, h;
+	int tileW, tileH;
+	int numHoriz, numVert;
+
+	TileLayout() : w(0), h(0), tileW(0), tileH(0), numHoriz(0), numVert(0) {}
+	// false if the size is invalid
+	bool init(int w, int h, int maxTextureWidth, int maxTextureHeight);
+	int count() const { return numHoriz * numVert; }
+	SDL_Rect tileRect(int idx) const;
+	// The tile indices [start, end) which rect (clipped to the surface) touches. false if none.
+	bool tileRange(const SDL_Rect& rect, int& horizStart, int& horizEnd, int& vertStart, int& vertEnd) const;
+	// Where the part sub of src goes when src is drawn to dst. Both edges come
+	// from the same mapping, so that adjacent tiles leave no gaps.
+	static SDL_Rect mapRect(const SDL_Rect& sub, const SDL_Rect& src, const SDL_Rect& dst);
+};
+
+#endif
@@ -0,0 +1,477 @@
+#include <SDL.h>
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <boost/algorithm/string.hpp>
+#ifdef HAVE_FFMPEG
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libavutil/frame.h>
+#include <libswscale/swscale.h>
+}
+#endif
+#include "Video.h"
+#include "Gfx.h"
+#include "Picture.h"
+#include "PixelPool.h"
+#include "Profiler.h"
+#include "Scale.h"
+
+// Decoded frames ahead of the one shown. 4K 4:2:0 is 12MB each.
+static const size_t RingSize = 4;
+// If a frame is that late, the clock restarts with it instead of dropping
+// everything after it, e.g. after the window was hidden.
+static const double MaxLateSecs = 0.5;
+// Without timestamps.
+static const double DefaultFrameSecs = 1.0 / 25;
+
+static auto &errors = std::cerr;
+using std::endl;
+namespace fs = boost::filesystem;
+
+VideoPlayer videoPlayer;
+
+bool isVideoFilename(const fs::path& path) {
+#ifdef HAVE_FFMPEG
+	std::string ext = path.extension().string();
+	boost::to_lower(ext);
+	return ext == ".mp4" || ext == ".m4v" || ext == ".mov" || ext == ".mkv" || ext == ".webm"
+		|| ext == ".avi" || ext == ".mpg" || ext == ".mpeg" || ext == ".ts";
+#else
+	return false;
+#endif
+}
+
+#ifdef HAVE_FFMPEG
+
+namespace {
+
+// The demuxer and the decoder of the best video stream.
+struct VideoFile : boost::noncopyable {
+	AVFormatContext* format;
+	AVCodecContext* codec;
+	AVStream* stream;
+	AVPacket* packet;
+	bool eof; // of the demuxer, the decoder gets drained
+
+	VideoFile() : format(NULL), codec(NULL), stream(NULL), packet(NULL), eof(false) {}
+	~VideoFile() {
+		av_packet_free(&packet);
+		avcodec_free_context(&codec);
+		avformat_close_input(&format);
+	}
+
+	bool open(const fs::path& path, const AVIOInterruptCB* interrupt) {
+		static std::once_flag logLevelOnce;
+		std::call_once(logLevelOnce, []() { av_log_set_level(AV_LOG_ERROR); });
+
+		format = avformat_alloc_context();
+		if(!format) return false;
+		if(interrupt) format->interrupt_callback = *interrupt;
+		// frees format on failure
+		if(avformat_open_input(&format, path.string().c_str(), NULL, NULL) < 0) return false;
+		if(avformat_find_stream_info(format, NULL) < 0) return false;
+		const int index = av_find_best_stream(format, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+		if(index < 0) return false;
+		stream = format->streams[index];
+		const AVCodec* decoder = avcodec_find_decoder(stream->codecpar->codec_id);
+		if(!decoder) return false;
+		codec = avcodec_alloc_context3(decoder);
+		if(!codec || avcodec_parameters_to_context(codec, stream->codecpar) < 0) return false;
+		// As many threads as there are CPUs. Frame threads are what makes 4K fast.
+		codec->thread_count = 0;
+		codec->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+		if(avcodec_open2(codec, decoder, NULL) < 0) return false;
+		packet = av_packet_alloc();
+		return packet != NULL;
+	}
+
+	// The next frame into frame. false at the end.
+	bool next(AVFrame* frame) {
+		while(true) {
+			const int r = avcodec_receive_frame(codec, frame);
+			if(r == 0) return true;
+			if(r == AVERROR_EOF) return false;
+			if(r != AVERROR(EAGAIN)) continue; // broken data, skip it
+			if(eof) return false;
+			if(av_read_frame(format, packet) < 0) {
+				eof = true;
+				avcodec_send_packet(codec, NULL);
+				continue;
+			}
+			if(packet->stream_index == stream->index)
+				avcodec_send_packet(codec, packet);
+			av_packet_unref(packet);
+		}
+	}
+
+	bool rewind() {
+		const int64_t start = (stream->start_time != AV_NOPTS_VALUE) ? stream->start_time : 0;
+		if(av_seek_frame(format, stream->index, start, AVSEEK_FLAG_BACKWARD) < 0) return false;
+		avcodec_flush_buffers(codec);
+		eof = false;
+		return true;
+	}
+};
+
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+static const AVPixelFormat ArgbFormat = AV_PIX_FMT_BGRA;
+#else
+static const AVPixelFormat ArgbFormat = AV_PIX_FMT_ARGB;
+#endif
+
+static bool isYuv420(int format) {
+	return format == AV_PIX_FMT_YUV420P || format == AV_PIX_FMT_YUVJ420P;
+}
+
+}
+
+struct VideoStream : boost::noncopyable {
+	struct Frame {
+		AVFrame* frame; // YUV 4:2:0
+		double pts; // seconds
+		int loop; // how often it started over before
+	};
+
+	const fs::path path;
+	VideoFile file;
+	SwsContext* sws; // to YUV 4:2:0, only if the video is something else
+	std::mutex mutex;
+	std::condition_variable cond; // the ring changed, or quit
+	std::deque<Frame> ring;
+	int width, height;
+	bool ended; // the decode thread returned
+	std::atomic<bool> quit;
+	std::atomic<size_t> decoded;
+	std::thread thread;
+
+	VideoStream(const fs::path& _path)
+	: path(_path), sws(NULL), width(0), height(0), ended(false), quit(false), decoded(0) {
+		thread = std::thread(&VideoStream::_run, this);
+	}
+
+	~VideoStream() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			quit = true;
+		}
+		cond.notify_all();
+		thread.join();
+		for(Frame& f : ring)
+			av_frame_free(&f.frame);
+		sws_freeContext(sws);
+	}
+
+	// Waits for the next frame. false if there is none anymore.
+	bool take(Frame& f) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			cond.wait(lock, [this]() { return !ring.empty() || ended; });
+			if(ring.empty()) return false;
+			f = ring.front();
+			ring.pop_front();
+		}
+		cond.notify_all();
+		return true;
+	}
+
+private:
+	static int _interrupt(void* self) { return ((VideoStream*) self)->quit; }
+
+	void _run() {
+		AVIOInterruptCB interrupt = {_interrupt, this};
+		AVFrame* frame = av_frame_alloc();
+		bool ok = frame && file.open(path, &interrupt);
+		if(!ok && !quit)
+			errors << "cannot open video " << path << endl;
+		if(ok) {
+			std::lock_guard<std::mutex> lock(mutex);
+			width = file.codec->width;
+			height = file.codec->height;
+		}
+		const double timeBase = ok ? av_q2d(file.stream->time_base) : 0;
+		int loop = 0;
+		bool any = false; // frames since it started over
+		double lastPts = -DefaultFrameSecs;
+		while(ok && !quit) {
+			if(!file.next(frame)) {
+				// Start over, unless that would only spin.
+				ok = any && file.rewind();
+				any = false;
+				loop++;
+				lastPts = -DefaultFrameSecs;
+				continue;
+			}
+			Frame f;
+			f.frame = _convert(frame);
+			if(!f.frame) break;
+			const int64_t ts = frame->best_effort_timestamp;
+			f.pts = (ts != AV_NOPTS_VALUE) ? ts * timeBase : lastPts + DefaultFrameSecs;
+			f.loop = loop;
+			lastPts = f.pts;
+			any = true;
+			decoded++;
+			if(!_push(f)) {
+				av_frame_free(&f.frame);
+				break;
+			}
+		}
+		av_frame_free(&frame);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			ended = true;
+		}
+		cond.notify_all();
+	}
+
+	AVFrame* _convert(AVFrame* frame) {
+		// Only a new reference to the decoder's buffers.
+		if(isYuv420(frame->format))
+			return av_frame_clone(frame);
+		ProfileScope scope("video convert");
+		AVFrame* out = av_frame_alloc();
+		if(!out) return NULL;
+		out->format = AV_PIX_FMT_YUV420P;
+		out->width = frame->width;
+		out->height = frame->height;
+		out->color_range = frame->color_range;
+		sws = sws_getCachedContext(sws, frame->width, frame->height, (AVPixelFormat) frame->format,
+			frame->width, frame->height, AV_PIX_FMT_YUV420P, SWS_BILINEAR, NULL, NULL, NULL);
+		if(!sws || av_frame_get_buffer(out, 0) < 0) {
+			av_frame_free(&out);
+			return NULL;
+		}
+		sws_scale(sws, frame->data, frame->linesize, 0, frame->height, out->data, out->linesize);
+		return out;
+	}
+
+	// Waits while the ring is full. false if it should quit.
+	bool _push(const Frame& f) {
+		bool wasEmpty = false;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			cond.wait(lock, [this]() { return quit || ring.size() < RingSize; });
+			if(quit) return false;
+			wasEmpty = ring.empty();
+			ring.push_back(f);
+		}
+		cond.notify_all();
+		// The main loop might sleep without a timeout then.
+		if(wasEmpty) pushDecodedEvent();
+		return true;
+	}
+};
+
+#else
+
+struct VideoStream {};
+
+#endif
+
+SmartPointer<SDL_Surface> decodeVideoFrame(const fs::path& path, int boxW, int boxH, int* fullW, int* fullH) {
+#ifdef HAVE_FFMPEG
+	ProfileScope scope("decodeVideoFrame");
+	VideoFile file;
+	if(!file.open(path, NULL)) {
+		errors << "cannot open video " << path << endl;
+		return NULL;
+	}
+	AVFrame* frame = av_frame_alloc();
+	if(!frame) return NULL;
+	SmartPointer<SDL_Surface> surf;
+	if(file.next(frame) && frame->width > 0 && frame->height > 0) {
+		if(fullW) *fullW = frame->width;
+		if(fullH) *fullH = frame->height;
+		const float s = fitScale(frame->width, frame->height, boxW, boxH);
+		const int w = std::max(int(frame->width * s + 0.5f), 1);
+		const int h = std::max(int(frame->height * s + 0.5f), 1);
+		SwsContext* sws = sws_getContext(frame->width, frame->height, (AVPixelFormat) frame->format,
+			w, h, ArgbFormat, SWS_AREA, NULL, NULL, NULL);
+		surf = pixelPool.createSurface(w, h, SDL_PIXELFORMAT_ARGB8888);
+		if(sws && surf.get()) {
+			uint8_t* dst[4] = {(uint8_t*) surf->pixels, NULL, NULL, NULL};
+			int dstStride[4] = {surf->pitch, 0, 0, 0};
+			sws_scale(sws, frame->data, frame->linesize, 0, frame->height, dst, dstStride);
+		}
+		else
+			surf = NULL;
+		sws_freeContext(sws);
+	}
+	av_frame_free(&frame);
+	return surf;
+#else
+	return NULL;
+#endif
+}
+
+double benchVideoDecode(const fs::path& path, int frames) {
+#ifdef HAVE_FFMPEG
+	if(!isVideoFilename(path)) return 0;
+	const Uint64 start = SDL_GetPerformanceCounter();
+	int n = 0;
+	{
+		VideoStream stream(path);
+		VideoStream::Frame f;
+		while(n < frames && stream.take(f)) {
+			av_frame_free(&f.frame);
+			n++;
+		}
+	}
+	const double secs = double(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+	return (n > 0 && secs > 0) ? n / secs : 0;
+#else
+	return 0;
+#endif
+}
+
+VideoPlayer::VideoPlayer()
+: m_textureW(0), m_textureH(0), m_paused(false), m_pausedAt(0),
+m_haveClock(false), m_clockBase(0), m_loop(0) {
+	m_stats.decoded = m_stats.shown = m_stats.dropped = 0;
+}
+
+VideoPlayer::~VideoPlayer() {
+	stop();
+}
+
+double VideoPlayer::_now() {
+	return double(SDL_GetPerformanceCounter()) / SDL_GetPerformanceFrequency();
+}
+
+bool VideoPlayer::play(const fs::path& path) {
+	if(m_stream && path == m_path) return true;
+	stop();
+	if(!isVideoFilename(path)) return false;
+#ifdef HAVE_FFMPEG
+	m_path = path;
+	m_stream.reset(new VideoStream(path));
+	return true;
+#else
+	return false;
+#endif
+}
+
+void VideoPlayer::stop() {
+	// joins the decode thread
+	m_stream.reset();
+	m_path.clear();
+	m_texture = NULL;
+	m_textureW = m_textureH = 0;
+	m_paused = false;
+	m_haveClock = false;
+	m_loop = 0;
+	m_stats.decoded = m_stats.shown = m_stats.dropped = 0;
+}
+
+void VideoPlayer::togglePause() {
+	if(!m_stream) return;
+	if(m_paused)
+		// continue where it stopped
+		m_clockBase += _now() - m_pausedAt;
+	else
+		m_pausedAt = _now();
+	m_paused = !m_paused;
+}
+
+void VideoPlayer::size(int& w, int& h) const {
+	w = h = 0;
+#ifdef HAVE_FFMPEG
+	if(!m_stream) return;
+	std::lock_guard<std::mutex> lock(m_stream->mutex);
+	w = m_stream->width;
+	h = m_stream->height;
+#endif
+}
+
+void VideoPlayer::_advance() {
+#ifdef HAVE_FFMPEG
+	if(m_paused) return;
+	const double now = _now();
+	AVFrame* show = NULL;
+	bool popped = false;
+	{
+		std::lock_guard<std::mutex> lock(m_stream->mutex);
+		std::deque<VideoStream::Frame>& ring = m_stream->ring;
+		while(!ring.empty()) {
+			const VideoStream::Frame& f = ring.front();
+			if(!m_haveClock || f.loop != m_loop) {
+				// the first frame, or it started over
+				m_haveClock = true;
+				m_loop = f.loop;
+				m_clockBase = now - f.pts;
+			}
+			const double late = now - m_clockBase - f.pts;
+			if(late < 0) break;
+			if(late > MaxLateSecs)
+				m_clockBase = now - f.pts;
+			if(show) {
+				av_frame_free(&show);
+				m_stats.dropped++;
+			}
+			show = f.frame;
+			ring.pop_front();
+			popped = true;
+		}
+	}
+	if(popped) m_stream->cond.notify_all();
+	if(!show) return;
+
+	ProfileScope scope("video upload");
+	if(!m_texture.get() || m_textureW != show->width || m_textureH != show->height) {
+#if SDL_VERSION_ATLEAST(2, 0, 8)
+		SDL_SetYUVConversionMode((show->color_range == AVCOL_RANGE_JPEG || show->format == AV_PIX_FMT_YUVJ420P)
+			? SDL_YUV_CONVERSION_JPEG : SDL_YUV_CONVERSION_AUTOMATIC);
+#endif
+		m_texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_IYUV, SDL_TEXTUREACCESS_STREAMING, show->width, show->height);
+		m_textureW = m_texture.get() ? show->width : 0;
+		m_textureH = m_texture.get() ? show->height : 0;
+		if(!m_texture.get())
+			errors << "cannot create video texture: " << SDL_GetError() << endl;
+	}
+	if(m_texture.get())
+		SDL_UpdateYUVTexture(m_texture.get(), NULL,
+			show->data[0], show->linesize[0],
+			show->data[1], show->linesize[1],
+			show->data[2], show->linesize[2]);
+	av_frame_free(&show);
+	m_stats.shown++;
+#endif
+}
+
+bool VideoPlayer::render(const Viewport& viewport) {
+	if(!m_stream) return false;
+	_advance();
+	if(!m_texture.get()) return false;
+	SDL_Rect src, dst;
+	if(viewport.rects(m_textureW, m_textureH, src, dst))
+		SDL_RenderCopy(renderer, m_texture.get(), &src, &dst);
+	return true;
+}
+
+int VideoPlayer::timeoutMs() const {
+#ifdef HAVE_FFMPEG
+	if(!m_stream || m_paused) return -1;
+	std::lock_guard<std::mutex> lock(m_stream->mutex);
+	if(m_stream->ring.empty()) return -1;
+	const VideoStream::Frame& f = m_stream->ring.front();
+	if(!m_haveClock || f.loop != m_loop) return 0;
+	const double wait = f.pts - (_now() - m_clockBase);
+	return std::max(int(ceil(wait * 1000)), 0);
+#else
+	return -1;
+#endif
+}
+
+VideoPlayer::Stats VideoPlayer::stats() const {
+	Stats s = m_stats;
+#ifdef HAVE_FFMPEG
+	if(m_stream) s.decoded = m_stream->decoded;
+#endif
+	return s;
+}
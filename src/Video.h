@@ -0,0 +1,86 @@
+#ifndef __ImageViewer_Video_h__
+#define __ImageViewer_Video_h__
+
+#include <stddef.h>
+#include <memory>
+#include <SDL.h>
+#include <boost/filesystem.hpp>
+#include <boost/noncopyable.hpp>
+#include "SmartPointer.h"
+#include "Viewport.h"
+
+// Whether it is a video file by its extension. Always false without FFmpeg.
+bool isVideoFilename(const boost::filesystem::path& path);
+
+/*
+The first frame of a video, like decodePicture(): ARGB8888, fitted into
+boxW x boxH. This is what the grid and the prefetching get for a video,
+and what is shown until the playback has its first frame.
+NULL without FFmpeg. This is thread-safe.
+*/
+SmartPointer<SDL_Surface> decodeVideoFrame(const boost::filesystem::path& path, int boxW, int boxH, int* fullW, int* fullH);
+
+// Decodes up to `frames` frames as fast as possible, for --bench.
+// Returns frames per second, 0 if it cannot be played.
+double benchVideoDecode(const boost::filesystem::path& path, int frames);
+
+struct VideoStream;
+
+/*
+Plays the current picture if it is a video. No audio.
+A decode thread (FFmpeg, software, with its own frame threads) fills a
+small ring of frames in YUV 4:2:0, converting only if the video is in
+another format, and waits while the ring is full. The UI thread takes the
+frame which is due by its presentation timestamp, against a clock which
+starts with the first frame, and uploads it into one streaming texture.
+If several are due, i.e. the decoding or the rendering was too slow, all
+but the newest are dropped, so it skips frames instead of falling behind.
+There is no busy waiting: the main loop sleeps until timeoutMs(), and the
+decode thread wakes it via pushDecodedEvent() when the ring was empty.
+Videos loop. UI thread only.
+*/
+class VideoPlayer : boost::noncopyable {
+public:
+	struct Stats {
+		size_t decoded, shown, dropped;
+	};
+
+	VideoPlayer();
+	~VideoPlayer();
+
+	// Starts playing path if it is a video and does not play already.
+	// Stops what played before. Returns whether path plays.
+	bool play(const boost::filesystem::path& path);
+	void stop();
+	bool isPlaying() const { return m_stream.get() != NULL; }
+	void togglePause();
+	// Of the video, 0 until the decode thread opened it.
+	void size(int& w, int& h) const;
+
+	// Uploads the frame which is due, if any, and draws the current one.
+	// false if there is no frame yet.
+	bool render(const Viewport& viewport);
+	// Until the next frame is due, -1 if there is nothing to wait for.
+	int timeoutMs() const;
+	Stats stats() const;
+
+private:
+	boost::filesystem::path m_path;
+	std::unique_ptr<VideoStream> m_stream; // the decode thread and the ring
+	SmartPointer<SDL_Texture> m_texture;
+	int m_textureW, m_textureH;
+	bool m_paused;
+	double m_pausedAt; // _now()
+	bool m_haveClock;
+	double m_clockBase; // now - clockBase is the presentation time, in seconds
+	int m_loop; // of the frames the clock is for
+	Stats m_stats;
+
+	// In seconds.
+	static double _now();
+	void _advance();
+};
+
+extern VideoPlayer videoPlayer;
+
+#endif
@@ -0,0 +1,119 @@
+#include <math.h>
+#include <algorithm>
+#include "Viewport.h"
+
+void Viewport::reset() {
+	fit = true;
+	_clamp();
+}
+
+void Viewport::setViewSize(int w, int h) {
+	if(w == viewW && h == viewH) return;
+	viewW = w;
+	viewH = h;
+	_clamp();
+}
+
+void Viewport::setPictureSize(int w, int h) {
+	if(w == picW && h == picH) return;
+	picW = w;
+	picH = h;
+	_clamp();
+}
+
+double Viewport::fitZoom() const {
+	if(picW <= 0 || picH <= 0 || viewW <= 0 || viewH <= 0) return 1;
+	return std::min(double(viewW) / picW, double(viewH) / picH);
+}
+
+double Viewport::minZoom() const {
+	// Zooming out further than fit is pointless. Small pictures can go down to 1:1.
+	return std::min(fitZoom(), 1.0);
+}
+
+void Viewport::zoomAt(double newZoom, int x, int y) {
+	if(picW <= 0 || picH <= 0) return;
+	newZoom = std::max(std::min(newZoom, maxZoom()), minZoom());
+	// the picture point under (x, y) before
+	const double px = centerX + (x - viewW * 0.5) / zoom;
+	const double py = centerY + (y - viewH * 0.5) / zoom;
+	fit = false;
+	zoom = newZoom;
+	centerX = px - (x - viewW * 0.5) / zoom;
+	centerY = py - (y - viewH * 0.5) / zoom;
+	_clamp();
+}
+
+void Viewport::toggleOneToOne(int x, int y) {
+	if(fit) zoomAt(1, x, y);
+	else reset();
+}
+
+void Viewport::pan(int dx, int dy) {
+	if(fit) return;
+	centerX -= dx / zoom;
+	centerY -= dy / zoom;
+	_clamp();
+}
+
+void Viewport::_clamp() {
+	if(fit) {
+		zoom = fitZoom();
+		centerX = picW * 0.5;
+		centerY = picH * 0.5;
+		return;
+	}
+	// Centered if it is smaller than the view, otherwise the edges stay outside.
+	const double halfW = viewW * 0.5 / zoom, halfH = viewH * 0.5 / zoom;
+	if(picW <= 2 * halfW) centerX = picW * 0.5;
+	else centerX = std::max(std::min(centerX, picW - halfW), halfW);
+	if(picH <= 2 * halfH) centerY = picH * 0.5;
+	else centerY = std::max(std::min(centerY, picH - halfH), halfH);
+}
+
+void Viewport::decodeBox(int& boxW, int& boxH) const {
+	if(fit || picW <= 0 || picH <= 0) {
+		boxW = viewW;
+		boxH = viewH;
+		return;
+	}
+	// The whole picture at the zoomed size. The decoder never goes above the original size.
+	boxW = int(ceil(picW * zoom));
+	boxH = int(ceil(picH * zoom));
+}
+
+bool Viewport::rects(int texW, int texH, SDL_Rect& src, SDL_Rect& dst) const {
+	const SDL_Rect whole = {0, 0, (picW > 0) ? picW : texW, (picH > 0) ? picH : texH};
+	return rects(whole, texW, texH, src, dst);
+}
+
+bool Viewport::rects(const SDL_Rect& part, int texW, int texH, SDL_Rect& src, SDL_Rect& dst) const {
+	if(texW <= 0 || texH <= 0 || viewW <= 0 || viewH <= 0 || part.w <= 0 || part.h <= 0) return false;
+	// texture pixel -> view pixel
+	const double sx = zoom * part.w / texW, sy = zoom * part.h / texH;
+	const double offX = viewW * 0.5 - (centerX - part.x) * zoom, offY = viewH * 0.5 - (centerY - part.y) * zoom;
+	// The visible part, in whole texture pixels. The dst rect is computed from
+	// exactly that, so that the picture does not wobble while panning.
+	const int x0 = std::max(int(floor(-offX / sx)), 0);
+	const int y0 = std::max(int(floor(-offY / sy)), 0);
+	const int x1 = std::min(int(ceil((viewW - offX) / sx)), texW);
+	const int y1 = std::min(int(ceil((viewH - offY) / sy)), texH);
+	if(x0 >= x1 || y0 >= y1) return false;
+	src.x = x0;
+	src.y = y0;
+	src.w = x1 - x0;
+	src.h = y1 - y0;
+	dst.x = int(floor(offX + x0 * sx + 0.5));
+	dst.y = int(floor(offY + y0 * sy + 0.5));
+	dst.w = int(floor(offX + x1 * sx + 0.5)) - dst.x;
+	dst.h = int(floor(offY + y1 * sy + 0.5)) - dst.y;
+	return dst.w > 0 && dst.h > 0;
+}
+
+SDL_Rect Viewport::visibleRect() const {
+	const double halfW = viewW * 0.5 / zoom, halfH = viewH * 0.5 / zoom;
+	const int x0 = std::max(int(floor(centerX - halfW)), 0), y0 = std::max(int(floor(centerY - halfH)), 0);
+	const int x1 = std::min(int(ceil(centerX + halfW)), picW), y1 = std::min(int(ceil(centerY + halfH)), picH);
+	SDL_Rect r = {x0, y0, std::max(x1 - x0, 0), std::max(y1 - y0, 0)};
+	return r;
+}
@@ -0,0 +1,50 @@
+#ifndef __ImageViewer_Viewport_h__
+#define __ImageViewer_Viewport_h__
+
+#include <SDL.h>
+
+/*
+Zoom and pan of the single picture view.
+Everything is in pixels of the original picture (picW x picH), so it does
+not matter at which size the picture is currently decoded.
+In fit mode, the zoom follows the view and picture size.
+*/
+struct Viewport {
+	bool fit;
+	double zoom; // view pixels per original picture pixel
+	double centerX, centerY; // the picture point in the center of the view
+	int viewW, viewH;
+	int picW, picH;
+
+	Viewport() : fit(true), zoom(1), centerX(0), centerY(0), viewW(0), viewH(0), picW(0), picH(0) {}
+
+	void reset(); // back to fit
+	void setViewSize(int w, int h);
+	void setPictureSize(int w, int h);
+
+	double fitZoom() const;
+	double minZoom() const;
+	double maxZoom() const { return 32; }
+	// Keeps the picture point under the view position (x, y) where it is.
+	void zoomAt(double newZoom, int x, int y);
+	void zoomBy(double factor, int x, int y) { zoomAt(zoom * factor, x, y); }
+	// Toggles between fit and 1:1, the latter around (x, y).
+	void toggleOneToOne(int x, int y);
+	// In view pixels, i.e. drag distance.
+	void pan(int dx, int dy);
+
+	// The size to decode the picture at, for decodePicture() & co.
+	void decodeBox(int& boxW, int& boxH) const;
+	// For a texture of the picture at texW x texH (decoded size), the part of it
+	// which is visible and where it goes in the view. false if nothing is visible.
+	bool rects(int texW, int texH, SDL_Rect& src, SDL_Rect& dst) const;
+	// Same for a texture of only the part `part` (in original picture pixels) of it.
+	bool rects(const SDL_Rect& part, int texW, int texH, SDL_Rect& src, SDL_Rect& dst) const;
+	// The part of the picture which is visible, in original picture pixels.
+	SDL_Rect visibleRect() const;
+
+private:
+	void _clamp();
+};
+
+#endif
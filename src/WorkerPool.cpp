@@ -0,0 +1,95 @@
+#include <assert.h>
+#include "WorkerPool.h"
+
+WorkerPool workerPool;
+
+WorkerPool::WorkerPool() : m_quit(false), m_running(0) {}
+
+WorkerPool::~WorkerPool() {
+	stop();
+}
+
+void WorkerPool::start(int numThreads) {
+	stop();
+	m_quit = false;
+	for(int i = 0; i < numThreads; ++i)
+		m_threads.push_back(std::thread(&WorkerPool::_worker, this));
+}
+
+void WorkerPool::stop() {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_quit = true;
+		for(auto& q : m_queues)
+			q.clear();
+	}
+	m_cond.notify_all();
+	for(auto& t : m_threads)
+		t.join();
+	m_threads.clear();
+}
+
+void WorkerPool::push(int queue, const Job& job) {
+	assert(queue >= 0 && queue < NumQueues);
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_queues[queue].push_back(job);
+	}
+	m_cond.notify_one();
+}
+
+void WorkerPool::setQueue(int queue, const std::vector<Job>& jobs) {
+	assert(queue >= 0 && queue < NumQueues);
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_queues[queue].assign(jobs.begin(), jobs.end());
+	}
+	m_cond.notify_all();
+}
+
+void WorkerPool::clearQueue(int queue) {
+	assert(queue >= 0 && queue < NumQueues);
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_queues[queue].clear();
+}
+
+size_t WorkerPool::pendingCount() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	size_t c = 0;
+	for(auto& q : m_queues)
+		c += q.size();
+	return c;
+}
+
+int WorkerPool::runningCount() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_running;
+}
+
+bool WorkerPool::_pop(Job& job) {
+	// expects m_mutex to be locked
+	for(auto& q : m_queues) {
+		if(q.empty()) continue;
+		job = q.front();
+		q.pop_front();
+		return true;
+	}
+	return false;
+}
+
+void WorkerPool::_worker() {
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while(!m_quit) {
+		Job job;
+		if(!_pop(job)) {
+			m_cond.wait(lock);
+			continue;
+		}
+		m_running++;
+		lock.unlock();
+		job();
+		job = Job(); // release captured state outside of the lock
+		lock.lock();
+		m_running--;
+	}
+}
@@ -0,0 +1,53 @@
+#ifndef __ImageViewer_WorkerPool_h__
+#define __ImageViewer_WorkerPool_h__
+
+#include <functional>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <boost/noncopyable.hpp>
+
+/*
+A fixed set of background threads which execute jobs.
+Jobs are organized in a few queues. A lower queue index is more urgent,
+i.e. a worker always takes the first job of the first non-empty queue.
+A queue can be replaced as a whole, which is what the prefetcher does
+whenever the selected picture changes: jobs which are not wanted
+anymore are just dropped if no worker has started them yet.
+*/
+class WorkerPool : boost::noncopyable {
+public:
+	typedef std::function<void()> Job;
+	enum { NumQueues = 4 };
+
+private:
+	std::vector<std::thread> m_threads;
+	std::deque<Job> m_queues[NumQueues];
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+	bool m_quit;
+	int m_running;
+
+	void _worker();
+	bool _pop(Job& job);
+
+public:
+	WorkerPool();
+	~WorkerPool();
+
+	void start(int numThreads);
+	void stop();
+	int numThreads() const { return (int) m_threads.size(); }
+
+	void push(int queue, const Job& job);
+	void setQueue(int queue, const std::vector<Job>& jobs);
+	void clearQueue(int queue);
+	size_t pendingCount();
+	int runningCount();
+};
+
+extern WorkerPool workerPool;
+
+#endif
@@ -2,19 +2,25 @@
 #include <SDL_image.h>
 #include <iostream>
 #include <boost/filesystem.hpp>
-#include <memory>
-#include <list>
 #include <string>
-#include <boost/algorithm/string.hpp>
 #include <algorithm>
-#include <fstream>
-#include "SmartPointer.h"
+#include <stdlib.h>
+#include <math.h>
 #include "Gfx.h"
+#include "Pictures.h"
+#include "WorkerPool.h"
+#include "PictureCache.h"
+#include "PixelPool.h"
+#include "ThumbnailStore.h"
+#include "GridView.h"
+#include "Bench.h"
+#include "Profiler.h"
 #include "Font.h"
+#include "Video.h"
+#include "Animation.h"
 
 
 static auto &errors = std::cerr;
-static auto &notes = std::cout;
 using std::endl;
 
 namespace fs = boost::filesystem;
@@ -23,128 +29,29 @@ bool quit = false;
 bool fullscreen = false;
 static SDL_Window *window;
 SDL_Renderer* renderer;
+SmartPointer<SDL_Renderer> rendererRef;
 
 
-struct Picture {
-	std::shared_ptr<Texture> m_texture;
-	fs::path m_path;
-
-	Picture(const fs::path& path) : m_path(path) {}
-
-	void load() {
-		if(*this) return;
-		Surface surf(IMG_Load(m_path.string().c_str()));
-		if(!surf) {
-			errors << "cannot load " << m_path << ": " << IMG_GetError() << endl;
-			return;
-		}
-		m_texture.reset(new Texture(renderer, surf.m_surf));
-		if(!*m_texture) {
-			errors << "cannot create texture from surface: " << SDL_GetError() << endl;
-			return;
-		}
-	}
-
-	operator bool() const { return m_texture.get() && *m_texture; }
-
-	void render() {
-		if(!m_texture.get()) return;
-		if(!*m_texture) return;
-
-		// TODO: rotate
-		// TODO: correct ratio scale
-		SDL_RenderCopy(renderer, m_texture->m_texture, 0, 0);
-
-		auto t = getTextureForText(m_path.leaf().string(), ColorWhite());
-		if(t.get()) {
-			SDL_Rect dstrect;
-			dstrect.x = 0;
-			dstrect.y = 0;
-			dstrect.w = 100;
-			dstrect.h = 20;
-			SDL_RenderCopy(renderer, t->m_texture, 0, &dstrect);
-		}
-	}
-};
-
-struct Pictures {
-	std::list<Picture> m_pictures;
-	decltype(m_pictures.begin()) m_curPic;
-
-	void addPicture(const Picture& pic) {
-		notes << "Add picture: " << pic.m_path << endl;
-		m_pictures.push_back(pic);
-	}
-
-	void loadFromList(const fs::path& f) {
-		std::ifstream ifs;
-		ifs.open(f.string(), std::ios::in);
-		if(!ifs) {
-			errors << "cannot open " << f << endl;
-			return;
-		}
-		while(!ifs.eof() && !ifs.fail()) {
-			std::string s;
-			std::getline(ifs, s);
-			boost::trim(s);
-			if(s.empty()) continue;
-			fs::path path = f.parent_path() / fs::path(s);
-			if(fs::is_regular_file(path))
-				addPicture(Picture(path));
-			else
-				errors << "file does not exist: " << path.string() << endl;
-		}
-	}
-
-	void loadDir(const fs::path& dir) {
-		for(fs::directory_iterator dir_iter(dir); dir_iter != fs::directory_iterator(); ++dir_iter) {
-			if(fs::is_regular_file(dir_iter->status())) {
-				fs::path path = dir_iter->path();
-				std::string ext = path.extension().string();
-				boost::to_lower(ext);
-				if(ext == ".jpg" || ext == ".jpeg")
-					addPicture(Picture(path));
-			}
-		}
-	}
-
-	void selectPic() {
-		m_curPic = m_pictures.begin();
-		prepareSelectedPic();
-	}
-
-	void nextPic() {
-		if(m_curPic == m_pictures.end()) return;
-		++m_curPic;
-		if(m_curPic == m_pictures.end()) m_curPic = m_pictures.begin();
-		prepareSelectedPic();
-	}
-
-	void prevPic() {
-		if(m_curPic == m_pictures.begin()) {
-			if(m_pictures.empty()) return;
-			m_curPic = m_pictures.end();
-		}
-		--m_curPic;
-		prepareSelectedPic();
-	}
-
-	void prepareSelectedPic() {
-		if(m_curPic == m_pictures.end()) return;
-		m_curPic->load();
-	}
-
-	void render() {
-		if(m_curPic == m_pictures.end()) selectPic();
-		if(m_curPic == m_pictures.end()) return;
-		m_curPic->render();
-	}
-};
-
-static Pictures pictures;
+// Mouse positions are in window coordinates, which differ with high-DPI.
+static void toRendererCoords(int& x, int& y) {
+	int winW = 0, winH = 0, outW = 0, outH = 0;
+	SDL_GetWindowSize(window, &winW, &winH);
+	SDL_GetRendererOutputSize(renderer, &outW, &outH);
+	if(winW <= 0 || winH <= 0) return;
+	x = x * outW / winW;
+	y = y * outH / winH;
+}
 
+static void zoomAtMouse(double factor) {
+	int x = 0, y = 0;
+	SDL_GetMouseState(&x, &y);
+	toRendererCoords(x, y);
+	pictures.zoom(factor, x, y);
+}
 
 static void onKeyDown(SDL_KeyboardEvent& ev) {
+	if(gridView.isActive() && gridView.onKeyDown(ev))
+		return;
 	switch(ev.keysym.sym) {
 		case SDLK_ESCAPE:
 		case 'q':
@@ -162,35 +69,277 @@ static void onKeyDown(SDL_KeyboardEvent& ev) {
 		case SDLK_RIGHT:
 			pictures.nextPic();
 			break;
+		case SDLK_HOME:
+			pictures.selectIndex(0);
+			break;
+		case SDLK_END:
+			if(!pictures.empty()) pictures.selectIndex(pictures.size() - 1);
+			break;
+		case SDLK_PAGEUP:
+			// 10% of the list, at least one
+			pictures.jump(-std::max(long(pictures.size() / 10), 1L));
+			break;
+		case SDLK_PAGEDOWN:
+			pictures.jump(std::max(long(pictures.size() / 10), 1L));
+			break;
+		case 's':
+			pictures.setSortMode(Catalogue::SortMode((pictures.m_sortMode + 1) % Catalogue::NumSortModes));
+			break;
+		case 'n':
+			pictures.setFollow(!pictures.m_follow);
+			break;
+		case 'g':
+			gridView.enter();
+			break;
+		case 'p':
+			profiler.setOverlay(!profiler.overlay());
+			break;
+		case SDLK_SPACE:
+			videoPlayer.togglePause();
+			animationPlayer.togglePause();
+			break;
+		case 'z':
+			pictures.toggleZoom(pictures.m_viewW / 2, pictures.m_viewH / 2);
+			break;
+		case SDLK_PLUS:
+		case SDLK_EQUALS:
+		case SDLK_KP_PLUS:
+			pictures.zoom(1.25, pictures.m_viewW / 2, pictures.m_viewH / 2);
+			break;
+		case SDLK_MINUS:
+		case SDLK_KP_MINUS:
+			pictures.zoom(1 / 1.25, pictures.m_viewW / 2, pictures.m_viewH / 2);
+			break;
 		default:
+			// 0..9 jumps to 0%..90%
+			if(ev.keysym.sym >= '0' && ev.keysym.sym <= '9')
+				pictures.jumpToFraction((ev.keysym.sym - '0') / 10.0f);
 			break;
 	}
 }
 
-static void mainLoop() {
-	while(true) {
-		SDL_RenderClear(renderer);
-		pictures.render();
-		SDL_RenderPresent(renderer);
+static void updateViewSize() {
+	int w = 0, h = 0;
+	SDL_GetRendererOutputSize(renderer, &w, &h);
+	pictures.setViewSize(w, h);
+}
 
-		SDL_Event ev;
-		if(SDL_WaitEvent(&ev) == 0)
+// Set whenever something visible changed. Only then a frame is drawn.
+static bool dirty = true;
+
+void requestRedraw() {
+	dirty = true;
+}
+
+// Key repeats of a held arrow key. Those which queued up while we were busy
+// are summed up into a single step, so that the pictures in between are
+// skipped instead of all being decoded.
+static long pendingSteps = 0;
+
+static void flushSteps() {
+	if(pendingSteps == 0) return;
+	pictures.step(pendingSteps);
+	pendingSteps = 0;
+}
+
+static void handleEvent(SDL_Event& ev) {
+	if(ev.type == PictureDecodedEvent) {
+		decodedEventHandled();
+		// Just redraw. Pictures::render() uploads it if it is the current one.
+		dirty = true;
+		return;
+	}
+	if(ev.type == SDL_KEYDOWN && ev.key.repeat && !gridView.isActive()
+			&& (ev.key.keysym.sym == SDLK_LEFT || ev.key.keysym.sym == SDLK_RIGHT)) {
+		pendingSteps += (ev.key.keysym.sym == SDLK_RIGHT) ? 1 : -1;
+		dirty = true;
+		return;
+	}
+	flushSteps();
+
+	switch(ev.type) {
+		case SDL_KEYDOWN:
+			onKeyDown(ev.key);
+			dirty = true;
+			break;
+		case SDL_MOUSEWHEEL:
+			if(gridView.isActive()) gridView.onMouseWheel(ev.wheel);
+			else zoomAtMouse(pow(1.25, ev.wheel.y));
+			dirty = true;
 			break;
+		case SDL_MOUSEBUTTONDOWN:
+			if(gridView.isActive()) gridView.onMouseButtonDown(ev.button);
+			else if(ev.button.button == SDL_BUTTON_LEFT && ev.button.clicks >= 2) {
+				int x = ev.button.x, y = ev.button.y;
+				toRendererCoords(x, y);
+				pictures.toggleZoom(x, y);
+			}
+			dirty = true;
+			break;
+		case SDL_MOUSEMOTION:
+			// drag to pan
+			if(!gridView.isActive() && (ev.motion.state & SDL_BUTTON_LMASK)) {
+				int dx = ev.motion.xrel, dy = ev.motion.yrel;
+				toRendererCoords(dx, dy);
+				pictures.pan(dx, dy);
+				dirty = true;
+			}
+			break;
+		case SDL_WINDOWEVENT:
+			switch(ev.window.event) {
+				case SDL_WINDOWEVENT_SIZE_CHANGED:
+					updateViewSize();
+					dirty = true;
+					break;
+				case SDL_WINDOWEVENT_EXPOSED:
+				case SDL_WINDOWEVENT_SHOWN:
+				case SDL_WINDOWEVENT_RESTORED:
+					dirty = true;
+					break;
+				default:
+					break;
+			}
+			break;
+		case SDL_QUIT:
+			quit = true;
+			break;
+		default:
+			break;
+	}
+}
 
-		switch(ev.type) {
-			case SDL_KEYDOWN:
-				onKeyDown(ev.key);
-				break;
-			case SDL_QUIT:
-				return;
-			default:
+static void mainLoop() {
+	while(!quit) {
+		if(pictures.pollScan())
+			dirty = true;
+		if(pictures.pollWatch()) {
+			dirty = true;
+			gridView.catalogueChanged();
+		}
+		if(dirty) {
+			dirty = false;
+			const Uint64 frameStart = profiler.now();
+			SDL_RenderClear(renderer);
+			if(gridView.isActive()) {
+				videoPlayer.stop();
+				animationPlayer.stop();
+				gridView.render();
+			}
+			else
+				pictures.render();
+			profiler.renderOverlay();
+			{
+				ProfileScope scope("SDL_RenderPresent");
+				SDL_RenderPresent(renderer);
+			}
+			profiler.frameDone(frameStart);
+		}
+		// Unless something wants another frame right away, sleep until something
+		// happens (input, a worker is done, the scanner found more), the overlay
+		// wants to show new numbers, or the next video or animation frame is due.
+		if(!dirty) {
+			SDL_Event ev;
+			int timeoutMs = profiler.overlayTimeoutMs();
+			for(int ms : {videoPlayer.timeoutMs(), animationPlayer.timeoutMs()})
+				if(ms >= 0 && (timeoutMs < 0 || ms < timeoutMs))
+					timeoutMs = ms;
+			if(timeoutMs >= 0) {
+				if(!SDL_WaitEventTimeout(&ev, timeoutMs)) {
+					dirty = true;
+					continue;
+				}
+			}
+			else if(!SDL_WaitEvent(&ev))
 				break;
+			handleEvent(ev);
 		}
-		if(quit) return;
+
+		// All which queued up meanwhile, before the next frame.
+		SDL_Event ev;
+		while(!quit && SDL_PollEvent(&ev))
+			handleEvent(ev);
+		flushSteps();
 	}
 }
 
+static void usage(const char* prog) {
+	errors << "usage: " << prog << " [options] [dir | listfile | -]" << endl
+		<< "  --threads N   number of background decode threads (0: decode in UI thread)" << endl
+		<< "  --ahead N     number of pictures to prefetch in the direction of travel" << endl
+		<< "  --behind N    number of pictures to prefetch against the direction of travel" << endl
+		<< "  --recursive N scan subdirectories up to depth N (default: 0)" << endl
+		<< "  --follow 0|1  select each picture which appears in the directory, also key n (default: 0)" << endl
+		<< "  --sort MODE   none, name, mtime, size or date (EXIF) (default: name, none for a listfile)" << endl
+		<< "  --cache-mb N  memory budget for decoded pictures (default: 1/4 of RAM)" << endl
+		<< "  --pool-mb N   max unused pixel buffers kept for reuse (default: 256)" << endl
+		<< "  --anim-mb N   memory budget for the frames of animations (default: 1/16 of RAM)" << endl
+		<< "  --bench FILE  no window, decode and render all pictures once and write timings as JSON to FILE" << endl
+		<< "  --trace FILE  write a Chrome trace (chrome://tracing, ui.perfetto.dev) of the session to FILE" << endl
+		<< "  --thumbs FILE thumbnail store (default: " << ThumbnailStore::defaultFile().string() << ", none: disabled)" << endl
+		<< "  --font FILE   TrueType font for the overlays (default: sans-serif via fontconfig or the font directories)" << endl;
+}
+
 int main(int argc, char** argv) {
+	int numThreads = -1;
+	int cacheMB = -1;
+	int poolMB = -1;
+	int animMB = -1;
+	int scanDepth = 0;
+	bool sortGiven = false;
+	fs::path thumbsFile = ThumbnailStore::defaultFile();
+	fs::path benchFile;
+	fs::path traceFile;
+	fs::path path;
+	for(int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if(arg.size() > 2 && arg.substr(0, 2) == "--") {
+			if(i + 1 >= argc) {
+				usage(argv[0]);
+				return 1;
+			}
+			std::string strValue = argv[++i];
+			int value = atoi(strValue.c_str());
+			if(arg == "--threads") numThreads = value;
+			else if(arg == "--ahead") pictures.m_prefetchAhead = std::max(value, 0);
+			else if(arg == "--behind") pictures.m_prefetchBehind = std::max(value, 0);
+			else if(arg == "--cache-mb") cacheMB = value;
+			else if(arg == "--pool-mb") poolMB = value;
+			else if(arg == "--anim-mb") animMB = value;
+			else if(arg == "--recursive") scanDepth = std::max(value, 0);
+			else if(arg == "--follow") pictures.m_follow = value != 0;
+			else if(arg == "--sort") {
+				if(!Catalogue::parseSortMode(strValue, pictures.m_sortMode)) {
+					usage(argv[0]);
+					return 1;
+				}
+				sortGiven = true;
+			}
+			else if(arg == "--bench") benchFile = strValue;
+			else if(arg == "--trace") traceFile = strValue;
+			else if(arg == "--font") setFontFile(strValue);
+			else if(arg == "--thumbs") thumbsFile = (strValue == "none") ? fs::path() : fs::path(strValue);
+			else {
+				usage(argv[0]);
+				return 1;
+			}
+		}
+		else if(path.empty())
+			path = arg;
+		else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if(!benchFile.empty()) {
+		// headless and without GPU. can be overwritten from outside
+		setenv("SDL_VIDEODRIVER", "dummy", 0);
+		SDL_SetHint(SDL_HINT_RENDER_DRIVER, "software");
+		// measure only the decoding we do in runBench()
+		numThreads = 0;
+		thumbsFile = fs::path();
+	}
+
 	if(SDL_Init(SDL_INIT_EVERYTHING) != 0) {
 		errors << "SDL_Init failed: " << SDL_GetError() << endl;
 		return 1;
@@ -204,41 +353,86 @@ int main(int argc, char** argv) {
 	window = SDL_CreateWindow(
 			"ImageViewer",
 			SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
-			640, 480,
-			0);
+			benchFile.empty() ? 640 : 1920, benchFile.empty() ? 480 : 1080,
+			benchFile.empty() ? 0 : SDL_WINDOW_HIDDEN);
 	if(!window) {
 		errors << "cannot create window: " << SDL_GetError() << endl;
 		return 1;
 	}
 
-	renderer = SDL_CreateRenderer(window, -1, 0);
+	// vsync, so that switching from the preview to the full picture never tears
+	renderer = SDL_CreateRenderer(window, -1, benchFile.empty() ? SDL_RENDERER_PRESENTVSYNC : SDL_RENDERER_SOFTWARE);
 	if(!renderer) {
 		errors << "cannot create renderer: " << SDL_GetError() << endl;
 		return 1;
 	}
+	rendererRef = renderer;
+	// For all textures created from now on. Together with the mipmaps, zooming out is not aliased.
+	SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "linear");
 
 	SDL_RenderClear(renderer);
 
-	if(argc > 1) {
-		fs::path path = argv[1];
-		if(fs::is_regular_file(path))
+	pictureCache.setBudget((cacheMB >= 0) ? size_t(cacheMB) * 1024 * 1024 : PictureCache::defaultBudget());
+	if(poolMB >= 0)
+		pixelPool.setCap(size_t(poolMB) * 1024 * 1024);
+	if(animMB >= 0)
+		animationPlayer.setCacheBudget(size_t(animMB) * 1024 * 1024);
+	pixelPool.startIdleTrim();
+
+	if(!thumbsFile.empty())
+		thumbnailStore.open(thumbsFile);
+
+	if(!traceFile.empty())
+		profiler.startTrace(traceFile);
+
+	PictureDecodedEvent = SDL_RegisterEvents(1);
+	if(numThreads < 0)
+		numThreads = std::max(SDL_GetCPUCount() - 1, 1);
+	workerPool.start(numThreads);
+	updateViewSize();
+
+	if(!path.empty()) {
+		if(path == "-" || (fs::exists(path) && !fs::is_directory(path))) {
+			// keep the order of the list, unless asked otherwise
+			if(!sortGiven) pictures.m_sortMode = Catalogue::SortNone;
 			pictures.loadFromList(path);
+		}
 		else if(fs::is_directory(path))
-			pictures.loadDir(path);
+			pictures.loadDir(path, scanDepth);
 		else {
 			errors << "not found: " << path.string() << endl;
 			return 1;
 		}
 	}
 	else
-		pictures.loadDir(".");
-	pictures.selectPic();
+		pictures.loadDir(".", scanDepth);
 
-	mainLoop();
+	int ret = 0;
+	if(!benchFile.empty()) {
+		// on a fixed set of pictures
+		pictures.stopWatching();
+		ret = runBench(benchFile);
+	}
+	else {
+		pictures.selectPic();
+		mainLoop();
+	}
 
-	SDL_DestroyRenderer(renderer);
+	pictures.m_scanner.cancel();
+	pictures.stopWatching();
+	workerPool.stop();
+	profiler.writeTrace();
+	gridView.clear();
+	videoPlayer.stop();
+	animationPlayer.clear();
+	pictureCache.clear();
+	clearText();
+	thumbnailStore.close();
+	// Destroys the renderer if nothing else references it anymore.
+	rendererRef = NULL;
+	renderer = NULL;
 	SDL_DestroyWindow(window);
 
-	return 0;
+	return ret;
 }
 
@@ -0,0 +1,94 @@
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include "Tests.h"
+#include "PixelKernels.h"
+
+static auto &errors = std::cerr;
+using std::endl;
+
+namespace {
+
+// Odd sizes, so that the scalar tails of the SIMD variants are used as well.
+const int W = 333, H = 17;
+const size_t RowBytes = W * 4;
+
+struct Kernel {
+	const char* name;
+	size_t outBytes;
+	bool inPlace; // out starts as a copy of the input, otherwise zeroed
+	void (*run)(const PixelKernels& k, const std::vector<Uint8>& in, std::vector<Uint8>& out);
+};
+
+const Kernel Kernels[] = {
+	{"rgb24ToArgb", RowBytes * H, false,
+		[](const PixelKernels& k, const std::vector<Uint8>& in, std::vector<Uint8>& out) {
+			for(int y = 0; y < H; ++y)
+				k.rgb24ToArgb(&in[y * W * 3], (Uint32*) &out[y * RowBytes], W - y); // also shorter rows
+		}},
+	{"bgr24ToArgb", RowBytes * H, false,
+		[](const PixelKernels& k, const std::vector<Uint8>& in, std::vector<Uint8>& out) {
+			for(int y = 0; y < H; ++y)
+				k.bgr24ToArgb(&in[y * W * 3], (Uint32*) &out[y * RowBytes], W - y);
+		}},
+	{"abgrToArgb", RowBytes * H, true,
+		[](const PixelKernels& k, const std::vector<Uint8>&, std::vector<Uint8>& out) {
+			for(int y = 0; y < H; ++y)
+				k.abgrToArgb((Uint32*) &out[y * RowBytes], W - y);
+		}},
+	{"premultiply", RowBytes * H, true,
+		[](const PixelKernels& k, const std::vector<Uint8>&, std::vector<Uint8>& out) {
+			for(int y = 0; y < H; ++y)
+				k.premultiply((Uint32*) &out[y * RowBytes], W - y);
+		}},
+	{"halveRow", W / 2 * 4 * (H / 2), false,
+		[](const PixelKernels& k, const std::vector<Uint8>& in, std::vector<Uint8>& out) {
+			for(int y = 0; y < H / 2; ++y)
+				k.halveRow(&in[y * 2 * RowBytes], &in[(y * 2 + 1) * RowBytes], &out[y * (W / 2) * 4], W / 2 - y);
+		}},
+	{"accumulateRow", RowBytes * 4 * H, false,
+		[](const PixelKernels& k, const std::vector<Uint8>& in, std::vector<Uint8>& out) {
+			for(int y = 0; y < H; ++y)
+				k.accumulateRow(&in[y * RowBytes], (Uint32*) &out[y * RowBytes * 4], RowBytes - y, y ? (1 << 15) / y : 1 << 15);
+		}},
+};
+
+// Random bytes, and the extremes, which are where rounding goes wrong.
+std::vector<Uint8> makeInput(int pattern) {
+	std::vector<Uint8> in(RowBytes * H);
+	Uint32 r = 2463534242u;
+	for(size_t i = 0; i < in.size(); ++i) {
+		// xorshift
+		r ^= r << 13; r ^= r >> 17; r ^= r << 5;
+		switch(pattern) {
+			case 0: in[i] = Uint8(r); break;
+			case 1: in[i] = (r & 1) ? 255 : 0; break;
+			default: in[i] = Uint8(i % 4 == 3 ? r % 3 : 255 - r % 3); break; // alpha near 0
+		}
+	}
+	return in;
+}
+
+}
+
+// All variants this CPU supports must give exactly the output of the scalar one.
+bool testPixelKernels() {
+	const std::vector<const PixelKernels*> variants = supportedPixelKernels();
+	bool ok = true;
+	for(int pattern = 0; pattern < 3; ++pattern) {
+		const std::vector<Uint8> in = makeInput(pattern);
+		for(const Kernel& kernel : Kernels) {
+			std::vector<Uint8> reference;
+			for(const PixelKernels* k : variants) {
+				std::vector<Uint8> out(kernel.outBytes, 0);
+				if(kernel.inPlace) std::copy(in.begin(), in.begin() + out.size(), out.begin());
+				kernel.run(*k, in, out);
+				if(reference.empty()) { reference = out; continue; } // the scalar one is first
+				if(out == reference) continue;
+				errors << k->name << " " << kernel.name << " differs from the scalar reference (input " << pattern << ")" << endl;
+				ok = false;
+			}
+		}
+	}
+	return ok;
+}
@@ -0,0 +1,61 @@
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <iostream>
+#include "Tests.h"
+#include "SmartPointer.h"
+
+static auto &errors = std::cerr;
+using std::endl;
+
+namespace {
+
+const int Threads = 4;
+const int Steps = 250000; // per thread
+
+struct StressObj {
+	static std::atomic<int> alive;
+	StressObj() { alive++; }
+	~StressObj() { alive--; }
+};
+std::atomic<int> StressObj::alive(0);
+
+}
+
+// The threads copy, move and drop random ones of a shared set of pointers.
+// In the end, all must have been destroyed exactly once.
+bool testSmartPointer() {
+	const int numObjs = 64;
+	std::vector<SmartPointer<StressObj> > objs;
+	for(int i = 0; i < numObjs; ++i)
+		objs.push_back(SmartPointer<StressObj>(new StressObj()));
+	std::vector<std::thread> ts;
+	for(int i = 0; i < Threads; ++i)
+		ts.push_back(std::thread([&objs, i]() {
+			std::vector<SmartPointer<StressObj> > mine(16);
+			unsigned r = 2463534242u + i;
+			for(int n = 0; n < Steps; ++n) {
+				// xorshift
+				r ^= r << 13; r ^= r >> 17; r ^= r << 5;
+				SmartPointer<StressObj>& slot = mine[r % mine.size()];
+				switch((r >> 8) % 4) {
+					case 0: slot = objs[(r >> 12) % objs.size()]; break;
+					case 1: slot = std::move(mine[(r >> 12) % mine.size()]); break;
+					case 2: slot = NULL; break;
+					default: { SmartPointer<StressObj> copy(slot); slot = copy; }
+				}
+			}
+		}));
+	for(auto& th : ts) th.join();
+	bool ok = StressObj::alive == numObjs;
+	for(auto& o : objs)
+		if(o.getRefCount() != 1) ok = false;
+	if(!ok)
+		errors << "references left after the threads: " << StressObj::alive << " objects alive" << endl;
+	objs.clear();
+	if(StressObj::alive != 0) {
+		errors << StressObj::alive << " objects not destroyed" << endl;
+		ok = false;
+	}
+	return ok;
+}
@@ -0,0 +1,13 @@
+#ifndef __ImageViewer_Tests_h__
+#define __ImageViewer_Tests_h__
+
+/*
+Checks of the parts which can be tested without a window, a renderer or
+pictures. Each returns false and prints what is wrong if it fails.
+Run by ctest, one test per check (see main.cpp).
+*/
+bool testPixelKernels();
+bool testSmartPointer();
+bool testTileLayout();
+
+#endif
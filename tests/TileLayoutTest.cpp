@@ -0,0 +1,80 @@
+#include <algorithm>
+#include <iostream>
+#include "Tests.h"
+#include "TileLayout.h"
+
+static auto &errors = std::cerr;
+using std::endl;
+
+namespace {
+
+// Sizes around the edge cases of the max texture size.
+struct TileCase { int w, h, maxTextureSize; };
+const TileCase TileCases[] = {
+	{4096, 2048, 2048}, // divides evenly
+	{4097, 2049, 2048}, // one pixel past it
+	{2049, 1, 1024},
+	{1, 1, 2048},
+	{300, 200, 0}, // no limit
+	{5000, 3000, 0}, // no limit, but still MaxTileSize
+	{1000, 1000, 333},
+};
+
+// Tiles must cover the surface exactly, with full tiles except for the
+// remainder at the right/bottom edge. tileRange() of the corners must give
+// the corner tiles, and the drawn tiles must abut without gaps.
+bool checkTiles(const TileCase& c) {
+	TileLayout l;
+	if(!l.init(c.w, c.h, c.maxTextureSize, c.maxTextureSize)) return false;
+	const int limit = (c.maxTextureSize > 0) ? std::min(c.maxTextureSize, int(TileLayout::MaxTileSize)) : int(TileLayout::MaxTileSize);
+	if(l.tileW > limit || l.tileH > limit) return false;
+	long long area = 0;
+	for(int i = 0; i < l.count(); ++i) {
+		const SDL_Rect r = l.tileRect(i);
+		const int col = i % l.numHoriz, row = i / l.numHoriz;
+		if(r.x != col * l.tileW || r.y != row * l.tileH) return false;
+		if(r.w <= 0 || r.h <= 0 || r.w > l.tileW || r.h > l.tileH) return false;
+		if((col < l.numHoriz - 1 && r.w != l.tileW) || (row < l.numVert - 1 && r.h != l.tileH)) return false;
+		if((col == l.numHoriz - 1 && r.x + r.w != c.w) || (row == l.numVert - 1 && r.y + r.h != c.h)) return false;
+		area += (long long) r.w * r.h;
+	}
+	if(area != (long long) c.w * c.h) return false;
+
+	int hs, he, vs, ve;
+	const SDL_Rect all = {0, 0, c.w, c.h};
+	if(!l.tileRange(all, hs, he, vs, ve) || hs != 0 || vs != 0 || he != l.numHoriz || ve != l.numVert) return false;
+	const SDL_Rect last = {c.w - 1, c.h - 1, 1, 1};
+	if(!l.tileRange(last, hs, he, vs, ve) || hs != l.numHoriz - 1 || he != l.numHoriz || vs != l.numVert - 1 || ve != l.numVert) return false;
+	const SDL_Rect outside = {c.w, c.h, 1, 1};
+	if(l.tileRange(outside, hs, he, vs, ve)) return false;
+
+	// Drawn scaled down and up. Each tile starts where the one before ended.
+	for(float scale : {0.37f, 1.0f, 2.5f}) {
+		const SDL_Rect dst = {7, 3, std::max(int(c.w * scale), 1), std::max(int(c.h * scale), 1)};
+		int nextX = dst.x, nextY = dst.y;
+		for(int i = 0; i < l.numHoriz; ++i) {
+			const SDL_Rect d = TileLayout::mapRect(l.tileRect(i), all, dst);
+			if(d.x != nextX) return false;
+			nextX = d.x + d.w;
+		}
+		for(int i = 0; i < l.numVert; ++i) {
+			const SDL_Rect d = TileLayout::mapRect(l.tileRect(i * l.numHoriz), all, dst);
+			if(d.y != nextY) return false;
+			nextY = d.y + d.h;
+		}
+		if(nextX != dst.x + dst.w || nextY != dst.y + dst.h) return false;
+	}
+	return true;
+}
+
+}
+
+bool testTileLayout() {
+	bool ok = true;
+	for(const TileCase& c : TileCases)
+		if(!checkTiles(c)) {
+			errors << "tiling of " << c.w << "x" << c.h << " with max texture size " << c.maxTextureSize << " is wrong" << endl;
+			ok = false;
+		}
+	return ok;
+}
@@ -0,0 +1,38 @@
+#include <string.h>
+#include <iostream>
+#include "Tests.h"
+
+static auto &errors = std::cerr;
+using std::endl;
+
+namespace {
+
+struct Test {
+	const char* name;
+	bool (*run)();
+};
+
+const Test Tests[] = {
+	{"kernels", testPixelKernels},
+	{"smartpointer", testSmartPointer},
+	{"tiles", testTileLayout},
+};
+
+}
+
+// ImageViewerTests [name]. Without a name, all are run.
+int main(int argc, char** argv) {
+	int failed = 0, ran = 0;
+	for(const Test& t : Tests) {
+		if(argc > 1 && strcmp(argv[1], t.name) != 0) continue;
+		ran++;
+		if(t.run()) continue;
+		errors << "test " << t.name << " failed" << endl;
+		failed++;
+	}
+	if(ran == 0) {
+		errors << "no test " << argv[1] << endl;
+		return 1;
+	}
+	return failed ? 1 : 0;
+}